@@ -6,4 +6,20 @@
 LUALIB_API int
 luaopen_ber (lua_State *L);
 
+/* Octets of string or slice value (NULL - neither) */
+LUALIB_API const char *
+luaber_tolstring (lua_State *L, int idx, size_t *len);
+
+struct mmodr;
+
+/* Open odr_udata set by compiled decoders (asn2odr -C), with the
+ * metatables of require "ber" as they are */
+LUALIB_API int
+luaber_open_odr (lua_State *L, int (*set) (struct mmodr *mo));
+
+struct ber_visitor;
+
+/* Visitor of bers with values on the stack of lua_State (bers.ud) */
+extern const struct ber_visitor luaber_visitor;
+
 #endif
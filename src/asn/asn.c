@@ -52,10 +52,14 @@
 
 #include "asn.h"
 #include "map.h"
+#include "code.h"
 
 
-static const char usage[] = "Usage: asn2odr [-n] [FILE ...] -s FILE ...\n"
+static const char usage[] = "Usage: asn2odr [-n] [-d] [-C NAME] [-T NAME] [FILE ...] -s FILE ...\n"
 		"\t-n - don't add names (global)\n"
+		"\t-d - don't add tag dispatch index\n"
+		"\t-C - write C decoders and encoders to NAME.c\n"
+		"\t-T - write C structs of types to NAME.h, NAME.c\n"
 		"\t-s - start file\n";
 
 static FILE *fi, *fo;
@@ -68,6 +72,11 @@ static struct odr_info info;
 
 static char is_sfile; /* start from current file? */
 static char is_names = 1; /* add names */
+static char is_disp = 1; /* add tag dispatch index */
+static const char *code_name; /* write C decoders */
+static const char *types_name; /* write C structs of types */
+static struct code_def *types; /* named types of modules */
+static int types_size, types_next;
 
 
 /* Universal tags (simple types) */
@@ -607,6 +616,38 @@ asnModuleId (unsigned char *oid)
     lex ();
 }
 
+/* Collect named types (not simple) of current module
+ * in order of definition
+ */
+static void
+asnTypes ()
+{
+    struct def *d;
+    int n = types_next, i;
+
+    for (d = mcur->defn; d; d = d->next) {
+	struct code_def *cd;
+	if (d->opt & (DEF_IMPORT | DEF_INCOMPL | FORWARD)
+	 || (d->tag.opt & TAG_SIMPLE))
+	    continue;
+	if (types_next >= types_size) {
+	    types = realloc (types,
+	     (types_size += 256) * sizeof (struct code_def));
+	    if (!types) asnError ("Types realloc\n");
+	}
+	cd = types + types_next++;
+	strncpy (cd->name, d->name, CODE_NAMESIZ - 1);
+	cd->name[CODE_NAMESIZ - 1] = '\0';
+	cd->tag = d->tag;
+    }
+    /* definitions are prepended */
+    for (i = 0; i < (types_next - n) / 2; ++i) {
+	struct code_def cd = types[n + i];
+	types[n + i] = types[types_next - 1 - i];
+	types[types_next - 1 - i] = cd;
+    }
+}
+
 /* Parses a collection of module specifications */
 static void
 asnModules ()
@@ -639,6 +680,7 @@ asnModules ()
 	if (!lex_name_move ("BEGIN"))
 	    asnError ("BEGIN expected\n");
 	asnModuleBody ();
+	if (types_name) asnTypes ();
 	if (!exports_all)
 	    /* defn -> imports -> exports */
 	    def_del (mcur, mcur->exports, DEF_INCOMPL | FORWARD);
@@ -684,13 +726,26 @@ module_cmp (const void *m1, const void *m2)
 static void
 asnOut ()
 {
+    struct odr_disp *disps = NULL;
+    struct odr_list *lists;
     int i;
 
     info.nodrs = odrs_next;
+    lists = calloc (odrs_next, sizeof (struct odr_list));
+    if (!lists) perror ("Lists calloc");
+    if (is_disp)
+	info.ndisps = disp_build (&disps, lists);
+    list_hints (lists);
+    memset (odrs, 0, sizeof (struct tmt));
     *((struct odr_info *) odrs) = info;
     fo = fopen ("asn.odr", "wb");
     if (!fo) asnError ("Create odr file\n");
     fwrite (odrs, sizeof (struct tmt), odrs_next, fo);
+    if (info.ndisps)
+	fwrite (disps, sizeof (struct odr_disp), info.ndisps, fo);
+    fwrite (lists, sizeof (struct odr_list), odrs_next, fo);
+    free (disps);
+    free (lists);
     /* reuse odrs area to sort modules.oid */
     for (i = 0; modules; module_del (modules))
 	if (modules->id.oid[0])
@@ -721,6 +776,19 @@ main (int argc, char *argv[])
 	    case 'n':
 		is_names = 0;
 		break;
+	    case 'd':
+		is_disp = 0;
+		break;
+	    case 'C':
+		if (++i >= argc)
+		    fprintf (stderr, usage), exit (EXIT_FAILURE);
+		code_name = argv[i];
+		break;
+	    case 'T':
+		if (++i >= argc)
+		    fprintf (stderr, usage), exit (EXIT_FAILURE);
+		types_name = argv[i];
+		break;
 	    case 's':
 		info.start = odrs_next;
 		is_sfile = 1;
@@ -733,5 +801,10 @@ main (int argc, char *argv[])
     if (!info.start)
 	fprintf (stderr, usage), exit (EXIT_FAILURE);
     asnOut ();
+    if (code_name) code_out (code_name, "asn.odr");
+    if (types_name) {
+	code_types (types_name, "asn.odr", types, types_next);
+	free (types);
+    }
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,1088 @@
+/* C code of decoders and encoders (asn2odr -C).
+ * Each components list becomes a function with switch by tag,
+ * which follows the ber_decode() rules of searching tmt:
+ * SEQUENCE - in order of components, skipping OPTIONAL ones;
+ * CHOICE - any alternative first;
+ * SEQUENCE OF - the element again and again;
+ * untagged CHOICE's are descended to the found alternative.
+ * Its encoder follows the ber_encode() rules of taking values:
+ * SEQUENCE - present components by position;
+ * CHOICE - the first present alternative;
+ * SEQUENCE OF - elements up to absent one, each as the first tmt.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mmodr.h"
+#include "code.h"
+
+
+#define CODE_CHOICES	8	/* CHOICES_MAX of ber.h */
+#define CODE_TAGS	1024	/* tags of list */
+
+/* Kinds of components lists */
+enum {LIST_SEQ, LIST_CHOICE, LIST_OF, LIST_OF_CHOICE, LIST_KINDS};
+static const char kind_ch[] = "scoe";
+
+static struct mmodr mo;
+static char id[64];	/* prefix of exported names */
+static FILE *fo;
+
+/* lists to write: done marks and queue of (addr, kind) */
+static unsigned char *done;
+static int *todo, todo_next;
+/* encoders of lists to write: the same of encoders */
+static unsigned char *edone;
+static int *etodo, etodo_next;
+
+
+static void
+codeError (const char *msg)
+{
+    perror (msg);
+    exit (EXIT_FAILURE);
+}
+
+/* Queue list of kind; return the address */
+static int
+list_req (const int addr, const int kind)
+{
+    if (!done[addr * LIST_KINDS + kind]) {
+	done[addr * LIST_KINDS + kind] = 1;
+	todo[todo_next++] = addr * LIST_KINDS + kind;
+    }
+    return addr;
+}
+
+/* Queue encoder of list of kind; return the address */
+static int
+enc_req (const int addr, const int kind)
+{
+    if (!edone[addr * LIST_KINDS + kind]) {
+	edone[addr * LIST_KINDS + kind] = 1;
+	etodo[etodo_next++] = addr * LIST_KINDS + kind;
+    }
+    return addr;
+}
+
+static int
+list_kind (const struct tmt *t)
+{
+    return ((t->opt & TAG_TYPE_OF) ? LIST_OF : LIST_SEQ)
+     + ((t->opt & TAG_CHOICE) ? 1 : 0);
+}
+
+/* Find tmt of tag in list at addr (first in order, descending untagged
+ * CHOICE's). Return count of choices in chain (-1 - not found)
+ */
+static int
+tag_find (int addr, const tag_id_t cn, int *chain, const int level)
+{
+    for (; addr; addr = mo.odrs[addr].comp_next) {
+	const struct tmt *t = mo.odrs + addr;
+	if (t->u.cn == cn) {
+	    chain[level] = addr;
+	    return level;
+	}
+	if (!(t->u.cn || (t->opt & TAG_SIMPLE)) && level + 1 < CODE_CHOICES) {
+	    const int n = tag_find (t->subaddr, cn, chain, level + 1);
+	    if (n >= 0) {
+		chain[level] = addr;
+		return n;
+	    }
+	}
+    }
+    return -1;
+}
+
+/* Collect tags of list, flattening untagged CHOICE's */
+static int
+tags_collect (int addr, tag_id_t *tags, int n, const int level)
+{
+    for (; addr; addr = mo.odrs[addr].comp_next) {
+	const struct tmt *t = mo.odrs + addr;
+	if (t->u.cn) {
+	    int i;
+	    for (i = 0; i < n && tags[i] != t->u.cn; ++i)
+		;
+	    if (i == n && n < CODE_TAGS) tags[n++] = t->u.cn;
+	} else if (!(t->opt & TAG_SIMPLE) && level + 1 < CODE_CHOICES)
+	    n = tags_collect (t->subaddr, tags, n, level + 1);
+    }
+    return n;
+}
+
+/* Indent by 4 columns of level */
+static void
+indent (const int level)
+{
+    int i;
+
+    for (i = level * 4; i >= 8; i -= 8) fputc ('\t', fo);
+    if (i) fputs ("    ", fo);
+}
+
+/* Write decoding of value of found tmt with chain of choices (ch)
+ * in list of kind
+ */
+static void
+code_value (const int *chain, const int ch, const int kind, const int store,
+ const int level)
+{
+    const struct tmt *t = mo.odrs + chain[ch];
+    const int sub = t->subaddr;
+    char no[16];
+    int i;
+
+    /* index of value in table of components */
+    if (kind >= LIST_OF) strcpy (no, "++n");
+    else sprintf (no, "%d", t->comp_no);
+    if (t->nameaddr) {
+	indent (level);
+	fprintf (fo, "/* %s */\n", mo.names + t->nameaddr);
+    }
+    for (i = 0; i < ch; ++i) {
+	indent (level);
+	fprintf (fo, "ber_c_table (bs, depth + %d, 0, 1);\n", i + 1);
+    }
+    if (!store) {
+	/* direct value of PDU is left on stack */
+	indent (level);
+	fprintf (fo, "if (v.len) {\n");
+    } else if (t->subaddr != FUN_NULL || !(t->opt & TAG_SIMPLE)) {
+	indent (level);
+	fprintf (fo, "if (!v.len) bs->vis->nil (bs);\n");
+	indent (level);
+	fprintf (fo, "else {\n");
+    } else {
+	indent (level);
+	fprintf (fo, "{\n");
+    }
+    indent (level + 1);
+    if (t->opt & TAG_SIMPLE)
+	switch (sub) {
+	case FUN_OCT: case FUN_BIT:
+	    fprintf (fo, (ch) ? "ber_c_str (bs, &v, %d, depth + %d);\n"
+	     : "ber_c_str (bs, &v, %d, depth);\n", sub, ch);
+	    break;
+	case FUN_EXT_ASN:
+	    fprintf (fo, "ext (bs, v.end, depth + %d);\n", ch + 1);
+	    break;
+	default:
+	    fprintf (fo, "ber_c_prim (bs, &v, %d);\n", sub);
+	}
+    else {
+	const struct odr_list *l = mo.lists + sub;
+	const int kind = list_kind (t);
+	fprintf (fo, "if (!v.cons) longjmp (*bs->jb, BER_ERRTAG);\n");
+	indent (level + 1);
+	if (kind >= LIST_OF)
+	    fprintf (fo, "ber_c_table (bs, depth + %d, ber_c_count (bs, &v), 0);\n",
+	     ch + 1);
+	else fprintf (fo, "ber_c_table (bs, depth + %d, %d, %d);\n",
+	     ch + 1, l->narr, l->nrec);
+	indent (level + 1);
+	fprintf (fo, "l%d%c (bs, v.end, depth + %d);\n",
+	 list_req (sub, kind), kind_ch[kind], ch + 1);
+    }
+    indent (level);
+    fprintf (fo, "}\n");
+    if (!store) return;
+    indent (level);
+    fprintf (fo, "bs->vis->set (bs, %s);\n", no);
+    for (i = ch; i--; ) {
+	indent (level);
+	fprintf (fo, "bs->vis->set (bs, %d);\n",
+	 mo.odrs[chain[i]].comp_no);
+    }
+}
+
+/* Writer of value of cases: C decoders | typed structs */
+static void (*value_out) (const int *chain, const int ch, const int kind,
+ const int store, const int level) = code_value;
+
+/* Write cases of list at addr: tags of components and values.
+ * kind < 0 - value of PDU
+ */
+static void
+code_cases (const int addr, const int kind)
+{
+    const int dynamic = (kind == LIST_SEQ || kind == LIST_CHOICE);
+    const int level = (kind < 0) ? 1 : 2; /* of case */
+    tag_id_t tags[CODE_TAGS];
+    int ntags, n, j;
+
+    ntags = tags_collect (addr, tags, 0, 0);
+    for (n = 0, j = addr; j; j = mo.odrs[j].comp_next) ++n;
+    for (j = 0; j < ntags; ++j) {
+	int i, m = -1, a, found = 0;
+	for (i = 0, a = addr; a; ++i, a = mo.odrs[a].comp_next) {
+	    const struct tmt *t = mo.odrs + a;
+	    const int mandatory = t->u.cn && !(t->opt & TAG_OPTIONAL);
+	    int chain[CODE_CHOICES], ch = -1;
+
+	    if (t->u.cn == tags[j]) ch = 0;
+	    else if (!(t->u.cn || (t->opt & TAG_SIMPLE)))
+		ch = tag_find (t->subaddr, tags[j], chain, 1);
+	    /* SEQUENCE OF | PDU: the first one after mandatory ones */
+	    if (ch < 0 || (!dynamic && (found
+	     || (kind != LIST_OF_CHOICE && m >= 0)))) {
+		if (mandatory) m = i;
+		continue;
+	    }
+	    chain[0] = a;
+	    if (!found) {
+		indent (level);
+		fprintf (fo, "case 0x%x:\n", (unsigned int) tags[j]);
+	    }
+	    if (dynamic) {
+		indent (level + 1);
+		fprintf (fo, "if (");
+		if (kind == LIST_CHOICE && !found) fprintf (fo, "k < 0 || ");
+		if (m + 1 == i) fprintf (fo, "k == %d) {\n", i);
+		else if (m < 0) fprintf (fo, "k <= %d) {\n", i);
+		else fprintf (fo, "(k > %d && k <= %d)) {\n", m, i);
+		value_out (chain, ch, kind, 1, level + 2);
+		indent (level + 2);
+		fprintf (fo, "k = %d;\n", (kind == LIST_CHOICE && !ch) ? n : i + 1);
+		indent (level + 2);
+		fprintf (fo, "continue;\n");
+		indent (level + 1);
+		fprintf (fo, "}\n");
+	    } else {
+		value_out (chain, ch, kind,
+		 kind >= 0 || ch || (t->opt & TAG_SIMPLE), level + 1);
+		indent (level + 1);
+		fprintf (fo, (kind < 0) ? "break;\n" : "continue;\n");
+	    }
+	    found = 1;
+	    if (mandatory) m = i;
+	}
+	if (found && dynamic) {
+	    indent (level + 1);
+	    fprintf (fo, "break;\n");
+	}
+    }
+}
+
+/* Are values of list at addr primitive ones, which take no depth? */
+static int
+list_leaf (int addr)
+{
+    for (; addr; addr = mo.odrs[addr].comp_next) {
+	const struct tmt *t = mo.odrs + addr;
+	if (!(t->opt & TAG_SIMPLE) || t->subaddr == FUN_OCT
+	 || t->subaddr == FUN_BIT || t->subaddr == FUN_EXT_ASN)
+	    return 0;
+    }
+    return 1;
+}
+
+/* Write function of list */
+static void
+code_list (const int addr, const int kind)
+{
+    fprintf (fo, "\nstatic void\nl%d%c (struct bers *bs, const unsigned char *endp,"
+     " const int depth)\n{\n    struct ber_tlv v;\n", addr, kind_ch[kind]);
+    switch (kind) {
+    case LIST_SEQ: fprintf (fo, "    int k = 0;\n"); break;
+    case LIST_CHOICE: fprintf (fo, "    int k = -1;\n"); break;
+    default: fprintf (fo, "    int n = %d;\n", COMP_START_NUM - 1);
+    }
+    if (list_leaf (addr)) fprintf (fo, "\n    (void) depth;\n");
+    fprintf (fo, "\n    while (ber_c_next (bs, endp)) {\n"
+     "\tber_c_tlv (bs, endp, &v);\n\tswitch (v.cn) {\n");
+    code_cases (addr, kind);
+    fprintf (fo, "\t}\n\tlongjmp (*bs->jb, BER_ERRTAGODR); /* Missing odr */\n"
+     "    }\n}\n");
+}
+
+/* Is tmt encoded by list of its own (constructed or Ext.ASN)? */
+static int
+enc_cons (const struct tmt *t)
+{
+    return !(t->opt & TAG_SIMPLE) || t->subaddr == FUN_EXT_ASN;
+}
+
+/* Write encoding of value on top of kind k as tmt at addr */
+static void
+enc_value (const int addr, const int level)
+{
+    const struct tmt *t = mo.odrs + addr;
+
+    indent (level);
+    if (!enc_cons (t)) {
+	fprintf (fo, "ber_c_put (bs, %d, k);\n", addr);
+	return;
+    }
+    fprintf (fo, (t->u.cn) ? "if ((o = ber_c_open (bs, %d, k, depth + 1)) >= 0) {\n"
+     : "if (ber_c_open (bs, %d, k, depth + 1) >= 0)\n", addr);
+    indent (level + 1);
+    if (t->opt & TAG_SIMPLE) fprintf (fo, "ext_put (bs, depth + 1);\n");
+    else {
+	const int kind = list_kind (t);
+	fprintf (fo, "e%d%c (bs, depth + 1);\n",
+	 enc_req (t->subaddr, kind), kind_ch[kind]);
+    }
+    if (!t->u.cn) return;
+    indent (level + 1);
+    fprintf (fo, "ber_c_close (bs, o);\n");
+    indent (level);
+    fprintf (fo, "}\n");
+}
+
+/* Write encoder of list: components of value on top by numbers */
+static void
+enc_list (const int addr, const int kind)
+{
+    int a, i, n = 0, deep = 0, open = 0;
+
+    for (a = addr; a; a = mo.odrs[a].comp_next) {
+	const struct tmt *t = mo.odrs + a;
+	++n;
+	if (enc_cons (t)) {
+	    deep = 1;
+	    if (t->u.cn) open = 1;
+	}
+	if (kind >= LIST_OF) break; /* the element */
+    }
+    fprintf (fo, "\nstatic void\ne%d%c (struct bers *bs, const int depth)\n{\n",
+     addr, kind_ch[kind]);
+    if (n) fprintf (fo, (kind >= LIST_OF) ? "    int n, k;\n" : "    int k;\n");
+    if (open) fprintf (fo, "    int o;\n");
+    if (!deep) fprintf (fo, "%s    (void) depth;\n", (n) ? "\n" : "");
+    if (kind >= LIST_OF) {
+	if (n) {
+	    fprintf (fo, "\n    for (n = %d; (k = bs->vis->get (bs, n)) != BER_VNIL;"
+	     " ++n) {\n", COMP_START_NUM);
+	    enc_value (addr, 2);
+	    fprintf (fo, "\tbs->vis->pop (bs);\n    }\n    bs->vis->pop (bs);\n");
+	}
+	fprintf (fo, "}\n");
+	return;
+    }
+    for (i = 0, a = addr; a; ++i, a = mo.odrs[a].comp_next) {
+	const struct tmt *t = mo.odrs + a;
+	fputc ('\n', fo);
+	if (t->nameaddr) fprintf (fo, "    /* %s */\n", mo.names + t->nameaddr);
+	fprintf (fo, "    if ((k = bs->vis->get (bs, %d)) != BER_VNIL) {\n",
+	 COMP_START_NUM + i);
+	enc_value (a, 2);
+	if (kind == LIST_CHOICE)
+	    fprintf (fo, "\tbs->vis->pop (bs);\n\treturn;\n");
+	fprintf (fo, "    }\n    bs->vis->pop (bs);\n");
+    }
+    fprintf (fo, "}\n");
+}
+
+/* Read odr image of file into mo with room of ext tmt's after odrs.
+ * Return image (*len - size)
+ */
+static unsigned char *
+code_read (const char *odrfile, const int ext, long *len)
+{
+    FILE *fi;
+    unsigned char *img;
+    long n;
+
+    fi = fopen (odrfile, "rb");
+    if (!fi) codeError ("Open odr file");
+    fseek (fi, 0, SEEK_END);
+    *len = ftell (fi);
+    fseek (fi, 0, SEEK_SET);
+    img = malloc (*len + sizeof (struct tmt));
+    if (!img) codeError ("Image malloc");
+    if (fread (img, 1, *len, fi) != (size_t) *len) codeError ("Read odr file");
+    fclose (fi);
+    if (mmodr_set (&mo, img, *len)) {
+	fprintf (stderr, "Bad odr file '%s'\n", odrfile);
+	exit (EXIT_FAILURE);
+    }
+    n = ((struct odr_info *) mo.odrs)->nodrs + ext;
+    done = calloc (n, LIST_KINDS);
+    todo = malloc (n * LIST_KINDS * sizeof (int));
+    if (!done || !todo) codeError ("Lists malloc");
+    todo_next = 0;
+    return img;
+}
+
+/* Set identifier of name: prefix of exported names */
+static void
+code_id (const char *name)
+{
+    const char *base = strrchr (name, '/');
+    int i;
+
+    base = (base) ? base + 1 : name;
+    for (i = 0; base[i] && i < (int) sizeof (id) - 1; ++i)
+	id[i] = isalnum ((unsigned char) base[i]) ? base[i] : '_';
+    id[i] = '\0';
+}
+
+/* Copy temporary file to output and close it */
+static void
+code_copy (FILE *fb)
+{
+    char buf[BUFSIZ];
+    size_t len;
+
+    rewind (fb);
+    while ((len = fread (buf, 1, sizeof (buf), fb)) > 0)
+	fwrite (buf, 1, len, fo);
+    fclose (fb);
+}
+
+/* Write C decoders of odr file to name.c */
+void
+code_out (const char *name, const char *odrfile)
+{
+    FILE *fb;
+    unsigned char *img;
+    long len, i;
+    char path[FILENAME_MAX];
+
+    img = code_read (odrfile, 0, &len);
+    code_id (name);
+    value_out = code_value;
+
+    /* bodies first: they request lists */
+    fo = tmpfile ();
+    if (!fo) codeError ("Create temporary file");
+
+    /* PDU */
+    fprintf (fo, "\n\n/* Decode complete PDU */\nstatic unsigned char\n"
+     "%s_decode (struct bers *bs)\n{\n    const int depth = 1;\n"
+     "    struct ber_tlv v;\n\n    ber_c_table (bs, depth, 0, 1);\n"
+     "    ber_c_tlv (bs, NULL, &v);\n    switch (v.cn) {\n", id);
+    code_cases (mo.start - mo.odrs, -1);
+    fprintf (fo, "    default:\n\tlongjmp (*bs->jb, BER_ERRTAGODR);"
+     " /* Missing odr */\n    }\n"
+     "    return (bs->bp < bs->endp) ? BER_MORE : 0;\n}\n");
+
+    /* EXTERNAL by modules */
+    fprintf (fo, "\n/* Components of EXTERNAL of module */\nstatic void\n"
+     "ext (struct bers *bs, const unsigned char *endp, const int depth)\n{\n"
+     "    const struct module_id *mid = ber_c_ext (bs, depth);\n\n"
+     "    switch ((mid) ? mid->addr : 0) {\n");
+    for (i = 0; i < mo.nmodules; ++i) {
+	const int addr = mo.modules[i].addr;
+	if (!addr) continue;
+	fprintf (fo, "    case %d:\n\tl%ds (bs, endp, depth);\n\tbreak;\n",
+	 list_req (addr, LIST_SEQ), addr);
+    }
+    fprintf (fo, "    default:\n\tber_c_ext_skip (bs, endp, depth);\n"
+     "    }\n}\n");
+
+    for (i = 0; i < todo_next; ++i)
+	code_list (todo[i] / LIST_KINDS, todo[i] % LIST_KINDS);
+
+    /* encoders: PDU is the SEQUENCE of start list */
+    i = ((struct odr_info *) mo.odrs)->nodrs;
+    edone = calloc (i, LIST_KINDS);
+    etodo = malloc (i * LIST_KINDS * sizeof (int));
+    if (!edone || !etodo) codeError ("Lists malloc");
+    etodo_next = 0;
+    fprintf (fo, "\n\n/* Encode complete PDU with definite lengths */\n"
+     "static unsigned char\n%s_encode (struct bers *bs)\n{\n"
+     "    e%ds (bs, 1);\n    return 0;\n}\n",
+     id, enc_req (mo.start - mo.odrs, LIST_SEQ));
+    fprintf (fo, "\n/* Components of EXTERNAL of module (checked by ber_c_open) */\n"
+     "static void\next_put (struct bers *bs, const int depth)\n{\n"
+     "    const struct module_id *mid = bs->ext_mid;\n\n"
+     "    bs->ext_mid = NULL;\n    switch (mid->addr) {\n");
+    for (i = 0; i < mo.nmodules; ++i) {
+	const int addr = mo.modules[i].addr;
+	if (!addr) continue;
+	fprintf (fo, "    case %d:\n\te%ds (bs, depth);\n\tbreak;\n",
+	 enc_req (addr, LIST_SEQ), addr);
+    }
+    fprintf (fo, "    default:\n\tlongjmp (*bs->jb, BER_ERREXTOID);"
+     " /* Bad Ext.OID */\n    }\n}\n");
+    for (i = 0; i < etodo_next; ++i)
+	enc_list (etodo[i] / LIST_KINDS, etodo[i] % LIST_KINDS);
+    fb = fo;
+
+    snprintf (path, sizeof (path), "%s.c", name);
+    fo = fopen (path, "w");
+    if (!fo) codeError ("Create C file");
+    fprintf (fo, "/* Decoders and encoders of complete PDU: generated by asn2odr -C */\n\n"
+     "#include <lauxlib.h>\n\n#include \"ber.h\"\n#include \"luaber.h\"\n\n"
+     "static void\next (struct bers *bs, const unsigned char *endp,"
+     " const int depth);\n"
+     "static void\next_put (struct bers *bs, const int depth);\n");
+    for (i = 0; i < todo_next; ++i)
+	fprintf (fo, "static void\nl%d%c (struct bers *bs,"
+	 " const unsigned char *endp, const int depth);\n",
+	 todo[i] / LIST_KINDS, kind_ch[todo[i] % LIST_KINDS]);
+    for (i = 0; i < etodo_next; ++i)
+	fprintf (fo, "static void\ne%d%c (struct bers *bs, const int depth);\n",
+	 etodo[i] / LIST_KINDS, kind_ch[etodo[i] % LIST_KINDS]);
+    code_copy (fb);
+
+    /* image of odr and exports */
+    fprintf (fo, "\n\nstatic const union {\n    unsigned char b[%ld];\n"
+     "    struct tmt align;\n} odr = {{", len);
+    for (i = 0; i < len; ++i)
+	fprintf (fo, "%s%d,", (i % 20) ? "" : "\n", img[i]);
+    fprintf (fo, "\n}};\n\n"
+     "/* Set odr with compiled decoders and encoders */\nint\n"
+     "%s_set (struct mmodr *mo)\n{\n"
+     "    if (mmodr_set (mo, odr.b, sizeof (odr.b))) return 1;\n"
+     "    mo->decode = %s_decode;\n    mo->encode = %s_encode;\n"
+     "    return 0;\n}\n\n"
+     "/* Open odr_udata with compiled decoders and encoders */\n"
+     "LUALIB_API int\nluaopen_%s (lua_State *L)\n{\n"
+     "    return luaber_open_odr (L, %s_set);\n}\n", id, id, id, id, id);
+    if (fclose (fo)) codeError ("Write C file");
+    free (img);
+    free (done);
+    free (todo);
+    free (edone);
+    free (etodo);
+}
+
+
+/* <<========================================
+ * Typed C structs (asn2odr -T).
+ * Each components list becomes struct of its kind:
+ * SEQUENCE - present bits and fields; CHOICE - which and union;
+ * SEQUENCE OF - count and array of elements;
+ * values of lists are referred by pointers (elements are in array),
+ * untagged CHOICE's are structs of their own.
+ * Lists are decoded by cases of the C decoders and encoded
+ * in order of components, as the interpreter does.
+ */
+
+#define CODE_LVSIZ	1024	/* C lvalue of component */
+
+static char (*tnames)[CODE_NAMESIZ];	/* names of structs of lists */
+static int *types, types_next;		/* queue of structs to write */
+
+static const char *const keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if",
+    "inline", "int", "long", "register", "restrict", "return", "short",
+    "signed", "sizeof", "static", "struct", "switch", "typedef", "union",
+    "unsigned", "void", "volatile", "while",
+    /* members of structs */
+    "present", "which", "u", "count", "elems", "NULL", NULL
+};
+
+
+/* Copy ASN.1 name to C identifier */
+static void
+name_c (char *dst, const char *src)
+{
+    const char *const *kw;
+    int i;
+
+    for (i = 0; src[i] && i < CODE_NAMESIZ - 2; ++i)
+	dst[i] = isalnum ((unsigned char) src[i]) ? src[i] : '_';
+    dst[i] = '\0';
+    for (kw = keywords; *kw; ++kw)
+	if (!strcmp (dst, *kw)) {
+	    dst[i] = '_';
+	    dst[i + 1] = '\0';
+	    break;
+	}
+}
+
+/* Name of field of component */
+static const char *
+field_name (const struct tmt *t)
+{
+    static char buf[CODE_NAMESIZ];
+
+    if (t->nameaddr) name_c (buf, mo.names + t->nameaddr);
+    else sprintf (buf, "c%d", t->comp_no);
+    return buf;
+}
+
+/* Queue struct of list of kind named by name (unique one);
+ * return the name
+ */
+static const char *
+type_req (const int addr, const int kind, const char *name)
+{
+    char *tn = tnames[addr * LIST_KINDS + kind];
+    int i;
+
+    if (tn[0]) return tn;
+    name_c (tn, name);
+    for (i = 0; i < types_next; ++i)
+	if (!strcmp (tnames[types[i]], tn)) {
+	    char buf[CODE_NAMESIZ];
+	    snprintf (buf, sizeof (buf), "%.48s_%d%c", tn, addr,
+	     kind_ch[kind]);
+	    strcpy (tn, buf);
+	    break;
+	}
+    types[types_next++] = addr * LIST_KINDS + kind;
+    return tn;
+}
+
+/* Name of struct of list (requested already, as a rule) */
+static const char *
+list_type (const int addr, const int kind)
+{
+    char buf[32];
+
+    sprintf (buf, "l%d%c", addr, kind_ch[kind]);
+    return type_req (addr, kind, buf);
+}
+
+/* Write C type of component t of struct parent (embed - not pointer) */
+static void
+type_c (const struct tmt *t, const char *parent, const char *field,
+ const int embed, char *buf)
+{
+    char name[CODE_NAMESIZ * 2];
+
+    if (t->opt & TAG_SIMPLE)
+	switch (t->subaddr) {
+	case FUN_INT:
+	    strcpy (buf, "unsigned int ");
+	    break;
+	case FUN_BOOL: case FUN_NULL:
+	    strcpy (buf, "unsigned char ");
+	    break;
+	default:
+	    strcpy (buf, "struct ber_str ");
+	}
+    else {
+	snprintf (name, sizeof (name), "%s_%s", parent, field);
+	sprintf (buf, "struct %s_%s %s", id,
+	 type_req (t->subaddr, list_kind (t), name), (embed) ? "" : "*");
+    }
+}
+
+/* Write struct of list */
+static void
+type_out (const int i)
+{
+    const int addr = i / LIST_KINDS, kind = i % LIST_KINDS;
+    const char *name = tnames[i];
+    char ct[CODE_NAMESIZ * 3];
+    int a, n = 0;
+
+    for (a = addr; a; a = mo.odrs[a].comp_next) ++n;
+    fprintf (fo, "\nstruct %s_%s {\n", id, name);
+    switch (kind) {
+    case LIST_SEQ:
+	fprintf (fo, "    unsigned char present[%d];\t/* BER_HAS () */\n",
+	 (n + 7) / 8 + !n);
+	for (a = addr; a; a = mo.odrs[a].comp_next) {
+	    const char *f = field_name (mo.odrs + a);
+	    type_c (mo.odrs + a, name, f, 0, ct);
+	    fprintf (fo, "    %s%s;\n", ct, field_name (mo.odrs + a));
+	}
+	break;
+    case LIST_CHOICE:
+	fprintf (fo, "    int which;\t/* number of alternative (0 - none) */\n"
+	 "    union {\n");
+	for (a = addr; a; a = mo.odrs[a].comp_next) {
+	    const char *f = field_name (mo.odrs + a);
+	    type_c (mo.odrs + a, name, f, 0, ct);
+	    fprintf (fo, "\t%s%s;\n", ct, field_name (mo.odrs + a));
+	}
+	if (!n) fprintf (fo, "\tchar none;\n");
+	fprintf (fo, "    } u;\n");
+	break;
+    case LIST_OF:
+	type_c (mo.odrs + addr, name, "elem", 1, ct);
+	fprintf (fo, "    int count;\n    %s*elems;\n", ct);
+	break;
+    default:
+	{
+	    char elem[CODE_NAMESIZ * 2];
+	    snprintf (elem, sizeof (elem), "%s_elem", name);
+	    fprintf (fo, "    int count;\n    struct %s_%s *elems;\n",
+	     id, type_req (addr, LIST_CHOICE, elem));
+	}
+    }
+    fprintf (fo, "};\n");
+    if (kind >= LIST_OF || !n) return;
+    /* numbers of components */
+    fprintf (fo, "enum {\n");
+    for (a = addr; a; a = mo.odrs[a].comp_next)
+	fprintf (fo, "    %s_%s_%s = %d%s\n", id, name, field_name (mo.odrs + a),
+	 mo.odrs[a].comp_no, (mo.odrs[a].comp_next) ? "," : "");
+    fprintf (fo, "};\n");
+}
+
+/* Write decoding of value of found tmt with chain of choices (ch)
+ * into struct v of list of kind (kind < 0 - into *pv)
+ */
+static void
+type_value (const int *chain, const int ch, const int kind, const int store,
+ const int level)
+{
+    const struct tmt *t = mo.odrs + chain[ch];
+    const int sub = t->subaddr;
+    char lv[CODE_LVSIZ];
+    int i, ptr = 1, lev = level;
+
+    (void) store; /* values are stored in structs */
+    if (t->nameaddr) {
+	indent (lev);
+	fprintf (fo, "/* %s */\n", mo.names + t->nameaddr);
+    }
+    /* field of the first tmt */
+    switch (kind) {
+    case LIST_SEQ:
+	indent (lev);
+	fprintf (fo, "BER_SET (v, %d);\n", mo.odrs[chain[0]].comp_no);
+	sprintf (lv, "v->%s", field_name (mo.odrs + chain[0]));
+	break;
+    case LIST_CHOICE:
+	indent (lev);
+	fprintf (fo, "v->which = %d;\n", mo.odrs[chain[0]].comp_no);
+	sprintf (lv, "v->u.%s", field_name (mo.odrs + chain[0]));
+	break;
+    case LIST_OF:
+	strcpy (lv, "v->elems[v->count]");
+	ptr = 0;
+	break;
+    case LIST_OF_CHOICE:
+	indent (lev);
+	fprintf (fo, "v->elems[v->count].which = %d;\n",
+	 mo.odrs[chain[0]].comp_no);
+	sprintf (lv, "v->elems[v->count].u.%s",
+	 field_name (mo.odrs + chain[0]));
+	break;
+    default:
+	strcpy (lv, "(*pv)");
+    }
+    /* structs of untagged CHOICE's */
+    if (ch) {
+	indent (lev);
+	fprintf (fo, "{\n");
+	for (i = 1; i <= ch; ++i) {
+	    indent (lev + 1);
+	    fprintf (fo, "struct %s_%s *c%d = ", id,
+	     list_type (mo.odrs[chain[i - 1]].subaddr,
+	     list_kind (mo.odrs + chain[i - 1])), i);
+	    if (i == 1 && !ptr) fprintf (fo, "&%s;\n", lv);
+	    else fprintf (fo, "bert_new (bt, sizeof *c%d);\n", i);
+	}
+	fputc ('\n', fo);
+	if (ptr) {
+	    indent (lev + 1);
+	    fprintf (fo, "%s = c1;\n", lv);
+	}
+	for (i = 1; i <= ch; ++i) {
+	    indent (lev + 1);
+	    fprintf (fo, "c%d->which = %d;\n", i, mo.odrs[chain[i]].comp_no);
+	    if (i == ch) break;
+	    indent (lev + 1);
+	    fprintf (fo, "c%d->u.%s = c%d;\n", i,
+	     field_name (mo.odrs + chain[i]), i + 1);
+	}
+	sprintf (lv, "c%d->u.%s", ch, field_name (t));
+	ptr = 1;
+	++lev;
+    }
+    indent (lev);
+    if (t->opt & TAG_SIMPLE)
+	switch (sub) {
+	case FUN_INT:
+	    fprintf (fo, "bert_int (bt, &t, &%s);\n", lv);
+	    break;
+	case FUN_BOOL:
+	    fprintf (fo, "bert_bool (bt, &t, &%s);\n", lv);
+	    break;
+	case FUN_NULL:
+	    fprintf (fo, "bert_null (bt, &t, &%s);\n", lv);
+	    break;
+	default:
+	    fprintf (fo, (ch) ? "bert_str (bt, &t, %d, &%s, depth + %d);\n"
+	     : "bert_str (bt, &t, %d, &%s, depth);\n", sub, lv, ch);
+	}
+    else {
+	const int k = list_kind (t);
+	const char *sel = (ptr) ? "->" : ".";
+	fprintf (fo, "if (!t.cons) longjmp (bt->jb, BER_ERRTAG);\n");
+	if (ptr) {
+	    indent (lev);
+	    fprintf (fo, "%s = bert_new (bt, sizeof *%s);\n", lv, lv);
+	}
+	if (k >= LIST_OF) {
+	    indent (lev);
+	    fprintf (fo, "%s%selems = bert_array (bt, &t, sizeof *%s%selems);\n",
+	     lv, sel, lv, sel);
+	}
+	indent (lev);
+	fprintf (fo, "d%d%c (bt, t.end, %s%s, depth + %d);\n",
+	 list_req (sub, k), kind_ch[k], (ptr) ? "" : "&", lv, ch + 1);
+    }
+    if (ch) {
+	indent (level);
+	fprintf (fo, "}\n");
+    }
+    if (kind >= LIST_OF) {
+	indent (level);
+	fprintf (fo, "++v->count;\n");
+    }
+}
+
+static void
+type_put (const struct tmt *t, const char *lv, const int ptr, const int level,
+ const int nest);
+
+/* Write encoding of alternative of struct lv of untagged CHOICE at addr */
+static void
+type_alts (const int addr, const char *lv, const int ptr, const int level,
+ const int nest)
+{
+    const char *sel = (ptr) ? "->" : ".";
+    int a;
+
+    indent (level);
+    fprintf (fo, "switch (%s%swhich) {\n", lv, sel);
+    for (a = addr; a; a = mo.odrs[a].comp_next) {
+	const struct tmt *t = mo.odrs + a;
+	char alt[CODE_LVSIZ];
+	indent (level);
+	fprintf (fo, "case %d:\n", t->comp_no);
+	snprintf (alt, sizeof (alt), "%s%su.%s", lv, sel, field_name (t));
+	type_put (t, alt, 1, level + 1, nest);
+	indent (level + 1);
+	fprintf (fo, "break;\n");
+    }
+    indent (level);
+    fprintf (fo, "default:\n");
+    indent (level + 1);
+    fprintf (fo, "longjmp (bt->jb, BER_ERRLUAOUT); /* Bad PDU */\n");
+    indent (level);
+    fprintf (fo, "}\n");
+}
+
+/* Write encoding of value lv of tmt (ptr - lv is pointer to struct) */
+static void
+type_put (const struct tmt *t, const char *lv, const int ptr, const int level,
+ const int nest)
+{
+    const int sub = t->subaddr;
+
+    if (t->opt & TAG_SIMPLE) {
+	indent (level);
+	switch (sub) {
+	case FUN_INT:
+	    fprintf (fo, "bert_put_int (bt, 0x%x, %s);\n",
+	     (unsigned int) t->u.cn, lv);
+	    break;
+	case FUN_BOOL:
+	    fprintf (fo, "bert_put_bool (bt, 0x%x, %s);\n",
+	     (unsigned int) t->u.cn, lv);
+	    break;
+	case FUN_NULL:
+	    fprintf (fo, "bert_put_null (bt, 0x%x);\n", (unsigned int) t->u.cn);
+	    break;
+	default:
+	    fprintf (fo, "bert_put_str (bt, 0x%x, %d, &%s);\n",
+	     (unsigned int) t->u.cn, sub, lv);
+	}
+    } else if (t->u.cn) {
+	const int k = list_kind (t);
+	indent (level);
+	fprintf (fo, "bert_open (bt, 0x%x);\n", (unsigned int) t->u.cn);
+	indent (level);
+	fprintf (fo, "e%d%c (bt, %s%s);\n", list_req (sub, k), kind_ch[k],
+	 (ptr) ? "" : "&", lv);
+	indent (level);
+	fprintf (fo, "bert_close (bt);\n");
+    } else if (nest < CODE_CHOICES)
+	type_alts (sub, lv, ptr, level, nest + 1);
+    else {
+	indent (level);
+	fprintf (fo, "longjmp (bt->jb, BER_ERRCHCSO); /* Too deep CHOICE */\n");
+    }
+}
+
+/* Write decoder and encoder of list */
+static void
+type_list (const int addr, const int kind)
+{
+    const char *name = list_type (addr, kind);
+    char lv[CODE_LVSIZ];
+    int a;
+
+    fprintf (fo, "\nstatic void\nd%d%c (struct bert *bt, const unsigned char *endp,"
+     " struct %s_%s *v,\n const int depth)\n{\n    struct ber_tlv t;\n",
+     addr, kind_ch[kind], id, name);
+    switch (kind) {
+    case LIST_SEQ: fprintf (fo, "    int k = 0;\n"); break;
+    case LIST_CHOICE: fprintf (fo, "    int k = -1;\n"); break;
+    }
+    fprintf (fo, "\n    bert_depth (bt, depth);\n"
+     "    while (bert_next (bt, endp)) {\n"
+     "\tbert_tlv (bt, endp, &t);\n\tswitch (t.cn) {\n");
+    code_cases (addr, kind);
+    fprintf (fo, "\t}\n\tlongjmp (bt->jb, BER_ERRTAGODR); /* Missing odr */\n"
+     "    }\n}\n");
+
+    fprintf (fo, "\nstatic void\ne%d%c (struct bert *bt, const struct %s_%s *v)\n{\n",
+     addr, kind_ch[kind], id, name);
+    switch (kind) {
+    case LIST_SEQ:
+	for (a = addr; a; a = mo.odrs[a].comp_next) {
+	    fprintf (fo, "    if (BER_HAS (v, %d)) {\n", mo.odrs[a].comp_no);
+	    sprintf (lv, "v->%s", field_name (mo.odrs + a));
+	    type_put (mo.odrs + a, lv, 1, 2, 0);
+	    fprintf (fo, "    }\n");
+	}
+	break;
+    case LIST_CHOICE:
+	type_alts (addr, "v", 1, 1, 0);
+	break;
+    default:
+	fprintf (fo, "    int i;\n\n    for (i = 0; i < v->count; ++i) {\n");
+	if (kind == LIST_OF)
+	    type_put (mo.odrs + addr, "v->elems[i]", 0, 2, 0);
+	else type_alts (addr, "v->elems[i]", 0, 2, 0);
+	fprintf (fo, "    }\n");
+    }
+    fprintf (fo, "}\n");
+}
+
+/* Write C structs of named types, their decoders and encoders
+ * of odr file to name.h, name.c
+ */
+void
+code_types (const char *name, const char *odrfile,
+ const struct code_def *defs, const int ndefs)
+{
+    FILE *fh, *fb, *fx;
+    struct tmt *odrs;
+    unsigned char *img;
+    char path[FILENAME_MAX], (*xnames)[CODE_NAMESIZ];
+    const char *base;
+    long len;
+    int nodrs, nout, i, j;
+
+    img = code_read (odrfile, ndefs, &len);
+    code_id (name);
+    value_out = type_value;
+    /* tmt's of definitions follow odrs */
+    nodrs = ((struct odr_info *) mo.odrs)->nodrs;
+    odrs = malloc ((nodrs + ndefs) * sizeof (struct tmt));
+    tnames = calloc ((nodrs + ndefs) * LIST_KINDS, CODE_NAMESIZ);
+    types = malloc ((nodrs + ndefs) * LIST_KINDS * sizeof (int));
+    xnames = calloc (ndefs + 1, CODE_NAMESIZ);
+    if (!odrs || !tnames || !types || !xnames) codeError ("Types malloc");
+    memcpy (odrs, mo.odrs, nodrs * sizeof (struct tmt));
+    for (i = 0; i < ndefs; ++i) {
+	odrs[nodrs + i] = defs[i].tag;
+	odrs[nodrs + i].comp_next = odrs[nodrs + i].nameaddr = 0;
+    }
+    mo.odrs = odrs;
+    types_next = 0;
+
+    /* structs of definitions are named by them */
+    for (i = 0; i < ndefs; ++i) {
+	const struct tmt *t = odrs + nodrs + i;
+	type_req (t->subaddr, list_kind (t), defs[i].name);
+	name_c (xnames[i], defs[i].name);
+	for (j = 0; j < i; ++j)
+	    if (!strcmp (xnames[j], xnames[i])) {
+		sprintf (xnames[i] + strlen (xnames[i]), "_%d", i);
+		break;
+	    }
+    }
+    fh = fo = tmpfile ();
+    if (!fo) codeError ("Create temporary file");
+    for (i = 0; i < types_next; ++i)
+	type_out (types[i]);
+    nout = types_next;
+
+    /* bodies: they request lists */
+    fb = fo = tmpfile ();
+    fx = tmpfile ();
+    if (!fo || !fx) codeError ("Create temporary file");
+    for (i = 0; i < ndefs; ++i) {
+	const int addr = nodrs + i;
+	const char *tn = list_type (odrs[addr].subaddr,
+	 list_kind (odrs + addr));
+
+	fprintf (fo, "\n\n/* %s */\nstatic void\nr%d (struct bert *bt,"
+	 " struct %s_%s **pv)\n{\n    const int depth = 1;\n"
+	 "    struct ber_tlv t;\n\n    bert_depth (bt, depth);\n"
+	 "    bert_tlv (bt, NULL, &t);\n"
+	 "    switch (t.cn) {\n", defs[i].name, addr, id, tn);
+	code_cases (addr, -1);
+	fprintf (fo, "    default:\n\tlongjmp (bt->jb, BER_ERRTAGODR);"
+	 " /* Missing odr */\n    }\n}\n\nstatic void\n"
+	 "x%d (struct bert *bt, const struct %s_%s *v)\n{\n", addr, id, tn);
+	type_put (odrs + addr, "v", 1, 1, 0);
+	fprintf (fo, "}\n\n/* Decode PDU of %s at p..p+len into *pv of arena.\n"
+	 " * Return length of PDU, 0 - incomplete or error code\n */\nint\n"
+	 "%s_decode_%s (struct ber_arena *a, const unsigned char *p,"
+	 " const int len,\n struct %s_%s **pv)\n{\n    struct bert bt;\n"
+	 "    int res = bert_begin (&bt, a, p, len);\n\n"
+	 "    if (res <= 0) return res;\n"
+	 "    if ((res = setjmp (bt.jb))) return res;\n"
+	 "    r%d (&bt, pv);\n    return bt.bp - p;\n}\n",
+	 defs[i].name, id, xnames[i], id, tn, addr);
+	fprintf (fo, "\n/* Encode %s to buf of size.\n"
+	 " * Return length of PDU or error code\n */\nint\n"
+	 "%s_encode_%s (const struct %s_%s *v, unsigned char *buf,"
+	 " const int size)\n{\n    struct bert bt;\n    int res;\n\n"
+	 "    bert_out (&bt, buf, size);\n"
+	 "    if ((res = setjmp (bt.jb))) return res;\n"
+	 "    x%d (&bt, v);\n    return bt.op - buf;\n}\n",
+	 defs[i].name, id, xnames[i], id, tn, addr);
+	fprintf (fx, "\nint\n%s_decode_%s (struct ber_arena *a,"
+	 " const unsigned char *p, const int len,\n struct %s_%s **pv);\n"
+	 "int\n%s_encode_%s (const struct %s_%s *v, unsigned char *buf,"
+	 " const int size);\n", id, xnames[i], id, tn, id, xnames[i], id, tn);
+    }
+    for (i = 0; i < todo_next; ++i)
+	type_list (todo[i] / LIST_KINDS, todo[i] % LIST_KINDS);
+    /* structs requested by bodies */
+    fo = fh;
+    for (i = nout; i < types_next; ++i)
+	type_out (types[i]);
+
+    /* header */
+    snprintf (path, sizeof (path), "%s.h", name);
+    fo = fopen (path, "w");
+    if (!fo) codeError ("Create C header file");
+    fprintf (fo, "/* Typed structs: generated by asn2odr -T */\n\n"
+     "#ifndef %s_H\n#define %s_H\n\n#include \"ber_typed.h\"\n\n", id, id);
+    for (i = 0; i < types_next; ++i)
+	fprintf (fo, "struct %s_%s;\n", id, tnames[types[i]]);
+    code_copy (fh);
+    fputc ('\n', fo);
+    code_copy (fx);
+    fprintf (fo, "\n#endif\n");
+    if (fclose (fo)) codeError ("Write C header file");
+
+    /* decoders and encoders */
+    snprintf (path, sizeof (path), "%s.c", name);
+    fo = fopen (path, "w");
+    if (!fo) codeError ("Create C file");
+    base = strrchr (name, '/');
+    base = (base) ? base + 1 : name;
+    fprintf (fo, "/* Typed decoders and encoders: generated by asn2odr -T */\n\n"
+     "#include \"%s.h\"\n\n", base);
+    for (i = 0; i < todo_next; ++i) {
+	const int addr = todo[i] / LIST_KINDS, kind = todo[i] % LIST_KINDS;
+	const char *tn = tnames[todo[i]];
+	fprintf (fo, "static void\nd%d%c (struct bert *bt, const unsigned char *endp,"
+	 " struct %s_%s *v,\n const int depth);\n"
+	 "static void\ne%d%c (struct bert *bt, const struct %s_%s *v);\n",
+	 addr, kind_ch[kind], id, tn, addr, kind_ch[kind], id, tn);
+    }
+    code_copy (fb);
+    if (fclose (fo)) codeError ("Write C file");
+    free (img);
+    free (odrs);
+    free (tnames);
+    free (types);
+    free (xnames);
+    free (done);
+    free (todo);
+}
@@ -0,0 +1,18 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include "odr.h"
+
+#define CODE_NAMESIZ	64
+
+/* Named type definition (asn2odr -T) */
+struct code_def {
+    char name[CODE_NAMESIZ];
+    struct tmt tag;
+};
+
+void code_out (const char *name, const char *odrfile);
+void code_types (const char *name, const char *odrfile,
+ const struct code_def *defs, const int ndefs);
+
+#endif
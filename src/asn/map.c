@@ -20,6 +20,7 @@ odr_add (const struct tmt *t)
 	if (!odrs) perror ("Odr realloc");
     }
     if (t) odrs[cur] = *t;
+    else memset (odrs + cur, 0, sizeof (struct tmt)); /* last component */
     return cur;
 }
 
@@ -192,3 +193,129 @@ find (const char *name, void *i, const void *end)
 	i = ((struct def *) i)->next;
     return (i == end) ? NULL : i;
 }
+
+/* <<========================================
+ * Tag dispatch index
+ */
+
+#define DISP_MIN	16	/* minimal entries to make table (less - scan) */
+#define DISP_LEVELS	8	/* nested untagged CHOICE's */
+
+/* entry with order of appearance (to sort stable) */
+struct disp_ent {
+    struct odr_disp d;
+    int order;
+};
+
+static struct disp_ent *ents;
+static int ents_size, ents_next;
+
+static void
+disp_add (const tag_id_t cn, const int addr)
+{
+    if (ents_next >= ents_size) {
+	ents = realloc (ents, (ents_size += 256) * sizeof (struct disp_ent));
+	if (!ents) perror ("Dispatch realloc");
+    }
+    ents[ents_next].d.cn = cn;
+    ents[ents_next].d.addr = addr;
+    ents[ents_next].order = ents_next;
+    ++ents_next;
+}
+
+/* Collect tags of components list, flattening untagged CHOICE's */
+static void
+disp_collect (int addr, const int via, const int level)
+{
+    for (; addr; addr = odrs[addr].comp_next) {
+	const struct tmt *t = odrs + addr;
+	if (t->u.cn) disp_add (t->u.cn, via ? via : addr);
+	else if (!(t->opt & TAG_SIMPLE) && t->subaddr && level < DISP_LEVELS)
+	    disp_collect (t->subaddr, via ? via : addr, level + 1);
+    }
+}
+
+static int
+disp_cmp (const void *e1, const void *e2)
+{
+    const struct disp_ent *d1 = e1, *d2 = e2;
+
+    if (d1->d.cn != d2->d.cn)
+	return (d1->d.cn < d2->d.cn) ? -1 : 1;
+    return d1->order - d2->order;
+}
+
+/* Make dispatch tables of all components lists.
+ * Return count of entries in *disps; lists[addr of list].disp -> head entry
+ */
+int
+disp_build (struct odr_disp **disps, struct odr_list *lists)
+{
+    struct odr_disp *dp = NULL;
+    int i, j, k, head, size = 0, next = 1; /* disps[0] - none */
+
+    for (i = 1; i < odrs_next; ++i) {
+	const struct tmt *t = odrs + i;
+	head = t->subaddr;
+	if ((t->opt & TAG_SIMPLE) || !head || lists[head].disp)
+	    continue;
+	ents_next = 0;
+	disp_collect (head, 0, 0);
+	if (ents_next < DISP_MIN) continue;
+	qsort (ents, ents_next, sizeof (struct disp_ent), disp_cmp);
+	if (next + ents_next + 1 > size) {
+	    j = size;
+	    dp = realloc (dp, (size += 1024 + ents_next) * sizeof (struct odr_disp));
+	    if (!dp) perror ("Dispatch realloc");
+	    memset (dp + j, 0, (size - j) * sizeof (struct odr_disp));
+	}
+	/* first (in order of components) of duplicated tags wins */
+	for (j = 0, k = next + 1; j < ents_next; ++j)
+	    if (!j || ents[j].d.cn != ents[j - 1].d.cn) {
+		dp[k].cn = ents[j].d.cn;
+		dp[k++].addr = ents[j].d.addr;
+	    }
+	if (k > 0xFFFF) {
+	    fprintf (stderr, "Dispatch index overflow\n");
+	    break;
+	}
+	dp[next].cn = k - next - 1;
+	dp[next].addr = 0;
+	lists[head].disp = next;
+	next = k;
+    }
+    free (ents);
+    ents = NULL;
+    ents_size = ents_next = 0;
+    *disps = dp;
+    return (dp) ? next : 0;
+}
+
+/* Set size hints of Lua tables of all components lists:
+ * array part for components (OPTIONAL ones too, to not spill to hash part),
+ * one record for alternative of CHOICE; count OPTIONAL components
+ */
+void
+list_hints (struct odr_list *lists)
+{
+    int i, addr;
+
+    for (i = 1; i < odrs_next; ++i) {
+	const struct tmt *t = odrs + i;
+	struct odr_list *l = lists + t->subaddr;
+	if ((t->opt & (TAG_SIMPLE | TAG_TYPE_OF)) || !t->subaddr
+	 || l->narr || l->nrec)
+	    continue;
+	if (t->opt & TAG_CHOICE) {
+	    l->nrec = 1;
+	    continue;
+	}
+	for (addr = t->subaddr; addr; addr = odrs[addr].comp_next) {
+	    if (l->narr < odrs[addr].comp_no)
+		l->narr = odrs[addr].comp_no;
+	    if (odrs[addr].opt & TAG_OPTIONAL) ++l->nopt;
+	}
+    }
+}
+
+/* ========================================>> */
@@ -10,5 +10,7 @@ struct def *def_add (struct module *m, const int opt, const char *dname);
 void def_del (struct module *m, struct def *dend, const unsigned char leave);
 void def_req (struct def *fdef, const union comp_addr u, const unsigned char opt);
 void *find (const char *name, void *i, const void *end);
+int disp_build (struct odr_disp **disps, struct odr_list *lists);
+void list_hints (struct odr_list *lists);
 
 #endif
@@ -6,15 +6,17 @@
 #define COMP_START_NUM	1 /* for Lua arrays */
 
 enum ber_fun {FUN_OCT, FUN_BIT, FUN_OID, FUN_INT, FUN_BOOL,
-		FUN_NULL, FUN_EXT_DREF, FUN_EXT_ASN, FUN_OCT_SKIP};
+		FUN_NULL, FUN_EXT_DREF, FUN_EXT_ASN, FUN_OCT_SKIP, FUN_SKIP};
 #ifdef BER_FUN_NAMES
 char *ber_fun_names[] = {"Oct", "Bit", "OID", "Int", "Bool",
 		"Null", "Ext_DRef", "Ext_ASN"};
 #endif
 
+/* Stored in odrs[0], so must not exceed sizeof (struct tmt) */
 struct odr_info {
     unsigned short start; /* first searching tmt in odrs area */
     unsigned short nodrs, nmodules; /* count of modules have ModuleId */
+    unsigned short ndisps; /* count of dispatch entries (0 - no index) */
 };
 
 typedef int	tag_id_t;
@@ -45,6 +47,23 @@ struct tmt {
     unsigned short subaddr, comp_next, nameaddr;
 };
 
+/* Tag dispatch table of components list.
+ * Head entry {count} followed by entries sorted by tag;
+ * untagged CHOICE's are flattened: addr is the component of list,
+ * which contains the tag in its alternatives.
+ */
+struct odr_disp {
+    tag_id_t cn;	/* tag | count of entries (head) */
+    unsigned short addr;
+};
+
+/* Components list info, indexed by address of list */
+struct odr_list {
+    unsigned short disp;	/* dispatch table in disps (0 - none) */
+    unsigned char narr, nrec;	/* size hints of Lua table of components */
+    unsigned char nopt;		/* count of OPTIONAL components */
+};
+
 struct module_id {
 #define OIDSIZ		12	/* with length byte */
     unsigned char oid[OIDSIZ];	/* oid[0] - length */
@@ -1,9 +1,8 @@
-/* BER octets <-> Lua tables */
+/* BER octets <-> values of visitor */
 
+#include <stdlib.h>	/* realloc, free */
 #include <string.h>	/* mem* */
 
-#include <lauxlib.h>
-
 #include "ber.h"
 
 
@@ -15,7 +14,11 @@
 static int
 ber_taglen (struct bers *bs);
 static struct ber *
-ber_add (struct bers *bs, const unsigned char opt);
+ber_add (struct bers *bs, const unsigned char opt,
+ const int narr, const int nrec);
+static void
+ber_walk (struct bers *bs, const int ev, const struct tmt *t, const int no,
+ const unsigned char *p, const int len);
 
 /* <<========================================
  * BER (de|en)coders
@@ -36,6 +39,7 @@ static int ber_null (struct bers *bs, int len, unsigned char opt);
 static int ber_ext_dref (struct bers *bs, int len, unsigned char opt);
 static int ber_ext_asn (struct bers *bs, int len, unsigned char opt);
 static int ber_oct_skip (struct bers *bs, int len, unsigned char opt);
+static int ber_proj_skip (struct bers *bs, int len, unsigned char opt);
 
 static struct {
     int (*fun) (struct bers *bs, int len, unsigned char opt);
@@ -51,9 +55,112 @@ static struct {
     {ber_ext_dref, OIDSIZ,	{{0}, 0, 0, 0, 0, 0}},
     {ber_ext_asn, 0,	{{0}, 0, 0, 0, 0, 0}},
     {ber_oct_skip, 0,	{{0}, TAG_SIMPLE, COMP_START_NUM, FUN_OCT_SKIP, 0, 0}},
+    {ber_proj_skip, 0,	{{0}, TAG_SIMPLE, COMP_START_NUM, FUN_SKIP, 0, 0}},
 };
 
 
+/* Grow output buffer by bs->grow () to have room of need octets:
+ * pointers to lengths of constructed values are moved with it
+ */
+static void
+ber_out_grow (struct bers *bs, const int need)
+{
+    const int used = bs->bp - bs->buf;
+    size_t size = bs->endp - bs->buf;
+    unsigned char *buf;
+    struct ber *b;
+
+    while (size - used < (size_t) need) size *= 2;
+    for (b = bs->stack; b && b <= bs->top; ++b)
+	if (b->opt & BER_CONSTR)
+	    b->v.size = b->v.bufp - bs->buf;
+    buf = bs->grow (bs, size);
+    for (b = bs->stack; b && b <= bs->top; ++b)
+	if (b->opt & BER_CONSTR)
+	    b->v.bufp = (buf ? buf : bs->buf) + b->v.size;
+    if (!buf) longjmp (*bs->jb, BER_ERRMEM);
+    bs->buf = buf;
+    bs->bp = buf + used;
+    bs->endp = buf + size;
+}
+
+/* Count of octets of long definite length (0 - short one) */
+static int
+ber_lenlen (const int len)
+{
+    int n = 0, i;
+
+    if (len < 0x80) return 0;
+    for (i = len; i; i >>= 8) ++n;
+    return n;
+}
+
+/* Put definite length at p, return pointer after it */
+static unsigned char *
+ber_setlen (unsigned char *p, const int len)
+{
+    int n = ber_lenlen (len);
+
+    if (!n) *p++ = len;
+    else {
+	*p++ = BER_INDEFIN | n;
+	while (n--) *p++ = (unsigned char) (len >> (n * 8));
+    }
+    return p;
+}
+
+/* Put long definite length of contents of constructed value b:
+ * contents are moved after it
+ */
+static void
+ber_putlen (struct bers *bs, struct ber *b, const int len)
+{
+    const int n = ber_lenlen (len);
+    unsigned char *p;
+
+    if (bs->endp - bs->bp < n + (int) ENC_BUFRESERVE (bs))
+	ber_out_grow (bs, n + ENC_BUFRESERVE (bs));
+    p = b->v.bufp;
+    memmove (p + 1 + n, p + 1, len);
+    bs->bp += n;
+    ber_setlen (p, len);
+}
+
+/* Grow sizes twice */
+static void
+ber_sizes_grow (struct bers *bs)
+{
+    const unsigned int n = (bs->sizes_max) ? bs->sizes_max * 2 : BERS_MIN;
+    int *sizes = realloc (bs->sizes, n * sizeof (int));
+
+    if (!sizes) longjmp (*bs->jb, BER_ERRMEM);
+    bs->sizes = sizes;
+    bs->sizes_max = n;
+}
+
+/* Put length of constructed value of ber b: definite one of sizes
+ * or placeholder, which ber_del () sets (counts) on its end
+ */
+static void
+ber_openlen (struct bers *bs, struct ber *b)
+{
+    if (bs->sizes_mode == BER_SIZES_PUT) {
+	if (bs->sizes_no >= bs->nsizes)
+	    longjmp (*bs->jb, BER_ERRLUAOUT); /* PDU differs from sized */
+	bs->bp = ber_setlen (bs->bp, bs->sizes[bs->sizes_no++]);
+	return;
+    }
+    if (bs->sizes_mode == BER_SIZES_COUNT) {
+	if (bs->nsizes >= bs->sizes_max) ber_sizes_grow (bs);
+	/* offset of contents, till its end */
+	b->v.size = bs->nsizes;
+	bs->sizes[bs->nsizes++] = bs->sizes_len + (bs->bp - bs->buf) + 1;
+    } else b->v.bufp = bs->bp;
+    *bs->bp++ = 0x80;
+    b->opt |= BER_CONSTR;
+}
+
+
 static int
 ber_encstr (struct bers *bs, int pad)
 {
@@ -61,7 +168,7 @@ ber_encstr (struct bers *bs, int pad)
     int len;
     unsigned char chunk = b->opt & (BER_MORE | BER_INCOMPL);
     size_t string_len = 0;
-    const char *string_ptr = lua_tolstring(bs->L, -1, &string_len);
+    const char *string_ptr = bs->vis->tostr (bs, &string_len);
 
     if (chunk & BER_MORE) {
 	len = b->v.size;
@@ -82,16 +189,15 @@ ber_encstr (struct bers *bs, int pad)
 		tag_id_t cn;
 		t = &simples[b->tag->subaddr].tag;
 		cn = t->u.cn;
-		b->v.bufp = bs->bp;
 		{
 		    tag_id_t pre = b->u.cn;
 		    unsigned char *tagp = bs->bp;
 		    tagp -= bytes_count(pre);
 		    *tagp |= BER_CONSTR;
 		}
-		*bs->bp++ = 0x80;
-		b->opt |= BER_CONSTR | BER_INCOMPL;
-		b = ber_add (bs, DEN_ENCODE);
+		ber_openlen (bs, b);
+		b->opt |= BER_INCOMPL;
+		b = ber_add (bs, DEN_ENCODE, 0, 0);
 		b->opt = BER_INCOMPL;
 		b->len = 0;
 		*((tag_id_t *) bs->bp) = cn;
@@ -125,6 +231,13 @@ ber_encstr (struct bers *bs, int pad)
     /* cut to chunks? */
     {
 	int bound = bs->endp - bs->bp;
+	if (bs->sizes_mode == BER_SIZES_COUNT
+	 || (bs->gather && len >= bs->gather_min))
+	    bound = len; /* not copied */
+	else if (len > bound && bs->grow) {
+	    ber_out_grow (bs, len);
+	    bound = bs->endp - bs->bp;
+	}
 	if (len > bound) {
 	    b->v.size = len - bound;
 	    len = bound;
@@ -132,8 +245,13 @@ ber_encstr (struct bers *bs, int pad)
 	}
     }
     /* copy (sub)string */
-    memcpy (bs->bp, string_ptr + b->len, len);
-    bs->bp += len;
+    if (bs->sizes_mode == BER_SIZES_COUNT) bs->sizes_len += len;
+    else if (bs->gather && len >= bs->gather_min)
+	bs->gather (bs, (const unsigned char *) string_ptr + b->len, len);
+    else {
+	memcpy (bs->bp, string_ptr + b->len, len);
+	bs->bp += len;
+    }
 
     if (b->opt & (BER_MORE | BER_INCOMPL)) {
 	b->len += len;
@@ -142,25 +260,204 @@ ber_encstr (struct bers *bs, int pad)
     return 0;
 }
 
+/* Is cn the tag of t or of an alternative of untagged CHOICE t? */
+static int
+ber_rawtag (const struct mmodr *mo, const struct tmt *t, const tag_id_t cn,
+ const int level)
+{
+    if (t->u.cn) return t->u.cn == cn;
+    if (!(t->opt & TAG_CHOICE) || level >= CHOICES_MAX) return 0;
+    for (t = mo->odrs + t->subaddr; ; t = mo->odrs + t->comp_next) {
+	if (ber_rawtag (mo, t, cn, level + 1)) return 1;
+	if (!t->comp_next) return 0;
+    }
+}
+
+/* Splice pre-encoded TLV of value on top as component t (by chunks) */
+static int
+ber_encraw (struct bers *bs, const struct tmt *t)
+{
+    struct ber *b = bs->top;
+    size_t raw_len = 0;
+    const unsigned char *raw =
+     (const unsigned char *) bs->vis->tostr (bs, &raw_len);
+    int len, bound;
+
+    if (b->opt & BER_MORE) b->opt &= ~BER_MORE;
+    else {
+	const unsigned char *p = raw;
+	struct ber_tlv v;
+	if (!raw_len || ber_tlv_get (&p, raw + raw_len, &v)
+	 || !ber_rawtag (bs->odr, t, v.cn, 0))
+	    longjmp (*bs->jb, BER_ERRTAGODR); /* Tag differs from odr */
+	b->len = 0;
+    }
+    len = (int) raw_len - b->len;
+    /* cut to chunks? */
+    bound = bs->endp - bs->bp;
+    if (bs->sizes_mode == BER_SIZES_COUNT
+     || (bs->gather && len >= bs->gather_min))
+	bound = len; /* not copied */
+    else if (len > bound && bs->grow) {
+	ber_out_grow (bs, len);
+	bound = bs->endp - bs->bp;
+    }
+    if (len > bound) {
+	len = bound;
+	b->opt |= BER_MORE;
+    }
+    /* copy (part of) TLV */
+    if (bs->sizes_mode == BER_SIZES_COUNT) bs->sizes_len += len;
+    else if (bs->gather && len >= bs->gather_min)
+	bs->gather (bs, raw + b->len, len);
+    else {
+	memcpy (bs->bp, raw + b->len, len);
+	bs->bp += len;
+    }
+    if (b->opt & BER_MORE) {
+	b->len += len;
+	return BER_MORE;
+    }
+    return 0;
+}
+
+/* Encode OCTET STRING from reader on top as constructed one of
+ * indefinite length: segments are read in place of buffer, which is
+ * returned as chunk (BER_INCOMPL) when it has no room for next one
+ */
+static int
+ber_encread (struct bers *bs)
+{
+    struct ber *b = bs->top;
+    const int seg = (bs->seg_size > 0) ? bs->seg_size : ENC_SEGSZ;
+    const int hdr = 2 + ber_lenlen (seg);
+
+    if (bs->sizes_mode)
+	longjmp (*bs->jb, BER_ERRLUAOUT); /* Reader has no size */
+    if (b->opt & BER_MORE) b->opt &= ~BER_MORE;
+    else {
+	*bs->bp++ = BER_INDEFIN;
+	b->len = 0; /* -1 - end of reader */
+    }
+    while (b->len >= 0) {
+	unsigned char *p, *q;
+	int room = bs->endp - bs->bp - hdr, n = 0, k;
+
+	if (room < seg && bs->grow) {
+	    ber_out_grow (bs, hdr + seg);
+	    room = bs->endp - bs->bp - hdr;
+	}
+	if (room < seg) {
+	    if (bs->bp > bs->buf) goto chunk;
+	    if (room < 1) longjmp (*bs->jb, BER_ERRMEM); /* Tiny buffer */
+	} else room = seg;
+	p = bs->bp + hdr;
+	while (n < room && (k = bs->vis->read (bs, p + n, room - n)) > 0)
+	    n += k;
+	if (n < room) b->len = -1;
+	if (!n) break;
+	/* segment: primitive OCTET STRING */
+	q = bs->bp;
+	*q++ = simples[FUN_OCT].tag.u.cn;
+	q = ber_setlen (q, n);
+	if (q != p) memmove (q, p, n);
+	bs->bp = q + n;
+    }
+    /* End Of Contents */
+    if (bs->endp - bs->bp < 2) goto chunk;
+    *bs->bp++ = 0;
+    *bs->bp++ = 0;
+    return 0;
+ chunk:
+    b->opt |= BER_MORE;
+    return BER_INCOMPL;
+}
+
+/* Ber of string, whose segment (of constructed one) is in ber b */
+static struct ber *
+ber_strown (struct bers *bs, struct ber *b)
+{
+    while (b > bs->stack && (b->opt & BER_INCOMPL)) --b;
+    return b;
+}
+
+/* Are octets of OCTET STRING t (not segment) in ber b for sink? */
+static int
+ber_sinkable (const struct bers *bs, const struct ber *b,
+ const struct tmt *t)
+{
+    if (!bs->sink || t->subaddr != FUN_OCT || (b->opt & BER_INCOMPL)
+     || t == &simples[FUN_OCT].tag)
+	return 0;
+    if (bs->sink_marks && bs->sink_marks[t - bs->odr->odrs]) return 1;
+    return bs->sink_min > 0
+     && ((b->opt & BER_INDEFIN) || b->len >= bs->sink_min);
+}
+
+/* Push decoded octets: slice or copy (or count of octets in sink) */
+static void
+ber_pushstr (struct bers *bs, int len)
+{
+    struct ber *b = (bs->sink) ? ber_strown (bs, bs->top) : bs->top;
+
+    /* octets in sink are counted on the stack */
+    if (b->opt & BER_SINK) {
+	const unsigned int n = bs->vis->tonum (bs);
+	bs->sink (bs, b->tag, bs->bp, len);
+	bs->vis->pop (bs);
+	bs->vis->num (bs, n + len);
+    }
+    /* cutted and constructed strings are concatenated on the stack */
+    else if (bs->slice && len >= bs->slice_min
+     && !(bs->top->opt & (BER_MORE | BER_INCOMPL))
+     && bs->vis->top (bs) == BER_VCONS)
+	bs->slice (bs, bs->bp, len);
+    else bs->vis->str (bs, bs->bp, len);
+    bs->bp += len;
+}
+
 static int
 ber_oct (struct bers *bs, int len, unsigned char opt)
 {
     if (opt & DEN_DECODE) {
-	lua_pushlstring (bs->L, (char *) bs->bp, len);
-	bs->bp += len;
+	ber_pushstr (bs, len);
 	return 0;
     }
     return ber_encstr (bs, 0);
 }
 
+/* Octets by value: the masked last octet of BIT STRING is pushed from
+ * here, as the source (Lua string, PDU shared by threads) is read only */
+#define OCTETS4(n)	(n), (n) + 1, (n) + 2, (n) + 3
+#define OCTETS16(n)	OCTETS4 (n), OCTETS4 ((n) + 4), OCTETS4 ((n) + 8), \
+			OCTETS4 ((n) + 12)
+#define OCTETS64(n)	OCTETS16 (n), OCTETS16 ((n) + 16), \
+			OCTETS16 ((n) + 32), OCTETS16 ((n) + 48)
+
+static const unsigned char octets[256] = {
+    OCTETS64 (0), OCTETS64 (64), OCTETS64 (128), OCTETS64 (192)
+};
+
+/* Push copy of len octets followed by the masked last one */
+static void
+ber_pushmasked (struct bers *bs, const int len, const unsigned char last)
+{
+    bs->vis->str (bs, bs->bp, len);
+    bs->vis->str (bs, octets + last, 1);
+    bs->vis->cat (bs);
+    bs->bp += len + 1;
+}
+
 static int
 ber_bit (struct bers *bs, int len, unsigned char opt)
 {
     /* unused bits ignored */
     if (opt & DEN_DECODE) {
-	bs->bp[--len] &= 0xFF >> *bs->bp++;
-	lua_pushlstring (bs->L, (char *) bs->bp, len);
-	bs->bp += len;
+	const unsigned char mask = 0xFF >> *bs->bp++;
+
+	if (--len > 0 && (bs->bp[len - 1] & ~mask))
+	    ber_pushmasked (bs, len - 1, bs->bp[len - 1] & mask);
+	else ber_pushstr (bs, len);
 	return 0;
     }
     return ber_encstr (bs, 1);
@@ -170,11 +467,11 @@ static int
 ber_oid (struct bers *bs, int len, unsigned char opt)
 {
     if (opt & DEN_DECODE) {
-	lua_pushlstring (bs->L, (char *) bs->bp, len);
+	bs->vis->str (bs, bs->bp, len);
 	bs->bp += len;
     } else {
 	size_t slen = 0;
-	const char *s = lua_tolstring(bs->L, -1, &slen);
+	const char *s = bs->vis->tostr (bs, &slen);
 	*bs->bp++ = slen;
 	memcpy (bs->bp, s, slen);
 	bs->bp += slen;
@@ -192,9 +489,9 @@ ber_int (struct bers *bs, int len, unsigned char opt)
 	    i <<= 8;
 	    i |= *bs->bp++;
 	}
-	lua_pushnumber (bs->L, i);
+	bs->vis->num (bs, i);
     } else {
-	i = (int) lua_tonumber (bs->L, -1);
+	i = bs->vis->tonum (bs);
 	do {
 	    num <<= 8;
 	    num |= (unsigned char) i;
@@ -213,10 +510,10 @@ ber_bool (struct bers *bs, int len, unsigned char opt)
 {
     UNUSED (len);
     if (opt & DEN_DECODE)
-	lua_pushboolean (bs->L, *bs->bp++ != 0);
+	bs->vis->boolean (bs, *bs->bp++ != 0);
     else {
 	*bs->bp++ = 1;
-	*bs->bp++ = lua_toboolean (bs->L, -1);
+	*bs->bp++ = bs->vis->tobool (bs);
     }
     return 0;
 }
@@ -225,41 +522,44 @@ static int
 ber_null (struct bers *bs, int len, unsigned char opt)
 {
     UNUSED (len);
-    if (opt & DEN_DECODE) lua_pushboolean (bs->L, 0);
+    if (opt & DEN_DECODE) bs->vis->boolean (bs, 0);
     else *bs->bp++ = 0;
     return 0;
 }
 
+/* Find module by oid (oidp[0] - length) */
+static struct module_id *
+ber_ext_mid (const struct mmodr *mo, const unsigned char *oidp)
+{
+    struct module_id *mbeg = mo->modules;
+    struct module_id *mend = mbeg + mo->nmodules - 1;
+
+    /* binary search of module by oid */
+    while (mbeg <= mend) {
+	struct module_id *mid = mbeg + ((mend - mbeg) >> 1);
+	int res = *oidp - *mid->oid;
+	if (!res) res = memcmp (oidp, mid->oid, *oidp + 1);
+	if (!res) return mid;
+	if (res < 0) mend = mid - 1;
+	else mbeg = mid + 1;
+    }
+    return NULL;
+}
+
 static int
 ber_ext_dref (struct bers *bs, int len, unsigned char opt)
 {
-    struct module_id *mid;
-    unsigned char oid[OIDSIZ], *oidp = bs->bp;
-    int res;
+    unsigned char oid[OIDSIZ + 1], *oidp = bs->bp;
 
     ber_oid (bs, len, opt);
     /* oidp points to len..content of oid */
     if (opt & DEN_DECODE) {
-	if (bs->bp == bs->buf) {
-	    memcpy (oid + 1, bs->bp, oid[0] = len);
+	if (oidp == bs->buf) { /* length octet in previous chunk */
+	    memcpy (oid + 1, oidp, oid[0] = len);
 	    oidp = oid;
 	} else --oidp;
-    } else len = *oidp;
-    ++len;
-    /* binary search of module by oid */
-    {
-	struct module_id *mbeg = bs->odr->modules;
-	struct module_id *mend = mbeg + bs->odr->nmodules - 1;
-	do {
-	    mid = mbeg + ((mend - mbeg) >> 1);
-	    res = *oidp - *mid->oid;
-	    if (!res) res = memcmp (oidp, mid->oid, len);
-	    if (!res) break;
-	    if (res < 0) mend = mid - 1;
-	    else mbeg = mid + 1;
-	} while (mbeg <= mend);
-    }
-    bs->ext_mid = res ? NULL : mid;
+    }
+    bs->ext_mid = ber_ext_mid (bs->odr, oidp);
     return 0;
 }
 
@@ -271,18 +571,19 @@ ber_ext_asn (struct bers *bs, int len, unsigned char opt)
     UNUSED (len);
 
     if (opt & DEN_DECODE) {
-	b = ber_add (bs, DEN_DECODE);
+	if (bs->walk)
+	    ber_walk (bs, BER_WALK_START, b->tag, b->no, bs->bp,
+	     (b->opt & BER_INDEFIN) ? -1 : b->len);
+	b = ber_add (bs, DEN_DECODE, 0, 1);
 	b->v.size = b->opt = 0;
 	b->next = bs->odr->odrs;
 	if (mid) b->next += mid->addr;
     } else {
 	if (!mid) longjmp (*bs->jb, BER_ERREXTOID); /* Bad Ext.OID */
 	*(bs->bp - 1) |= BER_CONSTR; /* Ext_ASN is constructed */
-	b->opt |= BER_CONSTR;
-	b->v.bufp = bs->bp;
-	*bs->bp++ = 0x80;
+	ber_openlen (bs, b);
 
-	b = ber_add (bs, DEN_ENCODE);
+	b = ber_add (bs, DEN_ENCODE, 0, 0);
 	b->opt = 0;
 	b->next = bs->odr->odrs + mid->addr;
 	b->no = COMP_START_NUM - 1;
@@ -296,7 +597,18 @@ static int
 ber_oct_skip (struct bers *bs, int len, unsigned char opt)
 {
     UNUSED (opt);
-    lua_pushlstring (bs->L, NULL, 0);
+    bs->vis->str (bs, NULL, 0);
+    bs->bp += len;
+    return 0;
+}
+
+/* Ignore input octets outside of projection: nil value of last chunk */
+static int
+ber_proj_skip (struct bers *bs, int len, unsigned char opt)
+{
+    UNUSED (opt);
+    if (!(bs->top->opt & BER_MORE))
+	bs->vis->nil (bs);
     bs->bp += len;
     return 0;
 }
@@ -304,18 +616,69 @@ ber_oct_skip (struct bers *bs, int len, unsigned char opt)
 /* ========================================>> */
 
 
-/* Add ber to bers stack */
+/* Grow bers stack twice up to limit */
+static void
+ber_grow (struct bers *bs)
+{
+    const unsigned int max = (bs->maxdepth) ? bs->maxdepth : BERS_MAX;
+    unsigned int n = (bs->nstack) ? bs->nstack * 2 : BERS_MIN;
+    struct ber *stack;
+
+    if (bs->nstack >= max)
+	longjmp (*bs->jb, BER_ERRSTKO); /* Bers stack overflow */
+    if (n > max) n = max;
+    stack = realloc (bs->stack, n * sizeof (struct ber));
+    if (!stack) longjmp (*bs->jb, BER_ERRMEM);
+    bs->stack = stack;
+    bs->nstack = n;
+}
+
+/* Add ber to bers stack (decode: with table of narr, nrec size hints) */
 static struct ber *
-ber_add (struct bers *bs, const unsigned char opt)
+ber_add (struct bers *bs, const unsigned char opt,
+ const int narr, const int nrec)
 {
-    if (!bs->top) bs->top = bs->stack;
-    else if (++bs->top - bs->stack >= BERS_MAX)
+    const unsigned int i = (bs->top) ? bs->top - bs->stack + 1 : 0;
+
+    if (bs->maxdepth && i >= bs->maxdepth) /* limit lowered after growth */
 	longjmp (*bs->jb, BER_ERRSTKO); /* Bers stack overflow */
-    if ((opt & (DEN_DECODE | DEN_SIMPLE)) == DEN_DECODE)
-	lua_newtable (bs->L);
+    if (i >= bs->nstack) ber_grow (bs);
+    bs->top = bs->stack + i;
+    if (bs->vis->room && !bs->vis->room (bs))
+	longjmp (*bs->jb, BER_ERRLUASTK); /* Stack of values overflow */
+    if ((opt & (DEN_DECODE | DEN_SIMPLE)) == DEN_DECODE) {
+	if (!bs->walk) bs->vis->begin (bs, narr, nrec);
+	else if (i) bs->vis->mark (bs); /* mark of value */
+    } else if (opt & DEN_ENCODE)
+	bs->top->u.cn = 0; /* no tag yet: stack is reused */
     return bs->top;
 }
 
+/* Report walk event; stop on nonzero result of walk */
+static void
+ber_walk (struct bers *bs, const int ev, const struct tmt *t, const int no,
+ const unsigned char *p, const int len)
+{
+    if (bs->walk (bs, ev, t, no, p, len))
+	longjmp (*bs->jb, BER_ERRSTOP); /* Stopped by walk */
+}
+
+/* Set value into constructed one below it or walk it */
+static void
+ber_set (struct bers *bs, const struct tmt *t, const int no)
+{
+    if (!bs->walk) {
+	bs->vis->set (bs, no);
+	return;
+    }
+    if (t != &simples[FUN_SKIP].tag) {
+	if (bs->vis->top (bs) == BER_VMARK)
+	    ber_walk (bs, BER_WALK_END, t, no, NULL, 0);
+	else ber_walk (bs, BER_WALK_VALUE, t, no, bs->walkp, bs->walklen);
+    }
+    bs->vis->pop (bs);
+}
+
 /* Delete top ber's from stack */
 static void
 ber_del (struct bers *bs, unsigned char opt)
@@ -327,7 +690,7 @@ ber_del (struct bers *bs, unsigned char opt)
 //fprintf (stderr, "- top=%d\n", bpr - bs->stack);
     if (bpr-- == bs->stack) {
 	if (opt & DEN_DECODE)
-	    lua_rawseti (bs->L, -2, bs->top->no);
+	    ber_set (bs, bs->top->tag, bs->top->no);
 	bs->top = NULL;
 	return;
     }
@@ -339,28 +702,35 @@ ber_del (struct bers *bs, unsigned char opt)
 		opt &= ~BER_INDEFIN;
 		bpr->v.size += bs->top->v.size;
 		--bs->top, --bpr;
+		if (bpr < bs->stack) break; /* bottom value is complete */
 	    }
 	    b = bs->top;
-	    if (b->opt & BER_INCOMPL)
-		lua_concat (bs->L, 2);
-	    else lua_rawseti (bs->L, -2, b->no);
-	    /* elements of type_of | cutted chunks */
-	    if ((b->opt & TAG_TYPE_OF) && !b->next) {
-		i = bpr->tag->subaddr;
-		b->next = (b->opt & BER_INCOMPL)
-		 ? &simples[i].tag : bs->odr->odrs + i;
-		++b->no;
-		b->opt &= BER_INCOMPL | TAG_TYPE_OF;
-	    }
+	    if (!(b->opt & BER_INCOMPL))
+		ber_set (bs, b->tag, b->no);
+	    else if (bs->walk) /* segment of string */
+		ber_set (bs, bpr->tag, bpr->no);
+	    else if (!(ber_strown (bs, b)->opt & BER_SINK))
+		bs->vis->cat (bs);
 	    if (b->opt & TAG_CHOICE) {
 		for (; bpr >= bs->stack && !bpr->u.cn; --bpr)
-		    lua_rawseti (bs->L, -2, bpr->no);
+		    if (bs->walk) bs->vis->pop (bs);
+		    else bs->vis->set (bs, bpr->no);
 		if (bpr < bs->stack) break;
 		bs->top = bpr + 1;
 		*bs->top = *b;
 		b = bs->top;
 		b->opt &= ~TAG_CHOICE;
 	    }
+	    /* elements of type_of (of choice) | cutted chunks */
+	    if (b->opt & TAG_TYPE_OF) {
+		i = bpr->tag->subaddr;
+		b->next = (b->opt & BER_INCOMPL)
+		 ? &simples[i].tag : bs->odr->odrs + i;
+		++b->no;
+		b->opt &= BER_INCOMPL | TAG_TYPE_OF | BER_PROJ;
+		if (!(b->opt & BER_INCOMPL))
+		    b->opt |= bpr->tag->opt & TAG_CHOICE;
+	    }
 	    i = bpr->len - b->v.size;
 	    if (i > 0) return;
 	    if (i < 0) {
@@ -376,15 +746,20 @@ ber_del (struct bers *bs, unsigned char opt)
 	    bpr->opt &= ~BER_INCOMPL;
 	else
 #endif
-	    lua_pop (bs->L, 1);
+	    bs->vis->pop (bs);
 	/* set length */
 	if (bpr->opt & BER_CONSTR) {
 	    if (bpr->opt & BER_INDEFIN) {
 		*bs->bp++ = '\0';
 		*bs->bp++ = '\0';
+	    } else if (bs->sizes_mode == BER_SIZES_COUNT) {
+		int *size = bs->sizes + bpr->v.size;
+		*size = bs->sizes_len + (bs->bp - bs->buf) - *size;
+		bs->sizes_len += ber_lenlen (*size);
 	    } else {
 		i = bs->bp - bpr->v.bufp - 1;
-		if (i >= 0x80) {
+		if (i >= 0x80 && bs->grow) ber_putlen (bs, bpr, i);
+		else if (i >= 0x80) {
 		    struct ber *bi = bpr;
 		    while (--bi >= bs->stack
 		     && !(bi->opt & BER_INDEFIN))
@@ -395,16 +770,67 @@ ber_del (struct bers *bs, unsigned char opt)
 		} else *bpr->v.bufp = i;
 	    }
 	}
-	for (; bpr >= bs->stack && !bpr->u.cn; --bpr)
-	    lua_pop (bs->L, 1);
-	bs->top = bpr;
+	bs->top = bpr; /* untagged CHOICE too: its list goes on */
+    }
+    if (bpr < bs->stack) {
+	/* walk: bottom value is left, if not in CHOICE */
+	if (bs->walk && (opt & DEN_DECODE) && bs->vis->top (bs) != BER_VNONE)
+	    ber_set (bs, bs->stack->tag, bs->stack->no);
+	bs->top = NULL;
+    }
+}
+
+
+/* Find component of list by tag: tagged one or
+ * untagged CHOICE, which contains the tag in alternatives
+ */
+static struct tmt *
+ber_disp (struct bers *bs, struct tmt *t, const int cn, const int level)
+{
+    const struct mmodr *mo = bs->odr;
+    const unsigned short i = mo->lists[t - mo->odrs].disp;
+
+    if (level >= CHOICES_MAX)
+	longjmp (*bs->jb, BER_ERRCHCSO); /* Choices stack overflow */
+    if (i) {
+	/* binary search in dispatch table */
+	const struct odr_disp *dbeg = mo->disps + i + 1;
+	const struct odr_disp *dend = dbeg + mo->disps[i].cn - 1;
+	while (dbeg <= dend) {
+	    const struct odr_disp *d = dbeg + ((dend - dbeg) >> 1);
+	    if (cn == d->cn) return mo->odrs + d->addr;
+	    if (cn < d->cn) dend = d - 1;
+	    else dbeg = d + 1;
+	}
+	return NULL;
+    }
+    for (; ; t = mo->odrs + t->comp_next) {
+	if (cn == t->u.cn) return t;
+	if (!(t->u.cn || (t->opt & TAG_SIMPLE))
+	 && ber_disp (bs, mo->odrs + t->subaddr, cn, level + 1))
+	    return t;
+	if (!t->comp_next) return NULL;
     }
-    if (bpr < bs->stack) bs->top = NULL;
 }
 
+/* Is found tmt (with untagged choices) in projection? */
+static int
+ber_proj_keep (const struct bers *bs, struct tmt **choices, const int ch_i,
+ const struct tmt *t)
+{
+    const struct tmt *odrs = bs->odr->odrs;
+    int i;
+
+    for (i = 0; i < ch_i; ++i)
+	switch (bs->proj[choices[i] - odrs]) {
+	case 0: return 0;
+	case PROJ_ALL: return 1;
+	}
+    return bs->proj[t - odrs];
+}
 
-/* Find tmt from choice */
-static char
+/* Set found tmt; descend untagged choices */
+static void
 ber_choice (struct bers *bs, const int cn, struct tmt *t)
 {
     struct ber *b = bs->top;
@@ -412,20 +838,19 @@ ber_choice (struct bers *bs, const int cn, struct tmt *t)
     int ch_i = 0;
 
     while (cn != t->u.cn) {
-	if (!t->u.cn) {
-	    choices[ch_i++] = t;
-	    if (ch_i >= CHOICES_MAX)
-		longjmp (*bs->jb, BER_ERRCHCSO); /* Choices stack overflow */
-	    t = bs->odr->odrs + t->subaddr;
-	    continue;
-	}
-	if (!t->comp_next) {
-	    while (--ch_i >= 0 && !choices[ch_i]->comp_next)
-		;
-	    if (ch_i < 0) return 0;
-	    t = choices[ch_i];
+	choices[ch_i++] = t;
+	t = ber_disp (bs, bs->odr->odrs + t->subaddr, cn, ch_i);
+	if (!t) longjmp (*bs->jb, BER_ERRTAGODR); /* Missing odr */
+    }
+    if ((b->opt & BER_PROJ) && !ber_proj_keep (bs, choices, ch_i, t)) {
+	/* skip the value without choices */
+	b->tag = &simples[FUN_SKIP].tag;
+	b->no = (ch_i ? choices[0] : t)->comp_no;
+	if (ch_i) {
+	    const int next = choices[0]->comp_next;
+	    b->next = next ? bs->odr->odrs + next : NULL;
 	}
-	t = bs->odr->odrs + t->comp_next;
+	return;
     }
     b->tag = t;
     if (ch_i) {
@@ -435,14 +860,13 @@ ber_choice (struct bers *bs, const int cn, struct tmt *t)
 	for (i = 0; i < ch_i; ++i) {
 	    b->u.cn = 0;
 	    b->no = choices[i]->comp_no;
-	    b = ber_add (bs, DEN_DECODE);
+	    b = ber_add (bs, DEN_DECODE, 0, 1);
 //fprintf (stderr, "+ >%s addr=%d top=%d\n", bs->odr->names + choices[i]->nameaddr, choices[i] - bs->odr->odrs, b - bs->stack);
 	}
 	*b = bo;
 	b->next = next ? bs->odr->odrs + next : NULL;
 	b->opt |= TAG_CHOICE; /* end of choices */
     }
-    return 1;
 }
 
 /* Find tmt in odrs area */
@@ -452,7 +876,6 @@ ber_odr (struct bers *bs)
     struct ber *b = bs->top;
     struct tmt *t = b->next;
     const int cn = b->u.cn;
-    char fnd = 0;
 
     if (t == bs->odr->odrs) {
 	b->tag = &simples[b->len > 0 ? FUN_OCT_SKIP : FUN_EXT_ASN].tag;
@@ -461,26 +884,29 @@ ber_odr (struct bers *bs)
     b->tag = b->next = NULL;
     if (b->opt & TAG_CHOICE) {
 	b->opt &= ~TAG_CHOICE;
-	fnd = ber_choice (bs, cn, t);
+	t = ber_disp (bs, t, cn, 0);
     } else {
-	while (t && cn != t->u.cn
-	 && ((t->opt & TAG_OPTIONAL) || !t->u.cn)) {
-	    if (!t->u.cn && (fnd = ber_choice (bs, cn, t))) break;
-	    t = (t->comp_next) ? bs->odr->odrs + t->comp_next : NULL;
-	}
-	if (t && cn == t->u.cn) {
-	    if (!fnd) {
-		b->tag = t;
-		fnd = 1;
+	while (t && cn != t->u.cn) {
+	    if (!t->u.cn) {
+		if (!(t->opt & TAG_SIMPLE)
+		 && ber_disp (bs, bs->odr->odrs + t->subaddr, cn, 1))
+		    break;
+	    } else if (!(t->opt & TAG_OPTIONAL)) {
+		t = NULL;
+		break;
 	    }
-	    /* use bs->top - may be added in ber_choice */
-	    if (t->comp_next)
-		bs->top->next = bs->odr->odrs + t->comp_next;
+	    t = (t->comp_next) ? bs->odr->odrs + t->comp_next : NULL;
 	}
+	if (t && cn == t->u.cn && t->comp_next)
+	    b->next = bs->odr->odrs + t->comp_next;
     }
-    if (!fnd) longjmp (*bs->jb, BER_ERRTAGODR); /* Missing odr */
+    if (!t) longjmp (*bs->jb, BER_ERRTAGODR); /* Missing odr */
+    ber_choice (bs, cn, t);
 }
 
+/* Octets of tag and length at most */
+#define TAGLEN_MAX	((int) (1 + (CLASS_NUMSIZ) + 1 + 1 + sizeof (int)))
+
 /* Set tag and length of contents.
  * Return error code and later check bounds (bp >= endp ?)
  */
@@ -496,7 +922,7 @@ ber_taglen (struct bers *bs)
 	return BER_INDEFIN;
     }
     /* tag & tclass */
-    b->opt &= BER_INCOMPL | TAG_CHOICE | TAG_TYPE_OF;
+    b->opt &= BER_INCOMPL | TAG_CHOICE | TAG_TYPE_OF | BER_PROJ;
     b->opt |= *bs->bp & BER_CONSTR;
     c = b->u.cn = 0;
     b->u.id.classnum = *bs->bp & ~BER_CONSTR;
@@ -527,20 +953,50 @@ ber_taglen (struct bers *bs)
     return 0;
 }
 
+/* Skip contents of indefinite length up to End Of Contents.
+ * Return pointer after EOC or NULL, if contents are incomplete
+ */
+static unsigned char *
+ber_skip (struct bers *bs, unsigned char *p)
+{
+    const unsigned char *q = p;
+    const int res = ber_tlvs (&q, bs->endp, 1);
+
+    if (res < 0) longjmp (*bs->jb, res);
+    return res ? NULL : (unsigned char *) q;
+}
+
 /* Process input ber octets */
 unsigned char
 ber_decode (struct bers *bs)
 {
     struct ber *b;
     struct tmt *t;
+    unsigned char *bufp = NULL;
     int i, sub;
     unsigned char c, more;
 
     if (!bs->top) {
-	b = ber_add (bs, DEN_DECODE);
+	/* compiled decoders take complete PDUs */
+	if (bs->odr->decode
+	 && !(bs->start || bs->lazy || bs->proj || bs->walk || bs->split)
+	 && ber_frame (bs->bp, bs->endp, 0, &i) > 0)
+	    return bs->odr->decode (bs);
+	b = ber_add (bs, DEN_DECODE, 0, 1);
 	b->v.size = 0;
-	b->opt = 0;
-	b->next = bs->odr->start;
+	b->opt = (bs->proj) ? BER_PROJ : 0;
+	b->next = (bs->start) ? bs->start : bs->odr->start;
+	/* elements of split SEQUENCE OF, as in its value */
+	if (bs->start_no) {
+	    b->u.cn = bs->start->u.cn;
+	    b->tag = bs->start;
+	    b->len = bs->endp - bs->bp;
+	    b = ber_add (bs, DEN_DECODE, 0, 0);
+	    b->v.size = 0;
+	    b->opt = bs->start->opt & (TAG_CHOICE | TAG_TYPE_OF);
+	    b->next = bs->odr->odrs + bs->start->subaddr;
+	    b->no = bs->start_no;
+	}
     }
     while (bs->top) {
 	b = bs->top;
@@ -548,8 +1004,16 @@ ber_decode (struct bers *bs)
 	more = b->opt & BER_MORE;
 	if (more) b->opt &= ~BER_MORE;
 	else {
-	    unsigned char *bufp = bs->bp;
-	    i = ber_taglen (bs);
+	    bufp = bs->bp;
+	    if (bs->endp - bufp < TAGLEN_MAX) {
+		/* short chunk: tag and length from its zero padded copy */
+		unsigned char tail[TAGLEN_MAX];
+		memset (tail, 0, TAGLEN_MAX);
+		if (bs->endp > bufp) memcpy (tail, bufp, bs->endp - bufp);
+		bs->bp = tail;
+		i = ber_taglen (bs);
+		bs->bp = bufp + (bs->bp - tail);
+	    } else i = ber_taglen (bs);
 	    if (bs->bp > bs->endp) {
 		bs->bp = bufp;
 		return BER_INCOMPL;
@@ -565,7 +1029,12 @@ ber_decode (struct bers *bs)
 	    b = bs->top; /* may be added in ber_odr */
 	    if (!(b->len || (b->opt & BER_INDEFIN)
 	     || b->tag->subaddr == FUN_NULL)) {
-		lua_pushnil (bs->L);
+		if (!(b->opt & TAG_TYPE_OF)
+		 && b->tag != &simples[FUN_SKIP].tag)
+		    b->no = b->tag->comp_no;
+		bs->walkp = bs->bp;
+		bs->walklen = 0;
+		bs->vis->nil (bs);
 		ber_del (bs, DEN_DECODE);
 		continue;
 	    }
@@ -574,7 +1043,7 @@ ber_decode (struct bers *bs)
 	sub = t->subaddr;
 //fprintf (stderr, " >%s addr=%d bp=0x%x\n", bs->odr->names + t->nameaddr, t - bs->odr->odrs, bs->bp - bs->buf);
 
-	if (!(b->opt & TAG_TYPE_OF))
+	if (!(b->opt & TAG_TYPE_OF) && t != &simples[FUN_SKIP].tag)
 	    b->no = t->comp_no;
 	if (t->opt & TAG_SIMPLE) {
 	    if (more) /* concat of cutted octets? */
@@ -582,16 +1051,40 @@ ber_decode (struct bers *bs)
 	    else /* constructed simples */
 		if ((b->opt & BER_CONSTR)
 		 && (simples[sub].tag.opt & TAG_COMPONENTS)) {
-		    lua_pushlstring (bs->L, NULL, 0);
-		    b = ber_add (bs, DEN_DECODE | DEN_SIMPLE);
+		    if (!bs->walk) {
+			if (ber_sinkable (bs, b, t)) {
+			    b->opt |= BER_SINK;
+			    bs->vis->num (bs, 0);
+			} else if (!(ber_strown (bs, b)->opt & BER_SINK))
+			    bs->vis->str (bs, NULL, 0);
+		    } else {
+			ber_walk (bs, BER_WALK_START, t, b->no, bs->bp,
+			 (b->opt & BER_INDEFIN) ? -1 : b->len);
+			bs->vis->mark (bs);
+		    }
+		    b = ber_add (bs, DEN_DECODE | DEN_SIMPLE, 0, 0);
 		    b->v.size = 0;
 		    b->opt = BER_INCOMPL | TAG_TYPE_OF;
 		    b->next = &simples[sub].tag;
 		    b->no = COMP_START_NUM;
 		    continue;
 		}
+	    /* count of octets instead of string in sink */
+	    if (!more && !bs->walk && ber_sinkable (bs, b, t)) {
+		b->opt |= BER_SINK;
+		bs->vis->num (bs, 0);
+	    }
 	    /* check length */
-	    if (sub != FUN_EXT_ASN) {
+	    if (sub == FUN_SKIP && (b->opt & BER_INDEFIN)) {
+		/* scan up to End Of Contents again in next chunk */
+		unsigned char *endp = ber_skip (bs, bs->bp);
+		if (!endp) {
+		    b->opt |= BER_MORE;
+		    return BER_INCOMPL;
+		}
+		i = endp - bs->bp;
+		b->v.size += i;
+	    } else if (sub != FUN_EXT_ASN) {
 		i = b->len;
 		c = simples[sub].berlen_max;
 		if (c && i > c)
@@ -599,23 +1092,63 @@ ber_decode (struct bers *bs)
 		if (i > bs->endp - bs->bp) {
 		    b->opt |= BER_MORE;
 		    /* gather only octet strings */
-		    if (sub != FUN_OCT && sub != FUN_OCT_SKIP)
+		    if (sub != FUN_OCT && sub != FUN_OCT_SKIP
+		     && sub != FUN_SKIP)
 			return BER_INCOMPL;
 		    i = bs->endp - bs->bp;
 		    b->len -= i;
 		}
 		b->v.size += i;
 	    } else i = 0;
+	    bs->walkp = bs->bp;
+	    bs->walklen = i;
 	    c = simples[sub].fun (bs, i, DEN_DECODE);
-	    if (more) lua_concat (bs->L, 2);
-	    if (b->opt & BER_MORE) return BER_INCOMPL;
-	    if (!c) ber_del (bs, DEN_DECODE);
+	    if (more && !(ber_strown (bs, b)->opt & BER_SINK))
+		bs->vis->cat (bs);
+	    if (!c) { /* else stack may be moved by Ext.ASN */
+		if (b->opt & BER_MORE) return BER_INCOMPL;
+		ber_del (bs, DEN_DECODE);
+	    }
 	} else {
 	    if (!(b->opt & BER_CONSTR))
 		longjmp (*bs->jb, BER_ERRTAG); /* BER is primitive */
-	    b = ber_add (bs, DEN_DECODE);
+	    /* lazy: value's proxy instead of components */
+	    if (bs->lazy && bs->top - bs->stack >= bs->lazy_depth) {
+		unsigned char *endp = (b->opt & BER_INDEFIN)
+		 ? ber_skip (bs, bs->bp) : bs->bp + b->len;
+		if (!endp || endp > bs->endp) return BER_INCOMPL;
+		bs->lazy (bs, t, bufp, endp);
+		b->v.size += endp - bs->bp;
+		bs->bp = endp;
+		ber_del (bs, DEN_DECODE);
+		continue;
+	    }
+	    c = ((b->opt & BER_PROJ)
+	     && bs->proj[t - bs->odr->odrs] == PROJ_PATH) ? BER_PROJ : 0;
+	    /* split: elements are decoded apart */
+	    if (bs->split && (t->opt & TAG_TYPE_OF) && !c
+	     && !(b->opt & BER_INDEFIN) && b->len >= bs->split_min
+	     && b->len <= bs->endp - bs->bp) {
+		bs->split (bs, t, bs->bp, bs->bp + b->len);
+		b->v.size += b->len;
+		bs->bp += b->len;
+		ber_del (bs, DEN_DECODE);
+		continue;
+	    }
+	    if (bs->walk)
+		ber_walk (bs, BER_WALK_START, t, b->no, bs->bp,
+		 (b->opt & BER_INDEFIN) ? -1 : b->len);
+	    if (t->opt & TAG_TYPE_OF) {
+		/* elements in buffer */
+		i = (!(b->opt & BER_INDEFIN) && b->len <= bs->endp - bs->bp)
+		 ? ber_count (bs->bp, bs->bp + b->len) : 0;
+		b = ber_add (bs, DEN_DECODE, i, 0);
+	    } else {
+		const struct odr_list *l = bs->odr->lists + sub;
+		b = ber_add (bs, DEN_DECODE, l->narr, l->nrec);
+	    }
 	    b->v.size = 0;
-	    b->opt = t->opt & (TAG_CHOICE | TAG_TYPE_OF);
+	    b->opt = (t->opt & (TAG_CHOICE | TAG_TYPE_OF)) | c;
 	    b->next = bs->odr->odrs + sub;
 	    b->no = COMP_START_NUM;
 //fprintf (stderr, "+ top=%d\n", bs->top - bs->stack);
@@ -624,20 +1157,73 @@ ber_decode (struct bers *bs)
     return (bs->bp < bs->endp) ? BER_MORE : 0;
 }
 
-/* Process output lua table */
+/* Bitmap of keys of ber b (grown with levels of stack) */
+static unsigned int *
+ber_keys (struct bers *bs, const struct ber *b)
+{
+    const unsigned int i = b - bs->stack;
+
+    if (i >= bs->nkeys) {
+	unsigned int *keys = realloc (bs->keys,
+	 bs->nstack * BER_KEYS_WORDS * sizeof (unsigned int));
+	if (!keys) longjmp (*bs->jb, BER_ERRMEM);
+	bs->keys = keys;
+	bs->nkeys = bs->nstack;
+    }
+    return bs->keys + i * BER_KEYS_WORDS;
+}
+
+/* Skip absent components of list of ber b by its keys */
+static void
+ber_keys_skip (struct bers *bs, struct ber *b)
+{
+    const unsigned int *keys = bs->keys + (b - bs->stack) * BER_KEYS_WORDS;
+    int i = b->no + 1 - COMP_START_NUM;
+
+    while (b->next && i < BER_KEYS_MAX
+     && !(keys[i >> 5] & (1U << (i & 31)))) {
+	const int next = b->next->comp_next;
+	b->next = (next) ? bs->odr->odrs + next : NULL;
+	++b->no, ++i;
+    }
+}
+
+/* Return chunk of encoded octets: open values are of indefinite length */
+static unsigned char
+ber_enc_chunk (struct bers *bs)
+{
+    struct ber *b;
+
+    for (b = bs->top; b >= bs->stack && !(b->opt & BER_INDEFIN); --b)
+	b->opt |= BER_INDEFIN;
+    return BER_INCOMPL;
+}
+
+/* Process output value of visitor */
 unsigned char
 ber_encode (struct bers *bs)
 {
     struct ber *b;
     struct tmt *t;
-    int sub, ltp = LUA_TNONE;
+    int sub, ltp = BER_VNONE;
     unsigned char chunk, iscons;
 
     if (!bs->top) {
-	b = ber_add (bs, DEN_ENCODE);
-	b->opt = 0;
-	b->next = bs->odr->start;
-	b->no = COMP_START_NUM - 1;
+	/* compiled encoders put definite lengths of whole PDU */
+	if (bs->odr->encode && bs->grow
+	 && !(bs->start || bs->sizes_mode || bs->gather || bs->hole))
+	    return bs->odr->encode (bs);
+	b = ber_add (bs, DEN_ENCODE, 0, 0);
+	if (bs->start) {
+	    /* the only component start */
+	    b->opt = TAG_CHOICE;
+	    b->next = bs->start;
+	    b->no = bs->start->comp_no - 1;
+	} else {
+	    b->opt = 0;
+	    b->next = bs->odr->start;
+	    b->no = COMP_START_NUM - 1;
+	}
     }
     while (bs->top) {
 	b = bs->top;
@@ -645,93 +1231,495 @@ ber_encode (struct bers *bs)
 	chunk = b->opt & (BER_MORE | BER_INCOMPL);
 	/* find tmt in odrs area */
 	if (!chunk) {
-	    lua_rawgeti (bs->L, -1, ++b->no);
-	    ltp = lua_type (bs->L, -1);
+	    if (b->opt & BER_SPARSE) ber_keys_skip (bs, b);
+	    ltp = bs->vis->get (bs, ++b->no);
 	    t = b->next;
 	    if (b->opt & TAG_TYPE_OF) {
-		if (ltp != LUA_TNIL) {
+		if (ltp != BER_VNIL) {
 		    b->opt = TAG_TYPE_OF;
 		    t = bs->odr->odrs + (b - 1)->tag->subaddr;
 		}
-	    } else if (t && ltp == LUA_TNIL) {
+	    } else if (t && ltp == BER_VNIL) {
 		int i = t->comp_next;
 		do {
-		    lua_pop (bs->L, 1);
-		    lua_rawgeti (bs->L, -1, ++b->no);
-		    ltp = lua_type (bs->L, -1);
-		} while (ltp == LUA_TNIL && (i = bs->odr->odrs[i].comp_next));
+		    bs->vis->pop (bs);
+		    ltp = bs->vis->get (bs, ++b->no);
+		} while (ltp == BER_VNIL && (i = bs->odr->odrs[i].comp_next));
 		t = (i) ? bs->odr->odrs + i : NULL;
 	    }
-	    if (!t || ltp == LUA_TNIL) {
-		lua_pop (bs->L, 1);
+	    if (!t || ltp == BER_VNIL) {
+		bs->vis->pop (bs);
 		ber_del (bs, DEN_ENCODE);
 		continue;
 	    }
-	    /* set next tmt */
+	    /* set next tmt: length of the previous one is set */
 	    b->tag = t;
+	    b->opt &= ~(BER_CONSTR | BER_INDEFIN);
 	    b->next = (!(b->opt & TAG_CHOICE) && t->comp_next)
 	     ? bs->odr->odrs + t->comp_next : NULL;
-	}
+	} else ltp = bs->vis->top (bs);
 	sub = t->subaddr;
 	iscons = !(t->opt & TAG_SIMPLE);
 
-	/* Tag */
-	if (!(chunk & BER_MORE) && t->u.cn) {
+	/* Tag (pre-encoded value has its own) */
+	if (!(chunk & BER_MORE) && t->u.cn
+	 && ltp != BER_VRAW && ltp != BER_VHOLE) {
 	    tag_id_t cn = b->u.cn = t->u.cn;
-	    cn |= (iscons) ? BER_CONSTR : 0;
+	    cn |= (iscons || ltp == BER_VREAD) ? BER_CONSTR : 0;
 	    *((tag_id_t *) bs->bp) = cn;
 	    //for (; cn; cn >>= 8) ++bs->bp;
 	    bs->bp += bytes_count(cn);
-	    if (iscons) {
-		b->v.bufp = bs->bp;
-		*bs->bp++ = 0x80;
-		b->opt |= BER_CONSTR;
-	    }
+	    if (iscons) ber_openlen (bs, b);
 	}
 	/* Content */
 //fprintf (stderr, ">%s\n", bs->odr->names + b->tag->nameaddr);
-	if (iscons) {
-	    if (ltp != LUA_TTABLE)
+	if (ltp == BER_VRAW) {
+	    if (!ber_encraw (bs, t))
+		bs->vis->pop (bs);
+	} else if (ltp == BER_VHOLE) {
+	    struct ber *bi;
+	    int level = 0;
+	    if (!bs->hole)
+		longjmp (*bs->jb, BER_ERRLUAOUT); /* Bad PDU */
+	    for (bi = bs->stack; bi < b; ++bi)
+		if (bi->tag->u.cn) ++level;
+	    bs->hole (bs, t, level);
+	    bs->vis->pop (bs);
+	} else if (ltp == BER_VREAD) {
+	    if (sub != FUN_OCT || !bs->vis->read)
+		longjmp (*bs->jb, BER_ERRLUAOUT); /* Bad PDU */
+	    if (ber_encread (bs)) return ber_enc_chunk (bs);
+	    bs->vis->pop (bs);
+	} else if (iscons) {
+	    if (ltp != BER_VCONS)
 		longjmp (*bs->jb, BER_ERRLUAOUT); /* Bad PDU */
-	    b = ber_add (bs, DEN_ENCODE);
+	    b = ber_add (bs, DEN_ENCODE, 0, 0);
 	    b->opt = t->opt & (TAG_CHOICE | TAG_TYPE_OF);
 	    b->next = bs->odr->odrs + sub;
 	    b->no = COMP_START_NUM - 1;
+	    /* many OPTIONAL components: walk present ones only */
+	    if (!b->opt && bs->vis->keys) {
+		const struct odr_list *l = bs->odr->lists + sub;
+		if (l->nopt >= ENC_SPARSE_MIN && l->narr <= BER_KEYS_MAX) {
+		    unsigned int *keys = ber_keys (bs, b);
+		    memset (keys, 0, BER_KEYS_WORDS * sizeof (unsigned int));
+		    bs->vis->keys (bs, keys, l->narr);
+		    b->opt = BER_SPARSE;
+		}
+	    }
 //fprintf (stderr, "+ top=%d\n", b - bs->stack);
 	} else
 	    if (!simples[sub].fun (bs, 0, DEN_ENCODE))
-		lua_pop (bs->L, 1);
-	/* Buffer overflow? */
-	if (bs->endp - bs->bp < ENC_BUFRESERVE) {
-	    for (b = bs->top; b >= bs->stack
-	     && !(b->opt & BER_INDEFIN); --b)
-		b->opt |= BER_INDEFIN;
-	    return BER_INCOMPL;
+		bs->vis->pop (bs);
+	/* Buffer overflow? (sized PDU may fit in whole) */
+	if (bs->endp - bs->bp < (int) ENC_BUFRESERVE (bs)
+	 && !(bs->sizes_mode == BER_SIZES_PUT
+	 && (size_t) (bs->endp - bs->buf)
+	 >= bs->sizes_len + sizeof (tag_id_t))) {
+	    if (bs->sizes_mode == BER_SIZES_COUNT) {
+		bs->sizes_len += bs->bp - bs->buf;
+		bs->bp = bs->buf;
+		continue;
+	    }
+	    if (bs->grow) {
+		ber_out_grow (bs, ENC_BUFRESERVE (bs));
+		continue;
+	    }
+	    return ber_enc_chunk (bs);
 	}
     }
+    if (bs->sizes_mode == BER_SIZES_PUT) bs->sizes_mode = 0;
+    return 0;
+}
+
+/* Count octets of PDU of value on top of visitor and sizes of its
+ * constructed values, encoding in scratch buffer buf..endp without
+ * copies of strings. Then ber_encode () puts definite lengths of the
+ * same value by sizes in one pass (whole PDU fits in buffer of
+ * sizes_len + sizeof (tag_id_t) octets)
+ */
+size_t
+ber_encode_size (struct bers *bs)
+{
+    bs->sizes_mode = BER_SIZES_COUNT;
+    bs->nsizes = 0;
+    bs->sizes_len = 0;
+    bs->bp = bs->buf;
+    ber_encode (bs);
+    bs->sizes_len += bs->bp - bs->buf;
+    bs->bp = bs->buf;
+    bs->sizes_mode = BER_SIZES_PUT;
+    bs->sizes_no = 0;
+    return bs->sizes_len;
+}
+
+/* Size of projection marks */
+int
+ber_proj_size (const struct mmodr *mo)
+{
+    return ((const struct odr_info *) mo->odrs)->nodrs;
+}
+
+/* Find component of list by name: named one or alternative of
+ * untagged CHOICE, which is marked as path (proj NULL - no marks)
+ */
+static struct tmt *
+ber_proj_find (const struct mmodr *mo, unsigned char *proj,
+ struct tmt *t, const char *name, const size_t len, const int level)
+{
+    if (level >= CHOICES_MAX) return NULL;
+    for (; ; t = mo->odrs + t->comp_next) {
+	const char *s = mo->names + t->nameaddr;
+	if (!strncmp (s, name, len) && !s[len]) return t;
+	if (!(t->u.cn || (t->opt & TAG_SIMPLE))) {
+	    struct tmt *found = ber_proj_find (mo, proj,
+	     mo->odrs + t->subaddr, name, len, level + 1);
+	    if (found) {
+		if (proj && !proj[t - mo->odrs])
+		    proj[t - mo->odrs] = PROJ_PATH;
+		return found;
+	    }
+	}
+	if (!t->comp_next) return NULL;
+    }
+}
+
+/* Find component of dotted path (from start tmt),
+ * marking its way in projection (proj NULL - no marks)
+ */
+static struct tmt *
+ber_path_walk (const struct mmodr *mo, unsigned char *proj,
+ const char *path)
+{
+    struct tmt *t = mo->start;
+
+    for (; ; ) {
+	const char *dot = strchr (path, '.');
+	const size_t len = dot ? (size_t) (dot - path) : strlen (path);
+
+	if (!len || !(t = ber_proj_find (mo, proj, t, path, len, 0)))
+	    return NULL;
+	if (!dot) return t;
+	/* descend to components (of element of TYPE_OF) */
+	if (t->opt & TAG_SIMPLE) return NULL;
+	if (proj && !proj[t - mo->odrs]) proj[t - mo->odrs] = PROJ_PATH;
+	if (t->opt & TAG_TYPE_OF) {
+	    t = mo->odrs + t->subaddr;
+	    if (t->u.cn) {
+		if (t->opt & TAG_SIMPLE) return NULL;
+		if (proj && !proj[t - mo->odrs])
+		    proj[t - mo->odrs] = PROJ_PATH;
+		t = mo->odrs + t->subaddr;
+	    }
+	} else t = mo->odrs + t->subaddr;
+	path = dot + 1;
+    }
+}
+
+/* Mark components of dotted path (from start tmt) in projection */
+int
+ber_proj_path (const struct mmodr *mo, unsigned char *proj,
+ const char *path)
+{
+    struct tmt *t = ber_path_walk (mo, proj, path);
+
+    if (!t) return BER_ERRPATH;
+    proj[t - mo->odrs] = PROJ_ALL;
     return 0;
 }
 
-const char *
-ber_errstr (const int no)
-{
-    switch (no) {
-    case BER_ERRMEM:	return "memory";
-    case BER_ERRTAG:	return "bad tag";
-    case BER_ERRTAGNUM:	return "bad tag.number";
-    case BER_ERRTAGLEN:	return "bad tag.length";
-    case BER_ERRTAGODR:	return "bad tag.odr";
-    case BER_ERROIDMID:	return "unknown ModuleID";
-    case BER_ERROID:	return "bad OID";
-    case BER_ERREXT:	return "bad External";
-    case BER_ERREXTOID:	return "bad Ext.OID";
-    case BER_ERRSTKO:	return "bers stack overflow";
-    case BER_ERRSTKU:	return "bers stack underflow";
-    case BER_ERRCHCSO:	return "choices stack overflow";
-    case BER_ERRLUASTK:	return "bad Lua stack";
-    case BER_ERRLUAOUT:	return "bad encode PDU";
-    case BER_ERRSIZE:	return "transfer limit";
-    case BER_ERRODR:	return "bad odr file";
-    default:		return "unknown error";
+/* Component of dotted path (from start tmt) or NULL */
+struct tmt *
+ber_path_find (const struct mmodr *mo, const char *path)
+{
+    return ber_path_walk (mo, NULL, path);
+}
+
+/* <<========================================
+ * Runtime of compiled decoders and encoders (asn2odr -C).
+ * They decode (encode) a complete PDU recursively, without bers stack;
+ * depth - count of bers stack entries, which the interpreter would take
+ */
+
+/* Is there TLV up to endp (NULL - up to End Of Contents)? */
+int
+ber_c_next (struct bers *bs, const unsigned char *endp)
+{
+    if (endp) {
+	if (bs->bp > endp)
+	    longjmp (*bs->jb, BER_ERRTAGLEN); /* Bad length */
+	return bs->bp < endp;
+    }
+    if (bs->endp - bs->bp < 2)
+	longjmp (*bs->jb, BER_ERRTAGLEN); /* Missing End Of Contents */
+    if (!(*bs->bp | *(bs->bp + 1))) {
+	bs->bp += 2;
+	return 0;
+    }
+    return 1;
+}
+
+/* Parse TLV header up to endp (NULL - up to end of buffer) */
+void
+ber_c_tlv (struct bers *bs, const unsigned char *endp, struct ber_tlv *v)
+{
+    const unsigned char *p = bs->bp;
+    const int res = ber_tlv_get (&p, (endp) ? endp : bs->endp, v);
+
+    if (res) longjmp (*bs->jb, res);
+    bs->bp = (unsigned char *) p;
+}
+
+/* Check depth and stack of values for next value */
+static void
+ber_c_depth (struct bers *bs, const int depth)
+{
+    if (depth > (int) ((bs->maxdepth) ? bs->maxdepth : BERS_MAX))
+	longjmp (*bs->jb, BER_ERRSTKO); /* Bers stack overflow */
+    if (bs->vis->room && !bs->vis->room (bs))
+	longjmp (*bs->jb, BER_ERRLUASTK); /* Stack of values overflow */
+}
+
+/* Push constructed value of components */
+void
+ber_c_table (struct bers *bs, const int depth, const int narr, const int nrec)
+{
+    ber_c_depth (bs, depth);
+    bs->vis->begin (bs, narr, nrec);
+}
+
+/* Count of elements of SEQUENCE OF (0 - unknown) */
+int
+ber_c_count (const struct bers *bs, const struct ber_tlv *v)
+{
+    return (v->end) ? ber_count (bs->bp, v->end) : 0;
+}
+
+/* Length of primitive contents up to max octets */
+static int
+ber_c_len (struct bers *bs, const struct ber_tlv *v, const int max)
+{
+    if (v->len < 0)
+	longjmp (*bs->jb, BER_ERRTAG); /* BER is constructed */
+    if (max && v->len > max)
+	longjmp (*bs->jb, BER_ERRTAGLEN); /* Too long length */
+    return v->len;
+}
+
+/* Push OCTET | BIT STRING; segments of constructed one are concatenated */
+void
+ber_c_str (struct bers *bs, const struct ber_tlv *v, const int fun,
+ const int depth)
+{
+    int len;
+
+    if (v->cons) {
+	ber_c_depth (bs, depth + 1);
+	bs->vis->str (bs, NULL, 0);
+	while (ber_c_next (bs, v->end)) {
+	    struct ber_tlv sv;
+	    ber_c_tlv (bs, v->end, &sv);
+	    if (sv.cn != simples[fun].tag.u.cn)
+		longjmp (*bs->jb, BER_ERRTAGODR); /* Missing odr */
+	    if (!sv.len) continue;
+	    ber_c_str (bs, &sv, fun, depth + 1);
+	    bs->vis->cat (bs);
+	}
+	return;
+    }
+    len = v->len;
+    if (fun == FUN_BIT) { /* unused bits ignored */
+	const unsigned char mask = 0xFF >> *bs->bp++;
+
+	if (--len > 0 && (bs->bp[len - 1] & ~mask)) {
+	    ber_pushmasked (bs, len - 1, bs->bp[len - 1] & mask);
+	    return;
+	}
+    }
+    /* segments are on the string */
+    if (bs->slice && len >= bs->slice_min
+     && bs->vis->top (bs) == BER_VCONS)
+	bs->slice (bs, bs->bp, len);
+    else bs->vis->str (bs, bs->bp, len);
+    bs->bp += len;
+}
+
+/* Push primitive value (and find module of direct reference) */
+void
+ber_c_prim (struct bers *bs, const struct ber_tlv *v, const int fun)
+{
+    simples[fun].fun (bs, ber_c_len (bs, v, simples[fun].berlen_max),
+     DEN_DECODE);
+    bs->bp = (unsigned char *) v->end;
+}
+
+/* Push table of encoding of EXTERNAL.
+ * Return module of the direct reference (NULL - unknown)
+ */
+const struct module_id *
+ber_c_ext (struct bers *bs, const int depth)
+{
+    const struct module_id *mid = bs->ext_mid;
+
+    ber_c_table (bs, depth, 0, 1);
+    bs->ext_mid = NULL;
+    return mid;
+}
+
+/* Skip values of EXTERNAL of unknown module */
+void
+ber_c_ext_skip (struct bers *bs, const unsigned char *endp, const int depth)
+{
+    while (ber_c_next (bs, endp)) {
+	struct ber_tlv v;
+	ber_c_tlv (bs, endp, &v);
+	if (v.len > 0) {
+	    bs->vis->str (bs, NULL, 0);
+	    bs->bp = (unsigned char *) v.end;
+	    bs->vis->set (bs, simples[FUN_OCT_SKIP].tag.comp_no);
+	    continue;
+	}
+	if (!v.len) bs->vis->nil (bs);
+	else {
+	    ber_c_ext (bs, depth + 1);
+	    ber_c_ext_skip (bs, NULL, depth + 1);
+	}
+	bs->vis->set (bs, simples[FUN_EXT_ASN].tag.comp_no);
+    }
+}
+
+/* Encoders put value on top of visitor of kind k as component tmt
+ * of address addr into buffer grown by bs->grow (), with definite
+ * lengths in one pass
+ */
+
+/* Room of need octets in buffer */
+static void
+ber_c_room (struct bers *bs, const int need)
+{
+    if (bs->endp - bs->bp < need) ber_out_grow (bs, need);
+}
+
+/* Put tag with room of length after it */
+static void
+ber_c_tag (struct bers *bs, const tag_id_t cn)
+{
+    ber_c_room (bs, sizeof (tag_id_t) + ENC_LLEN_MAX);
+    *((tag_id_t *) bs->bp) = cn;
+    bs->bp += bytes_count(cn);
+}
+
+/* Splice pre-encoded TLV of value on top as component t */
+static void
+ber_c_raw (struct bers *bs, const struct tmt *t)
+{
+    size_t len = 0;
+    const unsigned char *raw =
+     (const unsigned char *) bs->vis->tostr (bs, &len), *p = raw;
+    struct ber_tlv v;
+
+    if (!len || ber_tlv_get (&p, raw + len, &v)
+     || !ber_rawtag (bs->odr, t, v.cn, 0))
+	longjmp (*bs->jb, BER_ERRTAGODR); /* Tag differs from odr */
+    ber_c_room (bs, (int) len);
+    memcpy (bs->bp, raw, len);
+    bs->bp += len;
+}
+
+/* Put primitive value */
+void
+ber_c_put (struct bers *bs, const int addr, const int k)
+{
+    const struct tmt *t = bs->odr->odrs + addr;
+    const int sub = t->subaddr;
+    size_t len = 0;
+
+    if (k == BER_VRAW) {
+	ber_c_raw (bs, t);
+	return;
+    }
+    if (k == BER_VHOLE || k == BER_VREAD)
+	longjmp (*bs->jb, BER_ERRLUAOUT); /* Bad PDU */
+    if (t->u.cn) ber_c_tag (bs, t->u.cn);
+    if (sub == FUN_OCT || sub == FUN_BIT) {
+	const char *s = bs->vis->tostr (bs, &len);
+	const int pad = (sub == FUN_BIT); /* unused bits */
+
+	ber_c_room (bs, ENC_LLEN_MAX + pad + (int) len);
+	bs->bp = ber_setlen (bs->bp, (int) len + pad);
+	if (pad) *bs->bp++ = 0;
+	if (len) memcpy (bs->bp, s, len);
+	bs->bp += len;
+	return;
+    }
+    if (simples[sub].berlen_max == OIDSIZ) bs->vis->tostr (bs, &len);
+    ber_c_room (bs, 1 + sizeof (int) + (int) len);
+    simples[sub].fun (bs, 0, DEN_ENCODE);
+}
+
+/* Open constructed value (or Ext.ASN): put its tag and placeholder
+ * of length. Return offset of the length (0 - untagged one),
+ * -1 - pre-encoded value is put
+ */
+int
+ber_c_open (struct bers *bs, const int addr, const int k, const int depth)
+{
+    const struct tmt *t = bs->odr->odrs + addr;
+    int off;
+
+    if (k == BER_VRAW) {
+	ber_c_raw (bs, t);
+	return -1;
     }
+    if (k != BER_VCONS)
+	longjmp (*bs->jb, BER_ERRLUAOUT); /* Bad PDU */
+    ber_c_depth (bs, depth);
+    if (!t->u.cn) return 0;
+    if (t->opt & TAG_SIMPLE) {
+	if (!bs->ext_mid)
+	    longjmp (*bs->jb, BER_ERREXTOID); /* Bad Ext.OID */
+	ber_c_tag (bs, t->u.cn);
+	*(bs->bp - 1) |= BER_CONSTR; /* Ext_ASN is constructed */
+    } else ber_c_tag (bs, t->u.cn | BER_CONSTR);
+    off = bs->bp - bs->buf;
+    *bs->bp++ = 0x80;
+    return off;
+}
+
+/* Close constructed value: put definite length at offset off
+ * (contents are moved after long one)
+ */
+void
+ber_c_close (struct bers *bs, const int off)
+{
+    const int len = bs->bp - bs->buf - off - 1;
+    const int n = ber_lenlen (len);
+    unsigned char *p;
+
+    if (n) ber_c_room (bs, n);
+    p = bs->buf + off;
+    if (n) {
+	memmove (p + 1 + n, p + 1, len);
+	bs->bp += n;
+    }
+    ber_setlen (p, len);
+}
+
+/* ========================================>> */
+
+
+/* Free bers stack */
+void
+ber_free (struct bers *bs)
+{
+    free (bs->stack);
+    bs->stack = bs->top = NULL;
+    bs->nstack = 0;
+    free (bs->keys);
+    bs->keys = NULL;
+    bs->nkeys = 0;
+    free (bs->sizes);
+    bs->sizes = NULL;
+    bs->sizes_max = bs->nsizes = 0;
+    bs->sizes_mode = 0;
 }
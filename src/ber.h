@@ -2,17 +2,24 @@
 #define BER_H
 
 #include <setjmp.h>	/* jmp_buf */
-
-#include <lua.h>
+#include <stddef.h>	/* size_t */
 
 #include "mmodr.h"
+#include "ber_tlv.h"
 
 
-#define BERS_MAX	40	/* deep of bers stack */
+#define BERS_MIN	16	/* initial deep of bers stack */
+#define BERS_MAX	1024	/* default limit of deep of bers stack */
 #define CHOICES_MAX	8	/* maximum immediately choices */
-#define ENC_BUFRESERVE	BERS_MAX * 2		/* sizeof "\0\0" */
 #define ENC_LLEN_MAX	sizeof (int) + 1	/* encode length of length */
+/* sizeof "\0\0" of each ber in stack and of header */
+#define ENC_BUFRESERVE(bs) \
+	(((bs)->top - (bs)->stack + 1) * 2 + sizeof (tag_id_t) + ENC_LLEN_MAX)
 /*#define ENC_SIMPLESZ_MAX	1000*/		/* CER */
+#define ENC_SEGSZ	1000	/* CER: segments of strings from readers */
+#define ENC_SPARSE_MIN	4	/* OPTIONAL components to encode by keys */
+#define BER_KEYS_MAX	64	/* components of list encoded by keys */
+#define BER_KEYS_WORDS	(BER_KEYS_MAX / 32)	/* of bitmap of level */
 
 
 struct ber {
@@ -24,46 +31,190 @@ struct ber {
     } v;
 #define BER_INCOMPL	1
 #define BER_MORE	2
-#define BER_CONSTR	32
-#define BER_INDEFIN	128
+#define BER_PROJ	4	/* components list is projected */
+#define BER_SPARSE	8	/* encode: absent components are skipped by keys */
+#define BER_SINK	8	/* decode: octets of string go to bers.sink */
+/* BER_CONSTR, BER_INDEFIN of ber_tlv.h */
     unsigned char opt;		/* concurrent to tag.opt (TAG_...) */
     unsigned short int no;	/* tag->comp_no | occurence of TYPE_OF */
     struct tmt *tag, *next;
 };
 
+struct bers;
+
+/* Kinds of values of visitor */
+#define BER_VNONE	0	/* empty stack */
+#define BER_VNIL	1
+#define BER_VPRIM	2	/* primitive: string, number, boolean */
+#define BER_VCONS	3	/* constructed: components by number */
+#define BER_VMARK	4	/* mark of walk */
+#define BER_VRAW	5	/* pre-encoded TLV (read by tostr) */
+#define BER_VHOLE	6	/* hole of template (bers.hole) */
+#define BER_VREAD	7	/* reader of OCTET STRING (read by read) */
+
+/* Visitor of values: ber_decode () and ber_encode () keep values
+ * on the stack of visitor (luaber_visitor - Lua stack of bs->ud).
+ * Decode: begin pushes empty constructed value, primitive values
+ * are pushed by str (p NULL - empty string), num, boolean, nil;
+ * cat appends string on top to the string below it,
+ * set pops value into constructed one below it as component no.
+ * Encode: get pushes component no of constructed value on top,
+ * values on top are read by tostr, tonum, tobool */
+struct ber_visitor {
+    /* room for next level of values? (NULL - always) */
+    int (*room) (struct bers *bs);
+    void (*begin) (struct bers *bs, int narr, int nrec);
+    void (*mark) (struct bers *bs);
+    void (*str) (struct bers *bs, const unsigned char *p, int len);
+    void (*num) (struct bers *bs, unsigned int i);
+    void (*boolean) (struct bers *bs, int b);
+    void (*nil) (struct bers *bs);
+    void (*cat) (struct bers *bs);
+    void (*set) (struct bers *bs, int no);
+    void (*pop) (struct bers *bs);
+    int (*top) (struct bers *bs); /* kind of value on top (BER_V...) */
+    int (*get) (struct bers *bs, int no); /* returns kind of component */
+    const char *(*tostr) (struct bers *bs, size_t *len);
+    unsigned int (*tonum) (struct bers *bs);
+    int (*tobool) (struct bers *bs);
+    /* set bits of numbers (from COMP_START_NUM, up to n) of present
+     * components of constructed value on top (NULL - get each one) */
+    void (*keys) (struct bers *bs, unsigned int *bits, int n);
+    /* read up to max octets of reader on top to p (0 - its end) */
+    int (*read) (struct bers *bs, unsigned char *p, int max);
+};
+
 struct bers {
     struct mmodr *odr;
-    lua_State *L;
+    struct tmt *start; /* first searching tmt (NULL - odr->start);
+			  encode: the only component, value of comp_no */
+    int start_no; /* > 0: source is elements of SEQUENCE OF start
+		     from number start_no */
+    const struct ber_visitor *vis;
+    void *ud; /* state of visitor */
     jmp_buf *jb;
-    struct ber stack[BERS_MAX], *top;
+    struct ber *stack, *top; /* growing (malloc'ed) stack */
+    unsigned int nstack, maxdepth; /* allocated, limit (0 - BERS_MAX) */
+    /* Encode: bitmaps of present components by level of stack
+     * (BER_SPARSE), malloc'ed only for visitor with keys */
+    unsigned int *keys;
+    unsigned int nkeys; /* levels allocated */
     unsigned char *buf, *bp, *endp;
     struct module_id *ext_mid; /* EXTERNAL */
+    /* Lazy decode: push proxy of constructed value (tlv..endp)
+     * instead of its components, starting from lazy_depth of stack */
+    void (*lazy) (struct bers *bs, struct tmt *t,
+     unsigned char *tlv, unsigned char *endp);
+    unsigned char lazy_depth;
+    /* Slices: push reference to octets (p, len) of OCTET | BIT STRING
+     * instead of its copy, if len >= slice_min */
+    void (*slice) (struct bers *bs, unsigned char *p, int len);
+    int slice_min;
+    /* Projection: marks of tmts by address (NULL - decode all);
+     * components without mark in projected lists are skipped */
+    const unsigned char *proj;
+    /* Split: hand contents p..endp of SEQUENCE OF t of definite length
+     * of at least split_min octets to split () instead of decoding
+     * (its elements are decoded apart by start_no) */
+    void (*split) (struct bers *bs, struct tmt *t,
+     unsigned char *p, unsigned char *endp);
+    int split_min;
+    /* Walk: report values to walk () instead of building tables.
+     * Events: BER_WALK_START (p..len - contents, len -1 - indefinite),
+     * BER_WALK_VALUE (p..len - contents, decoded value on top of vis),
+     * BER_WALK_END; untagged CHOICE's have no events of their own.
+     * Nonzero result stops decoding with BER_ERRSTOP */
+    int (*walk) (struct bers *bs, int ev, const struct tmt *t, int no,
+     const unsigned char *p, int len);
+    const unsigned char *walkp; /* contents of simple value */
+    int walklen;
+    /* Grow: encode to buffer buf..endp, which grow () reallocates
+     * to size (NULL - no memory), instead of returning chunks;
+     * lengths of constructed values are definite then */
+    unsigned char *(*grow) (struct bers *bs, size_t size);
+    /* Gather: strings of at least gather_min octets p..len are left
+     * in place and handed to gather () after the octets up to bp,
+     * instead of copy to buffer */
+    void (*gather) (struct bers *bs, const unsigned char *p, int len);
+    int gather_min;
+    /* Hole: value of kind BER_VHOLE as component t inside of level
+     * TLVs is handed to hole () instead of encoding (no octets) */
+    void (*hole) (struct bers *bs, const struct tmt *t, int level);
+    /* Readers: value of kind BER_VREAD is encoded as constructed
+     * OCTET STRING of indefinite length with segments of seg_size
+     * octets (0 - ENC_SEGSZ), read in place of buffer */
+    int seg_size;
+    /* Sink: octets of OCTET STRING t of at least sink_min octets
+     * (0 - none; constructed one of indefinite length too) or marked
+     * in sink_marks (by tmt address, NULL - none) are handed to sink ()
+     * as they are decoded instead of pushing them; its value is the
+     * count of octets then */
+    void (*sink) (struct bers *bs, const struct tmt *t,
+     const unsigned char *p, int len);
+    int sink_min;
+    const unsigned char *sink_marks;
+    /* Sizes of constructed values in order of their tags, counted by
+     * ber_encode_size (), for ber_encode () to put definite lengths */
+    unsigned char sizes_mode; /* BER_SIZES_... */
+    int *sizes; /* growing (malloc'ed) */
+    unsigned int nsizes, sizes_max, sizes_no; /* counted, allocated, next */
+    size_t sizes_len; /* octets of PDU */
 };
 
+/* Modes of sizes */
+#define BER_SIZES_COUNT	1	/* count octets instead of writing them */
+#define BER_SIZES_PUT	2	/* put definite lengths of sizes */
+
+
+/* Events of walk */
+#define BER_WALK_START	1
+#define BER_WALK_VALUE	2
+#define BER_WALK_END	3
+
+/* Marks of projection */
+#define PROJ_PATH	1	/* decode marked components of its list */
+#define PROJ_ALL	2	/* decode whole value */
+
+
 
-/* Error codes */
-#define BER_ERRMEM	-1
-#define BER_ERRTAG	-10
-#define BER_ERRTAGLEN	-11
-#define BER_ERRTAGNUM	-12
-#define BER_ERRTAGODR	-13
-#define BER_ERROID	-20
-#define BER_ERROIDMID	-21
-#define BER_ERREXT	-30
-#define BER_ERREXTOID	-31
-#define BER_ERRSTKO	-40
-#define BER_ERRSTKU	-41
-#define BER_ERRCHCSO	-50
-#define BER_ERRLUASTK	-60
-#define BER_ERRLUAOUT	-61
-#define BER_ERRSIZE	-70
-#define BER_ERRODR	-80
-
-const char *
-ber_errstr (const int no);
 unsigned char
 ber_decode (struct bers *bs);
 unsigned char
 ber_encode (struct bers *bs);
+size_t
+ber_encode_size (struct bers *bs);
+void
+ber_free (struct bers *bs);
+int
+ber_proj_size (const struct mmodr *mo);
+int
+ber_proj_path (const struct mmodr *mo, unsigned char *proj, const char *path);
+struct tmt *
+ber_path_find (const struct mmodr *mo, const char *path);
+
+
+int
+ber_c_next (struct bers *bs, const unsigned char *endp);
+void
+ber_c_tlv (struct bers *bs, const unsigned char *endp, struct ber_tlv *v);
+void
+ber_c_table (struct bers *bs, const int depth, const int narr, const int nrec);
+int
+ber_c_count (const struct bers *bs, const struct ber_tlv *v);
+void
+ber_c_str (struct bers *bs, const struct ber_tlv *v, const int fun,
+ const int depth);
+void
+ber_c_prim (struct bers *bs, const struct ber_tlv *v, const int fun);
+const struct module_id *
+ber_c_ext (struct bers *bs, const int depth);
+void
+ber_c_ext_skip (struct bers *bs, const unsigned char *endp, const int depth);
+void
+ber_c_put (struct bers *bs, const int addr, const int k);
+int
+ber_c_open (struct bers *bs, const int addr, const int k, const int depth);
+void
+ber_c_close (struct bers *bs, const int off);
 
 #endif
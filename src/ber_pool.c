@@ -0,0 +1,278 @@
+/* Pool of threads decoding PDUs into trees (struct ber_job) in parallel.
+ * Workers do not touch Lua: results are taken by the running thread
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	/* sysconf */
+
+#include "ber_pool.h"
+
+
+#define POOL_CHUNKS	4	/* chunks of split SEQUENCE OF per thread */
+
+/* Chunk of elements of split SEQUENCE OF */
+struct pool_chunk {
+    struct ber_job job;
+    struct ber_job *owner;
+    struct ber_split *split;
+};
+
+
+/* Decode jobs of batch until none left (mutex is locked) */
+static void
+pool_jobs (struct ber_pool *pl)
+{
+    while (pl->next < pl->njobs) {
+	struct ber_job *j = pl->order[pl->next++];
+
+	pthread_mutex_unlock (&pl->mutex);
+	ber_tree_decode (pl->cfg, j);
+	pthread_mutex_lock (&pl->mutex);
+    }
+}
+
+static void *
+pool_worker (void *arg)
+{
+    struct ber_pool *pl = arg;
+    unsigned int batch = 0;
+
+    pthread_mutex_lock (&pl->mutex);
+    for (; ; ) {
+	while (!pl->quit && pl->batch == batch)
+	    pthread_cond_wait (&pl->start, &pl->mutex);
+	if (pl->quit) break;
+	batch = pl->batch;
+	++pl->busy;
+	pool_jobs (pl);
+	if (!--pl->busy)
+	    pthread_cond_signal (&pl->done);
+    }
+    pthread_mutex_unlock (&pl->mutex);
+    return NULL;
+}
+
+/* Start pool of nthreads, the running one included.
+ * Return 0 | -1 - no pool
+ */
+int
+ber_pool_init (struct ber_pool *pl, const int nthreads)
+{
+    pl->nthreads = pl->busy = pl->quit = 0;
+    pl->ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (pl->ncpus < 1) pl->ncpus = 1; /* unknown */
+    pl->batch = 0;
+    pl->cfg = NULL;
+    pl->order = NULL;
+    pl->njobs = pl->next = 0;
+    pl->threads = NULL;
+    if (nthreads > 1
+     && !(pl->threads = malloc ((nthreads - 1) * sizeof (pthread_t))))
+	return -1;
+    if (pthread_mutex_init (&pl->mutex, NULL)) goto err_mutex;
+    if (pthread_cond_init (&pl->start, NULL)) goto err_start;
+    if (pthread_cond_init (&pl->done, NULL)) goto err_done;
+    /* fewer workers, if system refuses */
+    while (pl->nthreads < nthreads - 1
+     && !pthread_create (&pl->threads[pl->nthreads], NULL, pool_worker, pl))
+	++pl->nthreads;
+    return 0;
+ err_done:
+    pthread_cond_destroy (&pl->start);
+ err_start:
+    pthread_mutex_destroy (&pl->mutex);
+ err_mutex:
+    free (pl->threads);
+    return -1;
+}
+
+/* Count of threads running at once */
+static int
+pool_parallel (const struct ber_pool *pl)
+{
+    return (pl->nthreads < pl->ncpus) ? pl->nthreads + 1 : pl->ncpus;
+}
+
+/* Of the largest first */
+static int
+pool_cmp (const void *a, const void *b)
+{
+    return (*(struct ber_job * const *) b)->len
+     - (*(struct ber_job * const *) a)->len;
+}
+
+/* Decode jobs in order of the largest first, the running thread too */
+static void
+pool_batch (struct ber_pool *pl, const struct bers *cfg,
+ struct ber_job **order, const int njobs)
+{
+    int i;
+
+    if (!pl->nthreads || njobs < 2) {
+	for (i = 0; i < njobs; ++i)
+	    ber_tree_decode (cfg, order[i]);
+	return;
+    }
+    qsort (order, njobs, sizeof (struct ber_job *), pool_cmp);
+
+    pthread_mutex_lock (&pl->mutex);
+    pl->cfg = cfg;
+    pl->order = order;
+    pl->njobs = njobs;
+    pl->next = 0;
+    ++pl->batch;
+    pthread_cond_broadcast (&pl->start);
+    pool_jobs (pl);
+    while (pl->busy)
+	pthread_cond_wait (&pl->done, &pl->mutex);
+    /* late workers find nothing */
+    pl->order = NULL;
+    pl->njobs = pl->next = 0;
+    pthread_mutex_unlock (&pl->mutex);
+}
+
+/* Cut elements of split into chunks of more than part octets.
+ * Return count of chunks | error code
+ */
+static int
+pool_cut (struct ber_split *sp, const int part, struct ber_job *owner,
+ struct pool_chunk *ch)
+{
+    const unsigned char *p = sp->p, *q = sp->p;
+    int no = COMP_START_NUM, k = 0, n = 0;
+
+    while (q < sp->endp) {
+	const int res = ber_tlvs (&q, sp->endp, 0);
+
+	if (res) return (res < 0) ? res : BER_ERRTAGLEN;
+	++k;
+	if (q - p > part || q == sp->endp) {
+	    ch[n].job.p = p;
+	    ch[n].job.len = q - p;
+	    ch[n].job.of = sp->of;
+	    ch[n].job.no = no;
+	    ch[n].owner = owner;
+	    ch[n].split = sp;
+	    ++n;
+	    no += k;
+	    k = 0;
+	    p = q;
+	}
+    }
+    return n;
+}
+
+/* Decode elements of split SEQUENCE OF's of jobs in chunks by all
+ * threads, then append them in order. Failed chunk fails its job
+ */
+static void
+pool_split (struct ber_pool *pl, const struct bers *cfg,
+ struct ber_job *jobs, const int njobs)
+{
+    const int nparts = POOL_CHUNKS * pool_parallel (pl);
+    struct pool_chunk *chunks = NULL;
+    struct ber_job **order = NULL;
+    struct ber_split *sp;
+    struct ber_mem *m;
+    struct bers ecfg;
+    int i, n = 0;
+
+    for (i = 0; i < njobs; ++i)
+	for (sp = jobs[i].splits; sp; sp = sp->next)
+	    n += nparts;
+    if (!n) return;
+    if (!(chunks = malloc (n * sizeof (struct pool_chunk)))
+     || !(order = malloc (n * sizeof (struct ber_job *)))) {
+	for (i = 0; i < njobs; ++i)
+	    if (jobs[i].splits) jobs[i].res = BER_ERRMEM;
+	goto end;
+    }
+    n = 0;
+    for (i = 0; i < njobs; ++i)
+	for (sp = jobs[i].splits; sp && jobs[i].res > 0; sp = sp->next) {
+	    const int res = pool_cut (sp, (sp->endp - sp->p) / nparts,
+	     &jobs[i], chunks + n);
+	    if (res < 0) jobs[i].res = res;
+	    else n += res;
+	}
+    for (i = 0; i < n; ++i)
+	order[i] = &chunks[i].job;
+
+    memset (&ecfg, 0, sizeof (struct bers));
+    ecfg.odr = cfg->odr;
+    ecfg.maxdepth = cfg->maxdepth;
+    pool_batch (pl, &ecfg, order, n);
+
+    for (i = 0; i < n; ++i) {
+	struct ber_job *c = &chunks[i].job, *j = chunks[i].owner;
+
+	if (j->res > 0 && c->res < 0) j->res = c->res;
+	if (j->res <= 0) {
+	    ber_tree_free (c->mem);
+	    continue;
+	}
+	ber_tree_splice (chunks[i].split->node, c->root);
+	for (m = c->mem; m->next; m = m->next)
+	    continue;
+	m->next = j->mem->next;
+	j->mem->next = c->mem;
+    }
+ end:
+    for (i = 0; i < njobs; ++i)
+	if (jobs[i].res <= 0 && jobs[i].mem) {
+	    ber_tree_free (jobs[i].mem);
+	    jobs[i].mem = NULL;
+	    jobs[i].root = NULL;
+	}
+    free (order);
+    free (chunks);
+}
+
+/* Decode jobs by odr of cfg, the running thread too.
+ * SEQUENCE OF's of at least cfg.split_min octets are decoded
+ * by all threads in chunks of elements, if two of them run at once:
+ * else cutting and appending of chunks is all the split gives
+ */
+void
+ber_pool_run (struct ber_pool *pl, const struct bers *cfg,
+ struct ber_job *jobs, const int njobs)
+{
+    struct ber_job **order = malloc (njobs * sizeof (struct ber_job *));
+    struct bers scfg = *cfg;
+    int i;
+
+    if (pool_parallel (pl) < 2) scfg.split_min = 0; /* nothing to share */
+    for (i = 0; i < njobs; ++i) {
+	jobs[i].of = NULL;
+	if (order) order[i] = &jobs[i];
+    }
+    if (!order) /* by the running thread alone */
+	for (i = 0; i < njobs; ++i)
+	    ber_tree_decode (&scfg, &jobs[i]);
+    else pool_batch (pl, &scfg, order, njobs);
+    free (order);
+    if (scfg.split_min > 0)
+	pool_split (pl, &scfg, jobs, njobs);
+}
+
+/* Stop threads of pool (freed one is left as is) */
+void
+ber_pool_free (struct ber_pool *pl)
+{
+    int i;
+
+    if (pl->quit) return;
+    pthread_mutex_lock (&pl->mutex);
+    pl->quit = 1;
+    pthread_cond_broadcast (&pl->start);
+    pthread_mutex_unlock (&pl->mutex);
+    for (i = 0; i < pl->nthreads; ++i)
+	pthread_join (pl->threads[i], NULL);
+    pthread_cond_destroy (&pl->done);
+    pthread_cond_destroy (&pl->start);
+    pthread_mutex_destroy (&pl->mutex);
+    free (pl->threads);
+    pl->threads = NULL;
+    pl->nthreads = 0;
+}
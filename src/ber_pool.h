@@ -0,0 +1,42 @@
+#ifndef BER_POOL_H
+#define BER_POOL_H
+
+#include <pthread.h>
+
+#include "ber_tree.h"
+
+
+/* Threads decoding batches of jobs into trees.
+ * Free threads take the next job of the largest first,
+ * so uneven PDUs are balanced; the odr is shared read only.
+ * Large SEQUENCE OF's (bers.split_min) are decoded by all threads
+ * in chunks of elements, which are appended in order then,
+ * when at least two of them run on processors of their own
+ */
+struct ber_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t start, done;
+    pthread_t *threads;
+    int nthreads;	/* workers besides the running thread */
+    int ncpus;		/* online processors */
+    int busy;		/* workers in batch */
+    unsigned int batch;	/* number of last batch */
+    int quit;
+    /* of batch */
+    const struct bers *cfg;
+    struct ber_job **order;
+    int njobs, next;
+};
+
+
+int
+ber_pool_init (struct ber_pool *pl, const int nthreads);
+
+void
+ber_pool_run (struct ber_pool *pl, const struct bers *cfg,
+ struct ber_job *jobs, const int njobs);
+
+void
+ber_pool_free (struct ber_pool *pl);
+
+#endif
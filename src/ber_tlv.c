@@ -0,0 +1,230 @@
+/* BER TLV's without Lua */
+
+#include <stddef.h>	/* NULL */
+
+#include "ber_tlv.h"
+
+
+/* Parse TLV header at *pp up to endp: constructed flag and length
+ * (BER_LEN_INDEFIN - indefinite).
+ * Return 0, count of octets needed at least or error code
+ */
+int
+ber_header (const unsigned char **pp, const unsigned char * const endp,
+ unsigned char *cons, unsigned int *len)
+{
+    const unsigned char *p = *pp;
+    unsigned char c;
+
+    if (p >= endp) return 2;
+    *cons = *p & BER_CONSTR;
+    if ((*p++ & 0x1F) == 0x1F)
+	for (c = 0; ; ++c) {
+	    if (p >= endp) return 2;
+	    if (c >= CLASS_NUMSIZ)
+		return BER_ERRTAGNUM; /* Too long tag.number */
+	    if (!(*p++ & 0x80)) break;
+	}
+    if (p >= endp) return 1;
+    c = *p++;
+    *len = 0;
+    if (c & BER_INDEFIN) {
+	c &= ~BER_INDEFIN;
+	if (!c) {
+	    if (!*cons)
+		return BER_ERRTAGLEN; /* Primitive indefinite */
+	    *len = BER_LEN_INDEFIN;
+	} else {
+	    if (c > sizeof (int))
+		return BER_ERRTAGLEN; /* Too long length of length */
+	    if (endp - p < c) return c - (endp - p);
+	    while (c--) {
+		*len <<= 8;
+		*len |= *p++;
+	    }
+	    if ((int) *len < 0)
+		return BER_ERRTAGLEN; /* Too long length */
+	}
+    } else *len = c;
+    *pp = p;
+    return 0;
+}
+
+/* Walk TLV headers from *pp up to End Of Contents of open indefinite
+ * values (level) or after one TLV (level 0); contents of definite
+ * length are skipped whole.
+ * Return 0 (*pp - after walked), count of octets needed at least
+ * or error code
+ */
+int
+ber_tlvs (const unsigned char **pp, const unsigned char * const endp,
+ int level)
+{
+    const unsigned char *p = *pp;
+
+    do {
+	unsigned char cons;
+	unsigned int len;
+	int res;
+
+	if (level && endp - p >= 2 && !(*p | *(p + 1))) {
+	    p += 2;
+	    --level;
+	    continue;
+	}
+	if ((res = ber_header (&p, endp, &cons, &len)))
+	    return res;
+	if (len == BER_LEN_INDEFIN) ++level;
+	else if ((unsigned int) (endp - p) < len)
+	    return len - (endp - p);
+	else p += len;
+    } while (level);
+    *pp = p;
+    return 0;
+}
+
+/* Count TLV's of definite contents p..endp up to indefinite one */
+int
+ber_count (const unsigned char *p, const unsigned char * const endp)
+{
+    int n = 0;
+
+    while (p < endp) {
+	unsigned int len = 0;
+	unsigned char c;
+
+	if ((*p++ & 0x1F) == 0x1F)
+	    while (p < endp && (*p++ & 0x80))
+		;
+	if (p >= endp) break;
+	c = *p++;
+	if (c & BER_INDEFIN) {
+	    c &= ~BER_INDEFIN;
+	    if (!c || c > sizeof (int) || endp - p < c) break;
+	    while (c--) {
+		len <<= 8;
+		len |= *p++;
+	    }
+	} else len = c;
+	if ((unsigned int) (endp - p) < len) break;
+	p += len;
+	++n;
+    }
+    return n;
+}
+
+/* Count TLV's of p..endp at all levels: contents of constructed ones
+ * are walked, of primitive ones skipped (up to a bad or cut TLV) */
+int
+ber_count_all (const unsigned char *p, const unsigned char * const endp)
+{
+    int n = 0;
+
+    while (p < endp) {
+	unsigned char cons;
+	unsigned int len;
+
+	if (endp - p >= 2 && !(*p | *(p + 1))) { /* End Of Contents */
+	    p += 2;
+	    continue;
+	}
+	if (ber_header (&p, endp, &cons, &len)) break;
+	if (!cons) {
+	    if ((unsigned int) (endp - p) < len) break;
+	    p += len;
+	}
+	++n;
+    }
+    return n;
+}
+
+/* Frame PDU at p..endp by its TLV headers, without decoding.
+ * Return length of complete PDU, 0 - incomplete (*need - count of octets
+ * needed at least) or error code (BER_ERRSIZE - longer than limit)
+ */
+int
+ber_frame (const unsigned char *p, const unsigned char *endp,
+ const unsigned int limit, int *need)
+{
+    const unsigned char *q = p;
+    unsigned int size;
+    int res;
+
+    if (endp - p >= 2 && !(*p | *(p + 1)))
+	return BER_ERRTAG; /* End Of Contents out of value */
+    res = ber_tlvs (&q, endp, 0);
+    if (res < 0) return res;
+    /* incomplete PDU takes all octets up to endp */
+    size = res ? (unsigned int) (endp - p) + res : (unsigned int) (q - p);
+    if (limit && size > limit)
+	return BER_ERRSIZE;
+    if (res) {
+	*need = res;
+	return 0;
+    }
+    return size;
+}
+
+/* Parse TLV header at *pp up to endp: tag, constructed flag and length
+ * of contents, which must be up to endp.
+ * Return 0 or error code
+ */
+int
+ber_tlv_get (const unsigned char **pp, const unsigned char * const endp,
+ struct ber_tlv *v)
+{
+    const unsigned char *p = *pp;
+    union tag_id u;
+    unsigned int len;
+    int res;
+
+    u.cn = 0;
+    u.id.classnum = *p & ~BER_CONSTR;
+    if ((*p & 0x1F) == 0x1F) {
+	unsigned int c;
+	for (c = 0; c < CLASS_NUMSIZ && p + c + 1 < endp; ++c)
+	    if (!((u.id.number[c] = p[c + 1]) & 0x80)) break;
+    }
+    res = ber_header (&p, endp, &v->cons, &len);
+    if (res) return (res < 0) ? res : BER_ERRTAGLEN;
+    v->cn = u.cn;
+    if (len == BER_LEN_INDEFIN) {
+	v->len = -1;
+	v->end = NULL;
+    } else {
+	if ((unsigned int) (endp - p) < len)
+	    return BER_ERRTAGLEN; /* Bad length */
+	v->len = len;
+	v->end = p + len;
+    }
+    *pp = p;
+    return 0;
+}
+
+const char *
+ber_errstr (const int no)
+{
+    switch (no) {
+    case BER_ERRMEM:	return "memory";
+    case BER_ERRTAG:	return "bad tag";
+    case BER_ERRTAGNUM:	return "bad tag.number";
+    case BER_ERRTAGLEN:	return "bad tag.length";
+    case BER_ERRTAGODR:	return "bad tag.odr";
+    case BER_ERROIDMID:	return "unknown ModuleID";
+    case BER_ERROID:	return "bad OID";
+    case BER_ERREXT:	return "bad External";
+    case BER_ERREXTOID:	return "bad Ext.OID";
+    case BER_ERRSTKO:	return "bers stack overflow";
+    case BER_ERRSTKU:	return "bers stack underflow";
+    case BER_ERRCHCSO:	return "choices stack overflow";
+    case BER_ERRLUASTK:	return "bad Lua stack";
+    case BER_ERRLUAOUT:	return "bad encode PDU";
+    case BER_ERRREAD:	return "bad string reader";
+    case BER_ERRSINK:	return "sink failed";
+    case BER_ERRSIZE:	return "transfer limit";
+    case BER_ERRODR:	return "bad odr file";
+    case BER_ERRPATH:	return "bad projection path";
+    case BER_ERRSTOP:	return "walk stopped";
+    default:		return "unknown error";
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef BER_TLV_H
+#define BER_TLV_H
+
+#include "asn/odr.h"
+
+
+#define BER_CONSTR	32
+#define BER_INDEFIN	128
+#define BER_LEN_INDEFIN	((unsigned int) -1)
+
+/* Error codes */
+#define BER_ERRMEM	-1
+#define BER_ERRTAG	-10
+#define BER_ERRTAGLEN	-11
+#define BER_ERRTAGNUM	-12
+#define BER_ERRTAGODR	-13
+#define BER_ERROID	-20
+#define BER_ERROIDMID	-21
+#define BER_ERREXT	-30
+#define BER_ERREXTOID	-31
+#define BER_ERRSTKO	-40
+#define BER_ERRSTKU	-41
+#define BER_ERRCHCSO	-50
+#define BER_ERRLUASTK	-60
+#define BER_ERRLUAOUT	-61
+#define BER_ERRREAD	-62
+#define BER_ERRSINK	-63
+#define BER_ERRSIZE	-70
+#define BER_ERRODR	-80
+#define BER_ERRPATH	-90
+#define BER_ERRSTOP	-100
+
+/* TLV header */
+struct ber_tlv {
+    tag_id_t cn;		/* tag */
+    int len;			/* length of contents (-1 - indefinite) */
+    const unsigned char *end;	/* end of contents (NULL - indefinite) */
+    unsigned char cons;		/* constructed? */
+};
+
+
+const char *
+ber_errstr (const int no);
+
+int
+ber_header (const unsigned char **pp, const unsigned char * const endp,
+ unsigned char *cons, unsigned int *len);
+int
+ber_tlvs (const unsigned char **pp, const unsigned char * const endp,
+ int level);
+int
+ber_count (const unsigned char *p, const unsigned char * const endp);
+int
+ber_count_all (const unsigned char *p, const unsigned char * const endp);
+int
+ber_frame (const unsigned char *p, const unsigned char *endp,
+ const unsigned int limit, int *need);
+int
+ber_tlv_get (const unsigned char **pp, const unsigned char * const endp,
+ struct ber_tlv *v);
+
+#endif
@@ -0,0 +1,229 @@
+/* Templates of PDUs: encoded once with holes (bers.hole), rendered
+ * by static octets, TLVs of holes and lengths of constructed values
+ * recounted for them
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ber_tpl.h"
+
+
+/* Room for next item of growing (malloc'ed) array */
+static int
+tpl_room (void **items, int *max, const int n, const size_t size)
+{
+    void *p;
+    int m;
+
+    if (n < *max) return 0;
+    m = (*max) ? *max * 2 : BERS_MIN;
+    if (!(p = realloc (*items, m * size))) return BER_ERRMEM;
+    *items = p;
+    *max = m;
+    return 0;
+}
+
+/* Count of octets of definite length */
+static int
+tpl_lenlen (const int len)
+{
+    int n = 1, i;
+
+    if (len < 0x80) return 1;
+    for (i = len; i; i >>= 8) ++n;
+    return n;
+}
+
+/* Count of octets of tag at p */
+static int
+tpl_taglen (const unsigned char *p)
+{
+    int n = 1;
+
+    if ((*p & 0x1F) == 0x1F)
+	while (p[n++] & 0x80)
+	    continue;
+    return n;
+}
+
+static int
+tpl_op (struct ber_tpl *tp, const int kind, const int arg)
+{
+    struct ber_tpl_op *op;
+
+    /* static octets are merged */
+    if (kind == BER_TPL_OCTETS && tp->nops
+     && tp->ops[tp->nops - 1].kind == BER_TPL_OCTETS) {
+	tp->ops[tp->nops - 1].arg += arg;
+	return 0;
+    }
+    if (tpl_room ((void **) &tp->ops, &tp->ops_max, tp->nops,
+     sizeof (struct ber_tpl_op)))
+	return BER_ERRMEM;
+    op = tp->ops + tp->nops++;
+    op->kind = kind;
+    op->arg = arg;
+    return 0;
+}
+
+static int
+tpl_cons (struct ber_tpl *tp, const int parent, const int end)
+{
+    struct ber_tpl_cons *c;
+
+    if (tpl_room ((void **) &tp->cons, &tp->cons_max, tp->ncons,
+     sizeof (struct ber_tpl_cons)))
+	return BER_ERRMEM;
+    c = tp->cons + tp->ncons++;
+    c->parent = parent;
+    c->len = 0;
+    c->end = end;
+    return 0;
+}
+
+/* Add hole of component t at offset off of encoded PDU, inside of
+ * level TLVs (NULL - no memory)
+ */
+struct ber_tpl_hole *
+ber_tpl_add (struct ber_tpl *tp, const struct tmt *t, const int off,
+ const int level)
+{
+    struct ber_tpl_hole *h;
+
+    if (tpl_room ((void **) &tp->holes, &tp->holes_max, tp->nholes,
+     sizeof (struct ber_tpl_hole)))
+	return NULL;
+    h = tp->holes + tp->nholes++;
+    memset (h, 0, sizeof (struct ber_tpl_hole));
+    h->t = t;
+    h->off = off;
+    h->level = level;
+    return h;
+}
+
+/* Compile PDU buf..len of definite lengths with added holes */
+int
+ber_tpl_compile (struct ber_tpl *tp, const unsigned char *buf, const int len)
+{
+    const unsigned char *p = buf;
+    unsigned char *op;
+    int cur = 0, level = 0, h = 0, res;
+
+    tp->nops = tp->ncons = 0;
+    free (tp->octets);
+    free (tp->lens);
+    tp->lens = NULL;
+    if (!(op = tp->octets = malloc (len ? len : 1))
+     || (res = tpl_cons (tp, -1, len)))
+	return BER_ERRMEM;
+    for (; ; ) {
+	struct ber_tlv v;
+	const unsigned char *q = p;
+	int n;
+
+	/* holes at p on this level */
+	for (; h < tp->nholes && tp->holes[h].off == p - buf
+	 && tp->holes[h].level == level; ++h) {
+	    tp->holes[h].cons = cur;
+	    if ((res = tpl_op (tp, BER_TPL_HOLE, h))) return res;
+	}
+	if (p - buf == tp->cons[cur].end) {
+	    if (!cur) break;
+	    cur = tp->cons[cur].parent;
+	    --level;
+	    continue;
+	}
+	if ((res = ber_tlv_get (&q, buf + tp->cons[cur].end, &v)))
+	    return res;
+	if (!v.end) return BER_ERRTAGLEN; /* Indefinite length */
+	n = (v.cons) ? tpl_taglen (p) : v.end - p;
+	memcpy (op, p, n);
+	op += n;
+	tp->cons[cur].len += n;
+	if ((res = tpl_op (tp, BER_TPL_OCTETS, n))) return res;
+	if (!v.cons) {
+	    p = v.end;
+	    continue;
+	}
+	if ((res = tpl_cons (tp, cur, v.end - buf))
+	 || (res = tpl_op (tp, BER_TPL_LEN, tp->ncons - 1)))
+	    return res;
+	cur = tp->ncons - 1;
+	++level;
+	p = q;
+    }
+    if (h < tp->nholes)
+	return BER_ERRTAGLEN; /* Hole out of PDU */
+    if (!(tp->lens = malloc (tp->ncons * sizeof (int))))
+	return BER_ERRMEM;
+    return 0;
+}
+
+/* Count lengths of constructed values by lengths of holes,
+ * return count of octets of PDU
+ */
+size_t
+ber_tpl_size (struct ber_tpl *tp)
+{
+    int i;
+
+    for (i = 0; i < tp->ncons; ++i)
+	tp->lens[i] = tp->cons[i].len;
+    for (i = 0; i < tp->nholes; ++i)
+	tp->lens[tp->holes[i].cons] += tp->holes[i].len;
+    /* inner values follow their parents */
+    for (i = tp->ncons - 1; i > 0; --i)
+	tp->lens[tp->cons[i].parent] += tpl_lenlen (tp->lens[i])
+	 + tp->lens[i];
+    return tp->lens[0];
+}
+
+/* Put PDU counted by ber_tpl_size () at p, return pointer after it */
+unsigned char *
+ber_tpl_put (const struct ber_tpl *tp, unsigned char *p)
+{
+    const unsigned char *s = tp->octets;
+    int i;
+
+    for (i = 0; i < tp->nops; ++i) {
+	const int arg = tp->ops[i].arg;
+
+	switch (tp->ops[i].kind) {
+	case BER_TPL_OCTETS:
+	    memcpy (p, s, arg);
+	    p += arg;
+	    s += arg;
+	    break;
+	case BER_TPL_LEN: {
+	    const int len = tp->lens[arg];
+	    int n = tpl_lenlen (len) - 1;
+
+	    if (!n) *p++ = len;
+	    else {
+		*p++ = BER_INDEFIN | n;
+		while (n--) *p++ = (unsigned char) (len >> (n * 8));
+	    }
+	    break;
+	}
+	case BER_TPL_HOLE:
+	    if (tp->holes[arg].len) {
+		memcpy (p, tp->holes[arg].p, tp->holes[arg].len);
+		p += tp->holes[arg].len;
+	    }
+	    break;
+	}
+    }
+    return p;
+}
+
+void
+ber_tpl_free (struct ber_tpl *tp)
+{
+    free (tp->octets);
+    free (tp->ops);
+    free (tp->cons);
+    free (tp->holes);
+    free (tp->lens);
+    memset (tp, 0, sizeof (struct ber_tpl));
+}
@@ -0,0 +1,59 @@
+#ifndef BER_TPL_H
+#define BER_TPL_H
+
+#include "ber.h"
+
+
+/* Operations of rendering */
+#define BER_TPL_OCTETS	0	/* arg static octets */
+#define BER_TPL_LEN	1	/* length of constructed value arg */
+#define BER_TPL_HOLE	2	/* TLV of hole arg */
+
+struct ber_tpl_op {
+    int kind, arg;
+};
+
+/* Constructed value: 0 is the PDU itself (no length of its own) */
+struct ber_tpl_cons {
+    int parent;
+    int len;	/* static octets of contents */
+    int end;	/* compiling: end of contents in PDU */
+};
+
+/* Hole: TLV of component t is encoded for each rendering */
+struct ber_tpl_hole {
+    const struct tmt *t;
+    int off, level;	/* in encoded PDU, count of enclosing TLVs */
+    int cons;		/* enclosing constructed value */
+    const unsigned char *p;	/* rendering: TLV (len 0 - absent) */
+    int len;
+    const void *ud;	/* of caller */
+};
+
+/* Template of PDU: static octets (without lengths of constructed
+ * values, which depend on holes) and operations to render it */
+struct ber_tpl {
+    unsigned char *octets;
+    struct ber_tpl_op *ops;
+    int nops, ops_max;
+    struct ber_tpl_cons *cons;
+    int ncons, cons_max;
+    struct ber_tpl_hole *holes;
+    int nholes, holes_max;
+    int *lens;	/* rendering: of contents of constructed values */
+};
+
+
+struct ber_tpl_hole *
+ber_tpl_add (struct ber_tpl *tp, const struct tmt *t, const int off,
+ const int level);
+int
+ber_tpl_compile (struct ber_tpl *tp, const unsigned char *buf, const int len);
+size_t
+ber_tpl_size (struct ber_tpl *tp);
+unsigned char *
+ber_tpl_put (const struct ber_tpl *tp, unsigned char *p);
+void
+ber_tpl_free (struct ber_tpl *tp);
+
+#endif
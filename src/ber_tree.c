@@ -0,0 +1,308 @@
+/* Visitor of decoded tree: nodes in arena instead of Lua tables.
+ * The tree is built without Lua and freed by reset of arena;
+ * it is no source of values to encode
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "ber_tree.h"
+
+
+#define TREE_ALIGN	sizeof (void *)	/* of nodes in arena */
+
+#define TREE(bs)	((struct ber_tree *) (bs)->ud)
+
+
+/* Go on in new arena of at least size octets: nodes stay in place */
+static void
+tree_grow (struct bers *bs, const size_t size)
+{
+    struct ber_tree *tr = TREE(bs);
+    size_t n = tr->arena->size * 2;
+    struct ber_mem *m;
+
+    if (!tr->mem)
+	longjmp (*bs->jb, BER_ERRMEM); /* Arena is full */
+    if (n < size) n = size;
+    if (!(m = malloc (sizeof (struct ber_mem) + n)))
+	longjmp (*bs->jb, BER_ERRMEM);
+    m->next = *tr->mem;
+    *tr->mem = m;
+    ber_arena_init (tr->arena, (unsigned char *) (m + 1), n);
+}
+
+/* Allocate octets of arena (aligned for node) */
+static void *
+tree_alloc (struct bers *bs, const size_t size, const int align)
+{
+    struct ber_arena *a = TREE(bs)->arena;
+    void *p;
+
+    if (align) {
+	a->used = (a->used + TREE_ALIGN - 1) & ~(TREE_ALIGN - 1);
+	if (a->used > a->size) a->used = a->size;
+    }
+    if (a->size - a->used < size)
+	tree_grow (bs, size);
+    p = a->base + a->used;
+    a->used += size;
+    return p;
+}
+
+/* Push new node */
+static struct ber_node *
+tree_push (struct bers *bs, const unsigned char type)
+{
+    struct ber_tree *tr = TREE(bs);
+    struct ber_node *n = tree_alloc (bs, sizeof (struct ber_node), 1);
+
+    memset (n, 0, sizeof (struct ber_node));
+    n->type = type;
+    n->next = tr->top;
+    tr->top = n;
+    return n;
+}
+
+static void
+tree_begin (struct bers *bs, int narr, int nrec)
+{
+    (void) narr, (void) nrec;
+    tree_push (bs, BER_NCONS);
+}
+
+static void
+tree_mark (struct bers *bs)
+{
+    tree_push (bs, BER_NMARK);
+}
+
+static void
+tree_str (struct bers *bs, const unsigned char *p, int len)
+{
+    struct ber_node *n = tree_push (bs, BER_NSTR);
+
+    n->u.s.p = p;
+    n->u.s.len = len;
+}
+
+static void
+tree_num (struct bers *bs, unsigned int i)
+{
+    tree_push (bs, BER_NNUM)->u.i = i;
+}
+
+static void
+tree_boolean (struct bers *bs, int b)
+{
+    tree_push (bs, BER_NBOOL)->u.i = b;
+}
+
+static void
+tree_nil (struct bers *bs)
+{
+    tree_push (bs, BER_NNIL);
+}
+
+static void
+tree_pop (struct bers *bs)
+{
+    struct ber_tree *tr = TREE(bs);
+
+    tr->top = tr->top->next;
+}
+
+/* Append string on top to the string below it */
+static void
+tree_cat (struct bers *bs)
+{
+    struct ber_node *b = TREE(bs)->top, *a = b->next;
+
+    tree_pop (bs);
+    if (!a->u.s.len) a->u.s = b->u.s;
+    else if (b->u.s.len) {
+	unsigned char *p = tree_alloc (bs, a->u.s.len + b->u.s.len, 0);
+	memcpy (p, a->u.s.p, a->u.s.len);
+	memcpy (p + a->u.s.len, b->u.s.p, b->u.s.len);
+	a->u.s.p = p;
+	a->u.s.len += b->u.s.len;
+    }
+}
+
+/* Append node on top to components of the node below it */
+static void
+tree_set (struct bers *bs, int no)
+{
+    struct ber_node *n = TREE(bs)->top, *c;
+
+    tree_pop (bs);
+    if (n->type == BER_NNIL) return;
+    c = TREE(bs)->top;
+    n->no = no;
+    n->next = NULL;
+    if (c->u.c.last) c->u.c.last->next = n;
+    else c->u.c.first = n;
+    c->u.c.last = n;
+    ++c->u.c.n;
+}
+
+/* Defer SEQUENCE OF: its elements are appended to empty node later */
+static void
+tree_split (struct bers *bs, struct tmt *t, unsigned char *p,
+ unsigned char *endp)
+{
+    struct ber_tree *tr = TREE(bs);
+    struct ber_split *sp = tree_alloc (bs, sizeof (struct ber_split), 1);
+
+    sp->node = tree_push (bs, BER_NCONS);
+    sp->of = t;
+    sp->p = p;
+    sp->endp = endp;
+    sp->next = tr->splits;
+    tr->splits = sp;
+}
+
+static int
+tree_top (struct bers *bs)
+{
+    const struct ber_node *n = TREE(bs)->top;
+
+    if (!n) return BER_VNONE;
+    switch (n->type) {
+    case BER_NNIL: return BER_VNIL;
+    case BER_NCONS: return BER_VCONS;
+    case BER_NMARK: return BER_VMARK;
+    }
+    return BER_VPRIM;
+}
+
+static int
+tree_get (struct bers *bs, int no)
+{
+    (void) no;
+    longjmp (*bs->jb, BER_ERRLUAOUT); /* No source of values */
+    return BER_VNONE;
+}
+
+static const char *
+tree_tostr (struct bers *bs, size_t *len)
+{
+    const struct ber_node *n = TREE(bs)->top;
+
+    *len = n->u.s.len;
+    return (const char *) n->u.s.p;
+}
+
+static unsigned int
+tree_tonum (struct bers *bs)
+{
+    return TREE(bs)->top->u.i;
+}
+
+static int
+tree_tobool (struct bers *bs)
+{
+    return TREE(bs)->top->u.i != 0;
+}
+
+const struct ber_visitor ber_tree_visitor = {
+    NULL, tree_begin, tree_mark, tree_str, tree_num, tree_boolean,
+    tree_nil, tree_cat, tree_set, tree_pop, tree_top, tree_get,
+    tree_tostr, tree_tonum, tree_tobool, NULL, NULL
+};
+
+
+/* Component no of constructed node (NULL - absent) */
+struct ber_node *
+ber_node_get (const struct ber_node *n, const int no)
+{
+    struct ber_node *c;
+
+    if (n->type != BER_NCONS) return NULL;
+    for (c = n->u.c.first; c && c->no != no; c = c->next)
+	continue;
+    return c;
+}
+
+/* Append components of node from to the ones of node to */
+void
+ber_tree_splice (struct ber_node *to, const struct ber_node *from)
+{
+    if (!from->u.c.first) return;
+    if (to->u.c.last) to->u.c.last->next = from->u.c.first;
+    else to->u.c.first = from->u.c.first;
+    to->u.c.last = from->u.c.last;
+    to->u.c.n += from->u.c.n;
+}
+
+/* Decode source of job by odr, maxdepth, projection and split_min
+ * of cfg: PDU at its start or elements of SEQUENCE OF.
+ * Job owns arenas of decoded tree (ber_tree_free (j->mem) later)
+ */
+void
+ber_tree_decode (const struct bers *cfg, struct ber_job *j)
+{
+    struct bers bs;
+    struct ber_tree tr;
+    struct ber_arena a;
+    jmp_buf jb;
+    size_t size;
+    int res;
+
+    j->mem = NULL;
+    j->root = NULL;
+    j->splits = NULL;
+    j->res = (j->of) ? j->len : ber_frame (j->p, j->p + j->len, 0, &j->need);
+    if (j->res <= 0) return;
+
+    memset (&bs, 0, sizeof (struct bers));
+    bs.odr = cfg->odr;
+    bs.maxdepth = cfg->maxdepth;
+    bs.proj = cfg->proj;
+    if (j->of) {
+	bs.start = j->of;
+	bs.start_no = j->no;
+    }
+    if (cfg->split_min > 0) {
+	bs.split = tree_split;
+	bs.split_min = cfg->split_min;
+    }
+    bs.vis = &ber_tree_visitor;
+    bs.ud = &tr;
+    bs.jb = &jb;
+    size = BER_TREE_ARENA (ber_count_all (j->p, j->p + j->res));
+    if (!(j->mem = malloc (sizeof (struct ber_mem) + size))) {
+	j->res = BER_ERRMEM;
+	return;
+    }
+    j->mem->next = NULL;
+    ber_arena_init (&a, (unsigned char *) (j->mem + 1), size);
+    ber_tree_init (&tr, &a);
+    tr.mem = &j->mem;
+    res = setjmp (jb);
+    if (!res) {
+	bs.bp = bs.buf = (unsigned char *) j->p;
+	bs.endp = bs.buf + j->res;
+	res = ber_decode (&bs);
+    }
+    ber_free (&bs);
+    if (res) {
+	ber_tree_free (j->mem);
+	j->mem = NULL;
+	j->res = (res < 0) ? res : BER_ERRTAGLEN;
+	return;
+    }
+    j->root = ber_tree_root (&tr);
+    j->splits = tr.splits;
+}
+
+/* Free arenas of tree */
+void
+ber_tree_free (struct ber_mem *mem)
+{
+    while (mem) {
+	struct ber_mem *next = mem->next;
+	free (mem);
+	mem = next;
+    }
+}
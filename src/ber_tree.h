@@ -0,0 +1,97 @@
+#ifndef BER_TREE_H
+#define BER_TREE_H
+
+#include "ber.h"
+#include "ber_typed.h"	/* struct ber_arena */
+
+
+/* Types of nodes */
+#define BER_NNIL	0	/* zero length value: not stored */
+#define BER_NSTR	1	/* OCTET | BIT STRING, OBJECT IDENTIFIER */
+#define BER_NNUM	2
+#define BER_NBOOL	3
+#define BER_NCONS	4	/* components by number */
+#define BER_NMARK	5	/* mark of walk */
+
+/* Node of decoded tree in arena.
+ * Strings point to the PDU, concatenated segments are in arena */
+struct ber_node {
+    unsigned char type;
+    unsigned short no;		/* component number in parent */
+    struct ber_node *next;	/* next component | below on stack */
+    union {
+	struct {
+	    const unsigned char *p;
+	    int len;
+	} s;
+	unsigned int i;		/* number | boolean */
+	struct {
+	    struct ber_node *first, *last;
+	    int n;		/* count of components */
+	} c;
+    } u;
+};
+
+/* SEQUENCE OF deferred by split (bers.split_min):
+ * elements of type of at p..endp are to be appended to node */
+struct ber_split {
+    struct ber_split *next;
+    struct ber_node *node;
+    struct tmt *of;
+    const unsigned char *p, *endp;
+};
+
+/* Malloc'ed arena of tree, linked to the next one of the same tree */
+struct ber_mem {
+    struct ber_mem *next;
+};
+
+/* State of tree visitor (bers.ud): nodes of the stack are linked.
+ * Full arena fails decoding (BER_ERRMEM), unless mem is set: then
+ * the tree goes on in a twice larger arena, malloc'ed into *mem */
+struct ber_tree {
+    struct ber_arena *arena;
+    struct ber_node *top;
+    struct ber_split *splits;
+    struct ber_mem **mem;	/* arenas grown (NULL - fixed arena) */
+};
+
+#define ber_tree_init(tr, a) \
+	((tr)->arena = (a), (tr)->top = NULL, (tr)->splits = NULL, \
+	 (tr)->mem = NULL)
+/* Root after complete decoding: components are values of PDU */
+#define ber_tree_root(tr)	((tr)->top)
+
+/* First arena of tree of n TLV's (ber_count_all): a node per TLV */
+#define BER_TREE_ARENA(n) \
+	(sizeof (struct ber_node) * ((n) + CHOICES_MAX))
+
+/* Decoding of complete PDU into tree of own arenas */
+struct ber_job {
+    const unsigned char *p;	/* source at p..p+len */
+    int len;
+    struct tmt *of;	/* source is elements of SEQUENCE OF of (NULL - PDU) */
+    int no;		/* from element number no */
+    int res;		/* length of PDU | 0 - incomplete | error code */
+    int need;		/* count of octets needed at least (incomplete) */
+    struct ber_mem *mem;	/* arenas of tree (NULL - failed) */
+    struct ber_node *root;
+    struct ber_split *splits;	/* of cfg.split_min */
+};
+
+
+extern const struct ber_visitor ber_tree_visitor;
+
+struct ber_node *
+ber_node_get (const struct ber_node *n, const int no);
+
+void
+ber_tree_splice (struct ber_node *to, const struct ber_node *from);
+
+void
+ber_tree_decode (const struct bers *cfg, struct ber_job *j);
+
+void
+ber_tree_free (struct ber_mem *mem);
+
+#endif
@@ -0,0 +1,354 @@
+/* Runtime of typed C structs (asn2odr -T): values are decoded into
+ * structs of arena and encoded from them, without Lua.
+ * Strings point to the PDU, unless concatenated or masked in arena
+ */
+
+#include <string.h>
+
+#include "ber_typed.h"
+
+
+#define BERT_ALIGN	sizeof (void *)	/* of structs in arena */
+
+/* Universal tags of segments of constructed strings */
+#define BERT_TAG_BIT	3
+#define BERT_TAG_OCT	4
+
+
+/* Begin decoding of PDU at p..p+len.
+ * Return length of complete PDU, 0 - incomplete or error code
+ */
+int
+bert_begin (struct bert *bt, struct ber_arena *a, const unsigned char *p,
+ const int len)
+{
+    int need;
+    const int res = ber_frame (p, p + len, 0, &need);
+
+    if (res <= 0) return res;
+    bt->bp = p;
+    bt->endp = p + res;
+    bt->op = bt->oendp = NULL;
+    bt->arena = a;
+    bt->maxdepth = BERT_DEPTH_MAX;
+    return res;
+}
+
+/* Begin encoding to buf of size */
+void
+bert_out (struct bert *bt, unsigned char *buf, const int size)
+{
+    bt->bp = bt->endp = NULL;
+    bt->op = buf;
+    bt->oendp = buf + size;
+    bt->arena = NULL;
+    bt->maxdepth = BERT_DEPTH_MAX;
+}
+
+
+/* Check depth of next value */
+void
+bert_depth (struct bert *bt, const int depth)
+{
+    if (depth > (int) bt->maxdepth)
+	longjmp (bt->jb, BER_ERRSTKO); /* Stack overflow */
+}
+
+/* Allocate octets of arena */
+static unsigned char *
+bert_alloc (struct bert *bt, const size_t size)
+{
+    struct ber_arena *a = bt->arena;
+    unsigned char *p;
+
+    if (a->size - a->used < size)
+	longjmp (bt->jb, BER_ERRMEM); /* Arena is full */
+    p = a->base + a->used;
+    a->used += size;
+    return p;
+}
+
+/* Allocate zeroed struct of arena */
+void *
+bert_new (struct bert *bt, const size_t size)
+{
+    struct ber_arena *a = bt->arena;
+    void *p;
+
+    a->used = (a->used + BERT_ALIGN - 1) & ~(BERT_ALIGN - 1);
+    if (a->used > a->size) a->used = a->size;
+    p = bert_alloc (bt, size);
+    memset (p, 0, size);
+    return p;
+}
+
+/* Allocate zeroed elements of SEQUENCE OF: one for each TLV of contents
+ * (NULL - no elements)
+ */
+void *
+bert_array (struct bert *bt, const struct ber_tlv *v, const size_t size)
+{
+    const unsigned char *p = bt->bp;
+    const unsigned char *endp = (v->end) ? v->end : bt->endp;
+    int n = 0;
+
+    while (p < endp) {
+	int res;
+
+	if (!v->end && endp - p >= 2 && !(*p | *(p + 1)))
+	    break;
+	if ((res = ber_tlvs (&p, endp, 0)))
+	    longjmp (bt->jb, (res < 0) ? res : BER_ERRTAGLEN);
+	++n;
+    }
+    return (n) ? bert_new (bt, n * size) : NULL;
+}
+
+/* Is there TLV up to endp (NULL - up to End Of Contents)? */
+int
+bert_next (struct bert *bt, const unsigned char *endp)
+{
+    if (endp) {
+	if (bt->bp > endp)
+	    longjmp (bt->jb, BER_ERRTAGLEN); /* Bad length */
+	return bt->bp < endp;
+    }
+    if (bt->endp - bt->bp < 2)
+	longjmp (bt->jb, BER_ERRTAGLEN); /* Missing End Of Contents */
+    if (!(*bt->bp | *(bt->bp + 1))) {
+	bt->bp += 2;
+	return 0;
+    }
+    return 1;
+}
+
+/* Parse TLV header up to endp (NULL - up to end of PDU) */
+void
+bert_tlv (struct bert *bt, const unsigned char *endp, struct ber_tlv *v)
+{
+    const int res = ber_tlv_get (&bt->bp, (endp) ? endp : bt->endp, v);
+
+    if (res) longjmp (bt->jb, res);
+}
+
+/* Length of primitive contents up to max octets (0 - any) */
+static int
+bert_len (struct bert *bt, const struct ber_tlv *v, const int max)
+{
+    if (v->len < 0)
+	longjmp (bt->jb, BER_ERRTAG); /* BER is constructed */
+    if (max && v->len > max)
+	longjmp (bt->jb, BER_ERRTAGLEN); /* Too long length */
+    return v->len;
+}
+
+/* Mask of last octet of BIT STRING by count of unused bits */
+static unsigned char
+bert_mask (struct bert *bt, const unsigned char pad)
+{
+    if (pad > 7)
+	longjmp (bt->jb, BER_ERRTAG); /* Bad unused bits */
+    return 0xFF >> pad;
+}
+
+/* Append segments of constructed string to arena */
+static void
+bert_cat (struct bert *bt, const struct ber_tlv *v, const int fun,
+ struct ber_str *s, const int depth)
+{
+    const unsigned char *p;
+    unsigned char *d;
+    int len;
+
+    if (v->cons) {
+	const tag_id_t cn = (fun == FUN_BIT) ? BERT_TAG_BIT : BERT_TAG_OCT;
+	bert_depth (bt, depth + 1);
+	while (bert_next (bt, v->end)) {
+	    struct ber_tlv sv;
+	    bert_tlv (bt, v->end, &sv);
+	    if (sv.cn != cn)
+		longjmp (bt->jb, BER_ERRTAGODR); /* Missing odr */
+	    bert_cat (bt, &sv, fun, s, depth + 1);
+	}
+	return;
+    }
+    p = bt->bp;
+    len = bert_len (bt, v, 0);
+    bt->bp = v->end;
+    if (fun == FUN_BIT && len) { /* unused bits ignored */
+	const unsigned char mask = bert_mask (bt, *p);
+	d = bert_alloc (bt, --len);
+	memcpy (d, p + 1, len);
+	if (len) d[len - 1] &= mask;
+    } else {
+	d = bert_alloc (bt, len);
+	memcpy (d, p, len);
+    }
+    if (!s->p) s->p = d;
+    s->len += len;
+}
+
+/* Decode string: octets of contents (of EXTERNAL too) */
+void
+bert_str (struct bert *bt, const struct ber_tlv *v, const int fun,
+ struct ber_str *s, const int depth)
+{
+    const unsigned char *p = bt->bp;
+    int len;
+
+    s->p = NULL;
+    s->len = 0;
+    switch (fun) {
+    case FUN_EXT_ASN:
+	if (!v->end) { /* up to End Of Contents */
+	    const int res = ber_tlvs (&bt->bp, bt->endp, 1);
+	    if (res) longjmp (bt->jb, (res < 0) ? res : BER_ERRTAGLEN);
+	    s->p = p;
+	    s->len = bt->bp - p - 2;
+	    return;
+	}
+	break;
+    case FUN_OCT: case FUN_BIT:
+	if (v->cons) {
+	    bert_cat (bt, v, fun, s, depth);
+	    return;
+	}
+	break;
+    default:
+	bert_len (bt, v, OIDSIZ);
+    }
+    len = v->len;
+    bt->bp = v->end;
+    if (fun == FUN_BIT && len) { /* unused bits ignored */
+	const unsigned char mask = bert_mask (bt, *p);
+	s->p = p + 1;
+	s->len = --len;
+	/* mask in arena only, PDU is read only */
+	if (len && (p[len] & ~mask)) {
+	    unsigned char *d = bert_alloc (bt, len);
+	    memcpy (d, p + 1, len);
+	    d[len - 1] &= mask;
+	    s->p = d;
+	}
+	return;
+    }
+    s->p = p;
+    s->len = len;
+}
+
+void
+bert_int (struct bert *bt, const struct ber_tlv *v, unsigned int *i)
+{
+    int len = bert_len (bt, v, sizeof (int));
+
+    *i = 0;
+    while (len--) {
+	*i <<= 8;
+	*i |= *bt->bp++;
+    }
+}
+
+void
+bert_bool (struct bert *bt, const struct ber_tlv *v, unsigned char *b)
+{
+    *b = bert_len (bt, v, 1) && *bt->bp != 0;
+    bt->bp = v->end;
+}
+
+void
+bert_null (struct bert *bt, const struct ber_tlv *v, unsigned char *b)
+{
+    bert_len (bt, v, 1);
+    bt->bp = v->end;
+    *b = 1;
+}
+
+
+/* Check room of encoding buffer */
+static void
+bert_room (struct bert *bt, const int len)
+{
+    if (bt->oendp - bt->op < len)
+	longjmp (bt->jb, BER_ERRSIZE); /* Buffer overflow */
+}
+
+/* Put tag (constructed?) and length of primitive contents */
+static void
+bert_put_tag (struct bert *bt, const tag_id_t cn, const unsigned char cons,
+ const int len)
+{
+    union tag_id u;
+    unsigned int c;
+
+    u.cn = cn;
+    bert_room (bt, sizeof (tag_id_t) + 1 + sizeof (int) + len);
+    *bt->op++ = u.id.classnum | cons;
+    if ((u.id.classnum & 0x1F) == 0x1F)
+	for (c = 0; c < CLASS_NUMSIZ; ++c)
+	    if (!((*bt->op++ = u.id.number[c]) & 0x80)) break;
+    if (len < 0) {
+	*bt->op++ = BER_INDEFIN;
+	return;
+    }
+    if (len < BER_INDEFIN) *bt->op++ = len;
+    else {
+	unsigned char n = 0;
+	int i;
+	for (i = len; i; i >>= 8) ++n;
+	*bt->op++ = BER_INDEFIN | n;
+	while (n--) *bt->op++ = (unsigned char) (len >> (n * 8));
+    }
+}
+
+/* Open constructed value of indefinite length, as the interpreter does */
+void
+bert_open (struct bert *bt, const tag_id_t cn)
+{
+    bert_put_tag (bt, cn, BER_CONSTR, -1);
+}
+
+/* Close constructed value by End Of Contents */
+void
+bert_close (struct bert *bt)
+{
+    bert_room (bt, 2);
+    *bt->op++ = 0;
+    *bt->op++ = 0;
+}
+
+void
+bert_put_str (struct bert *bt, const tag_id_t cn, const int fun,
+ const struct ber_str *s)
+{
+    const int pad = (fun == FUN_BIT);
+
+    bert_put_tag (bt, cn, (fun == FUN_EXT_ASN) ? BER_CONSTR : 0,
+     s->len + pad);
+    if (pad) *bt->op++ = 0;
+    memcpy (bt->op, s->p, s->len);
+    bt->op += s->len;
+}
+
+void
+bert_put_int (struct bert *bt, const tag_id_t cn, const unsigned int i)
+{
+    int len = 0;
+    unsigned int j = i;
+
+    do ++len; while (j >>= 8);
+    bert_put_tag (bt, cn, 0, len);
+    while (len--) *bt->op++ = (unsigned char) (i >> (len * 8));
+}
+
+void
+bert_put_bool (struct bert *bt, const tag_id_t cn, const unsigned char b)
+{
+    bert_put_tag (bt, cn, 0, 1);
+    *bt->op++ = b != 0;
+}
+
+void
+bert_put_null (struct bert *bt, const tag_id_t cn)
+{
+    bert_put_tag (bt, cn, 0, 0);
+}
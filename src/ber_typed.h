@@ -0,0 +1,87 @@
+#ifndef BER_TYPED_H
+#define BER_TYPED_H
+
+#include <setjmp.h>	/* jmp_buf */
+#include <stddef.h>	/* size_t */
+
+#include "ber_tlv.h"
+
+
+#define BERT_DEPTH_MAX	1024	/* default limit of deep of values */
+
+/* Arena of decoded values: freed at once by reset */
+struct ber_arena {
+    unsigned char *base;
+    size_t size, used;
+};
+#define ber_arena_init(a, p, n) \
+	((a)->base = (p), (a)->size = (n), (a)->used = 0)
+#define ber_arena_reset(a)	((a)->used = 0)
+
+/* Octets of OCTET | BIT STRING, OBJECT IDENTIFIER, contents of EXTERNAL */
+struct ber_str {
+    const unsigned char *p;
+    int len;
+};
+
+/* Presence of component no of SEQUENCE */
+#define BER_HAS(v, no) \
+	((v)->present[((no) - COMP_START_NUM) >> 3] \
+	 & (1 << (((no) - COMP_START_NUM) & 7)))
+#define BER_SET(v, no) \
+	((v)->present[((no) - COMP_START_NUM) >> 3] \
+	 |= (1 << (((no) - COMP_START_NUM) & 7)))
+
+/* State of typed decoding | encoding (asn2odr -T) */
+struct bert {
+    const unsigned char *bp, *endp;	/* decode: current, end of PDU */
+    unsigned char *op, *oendp;		/* encode: current, end of buffer */
+    struct ber_arena *arena;
+    unsigned int maxdepth;
+    jmp_buf jb;
+};
+
+
+int
+bert_begin (struct bert *bt, struct ber_arena *a, const unsigned char *p,
+ const int len);
+void
+bert_out (struct bert *bt, unsigned char *buf, const int size);
+
+/* Decoding */
+void
+bert_depth (struct bert *bt, const int depth);
+void *
+bert_new (struct bert *bt, const size_t size);
+void *
+bert_array (struct bert *bt, const struct ber_tlv *v, const size_t size);
+int
+bert_next (struct bert *bt, const unsigned char *endp);
+void
+bert_tlv (struct bert *bt, const unsigned char *endp, struct ber_tlv *v);
+void
+bert_str (struct bert *bt, const struct ber_tlv *v, const int fun,
+ struct ber_str *s, const int depth);
+void
+bert_int (struct bert *bt, const struct ber_tlv *v, unsigned int *i);
+void
+bert_bool (struct bert *bt, const struct ber_tlv *v, unsigned char *b);
+void
+bert_null (struct bert *bt, const struct ber_tlv *v, unsigned char *b);
+
+/* Encoding */
+void
+bert_open (struct bert *bt, const tag_id_t cn);
+void
+bert_close (struct bert *bt);
+void
+bert_put_str (struct bert *bt, const tag_id_t cn, const int fun,
+ const struct ber_str *s);
+void
+bert_put_int (struct bert *bt, const tag_id_t cn, const unsigned int i);
+void
+bert_put_bool (struct bert *bt, const tag_id_t cn, const unsigned char b);
+void
+bert_put_null (struct bert *bt, const tag_id_t cn);
+
+#endif
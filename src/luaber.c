@@ -1,130 +1,2063 @@
 /* Lua BER library */
 
+#include <errno.h>
+#include <limits.h>	/* IOV_MAX */
 #include <setjmp.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/uio.h>	/* writev */
+#include <unistd.h>	/* write */
 
 #include <lauxlib.h>
 #include <lua.h>
 
 #include "ber.h"
+#include "ber_pool.h"
+#include "ber_tpl.h"
+#include "ber_tree.h"
 #include "ber_util.h"
+#include "luaber.h"
+
+#if LUA_VERSION_NUM < 502
+#include <lualib.h>	/* LUA_FILEHANDLE */
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX		16 /* POSIX minimum */
+#endif
+
+#if LUA_VERSION_NUM < 502
+#define lua_getuservalue	lua_getfenv
+#define lua_setuservalue	lua_setfenv
+#define lua_rawlen		lua_objlen
+#endif
 
 typedef struct bers *p_bers;
 typedef struct mmodr *p_mmodr;
 
 #define BERHANDLE	"bers*"
 #define ODRHANDLE	"mmodr*"
+#define LAZYHANDLE	"lazy*"
+#define SLICEHANDLE	"slice*"
+#define PROJHANDLE	"proj*"
+#define NODEHANDLE	"node*"
+#define ARENAHANDLE	"arena*"
+#define POOLHANDLE	"pool*"
+#define RAWHANDLE	"raw*"
+#define HOLEHANDLE	"hole*"
+#define TPLHANDLE	"tpl*"
+
+/* Proxy of lazy decoded constructed value */
+struct lazy {
+    struct mmodr *odr;
+    struct tmt *tag;
+    unsigned char *tlv, *endp;
+    int slice_min; /* slices of level (0 - disabled) */
+    unsigned int maxdepth; /* limit of bers stack from the value down */
+    unsigned char decoded; /* uservalue: anchor -> components {[0] = anchor} */
+};
+typedef struct lazy *p_lazy;
+
+/* Reference to octets of source string */
+struct slice {
+    const char *p;
+    size_t len; /* uservalue: anchor */
+};
+typedef struct slice *p_slice;
+
+/* Pre-encoded TLV: len octets follow the header */
+struct raw {
+    size_t len;
+};
+typedef struct raw *p_raw;
+
+#define RAW_OCTETS(r)	((unsigned char *) ((r) + 1))
+
+/* Hole of template: len octets of name follow the header */
+struct hole {
+    size_t len;
+};
+typedef struct hole *p_hole;
+
+#define HOLE_NAME(h)	((const char *) ((h) + 1))
+
+/* Template of PDU (uservalue: {[0] = thread, odr = odr_udata,
+ * names of holes by number}) */
+struct ltpl {
+    struct bers bs; /* encoder of holes: thread has {[comp_no] = value} */
+    struct ber_tpl tpl;
+    unsigned char *hbuf; /* TLVs of holes */
+    size_t hsize;
+    unsigned char *obuf; /* PDU */
+    size_t osize;
+};
+typedef struct ltpl *p_ltpl;
+
+/* Compiled projection of ODR */
+struct proj {
+    struct tmt *odrs; /* of compiling, to match the decoding odr */
+    unsigned char marks[1]; /* PROJ_* by tmt address */
+};
+typedef struct proj *p_proj;
+
+/* Bers of Lua (uservalue: {[0] = thread, odr = odr_udata,
+ *	proj = projection_udata of decoding}) */
+struct lbers {
+    struct bers bs;
+    int anchor; /* registry ref of {[0] = source string, [odr = odr_udata]} in decoding */
+    unsigned char *obuf; /* growing buffer of encode_all */
+    size_t osize;
+    /* Gathered encoding: pairs of octets of obuf (iov_base is NULL
+     * till the end of encoding) and strings in place */
+    struct iovec *iov;
+    unsigned int niov, iov_max;
+    size_t ohead; /* start of octets of obuf after the last string */
+    lua_State *L; /* of list of gathered values (at index list) */
+    int list;
+    int sink; /* registry ref of sink of decoded strings */
+    struct lsink *sk; /* of decoding */
+};
+typedef struct lbers *p_lbers;
+
+/* Proxy of constructed node of decoded tree
+ * (uservalue: anchor {[0] = source string, [1] = arena}) */
+struct node {
+    const struct ber_node *node;
+};
+typedef struct node *p_node;
+
+/* Owner of malloc'ed arenas of decoded tree */
+struct arena {
+    struct ber_mem *mem;
+};
+typedef struct arena *p_arena;
+
+typedef struct ber_pool *p_pool;
+
+/* Walk of source string by Lua handler */
+struct lwalk {
+    struct lbers lb;
+    lua_State *L; /* handler at index 3 */
+    const char *str;
+    int err; /* handler raised error (message on top of L) */
+};
+
+/* Sink of encode_into and of decoded strings:
+ * function at index of L, FILE | fd */
+struct lsink {
+    lua_State *L;
+    int idx;
+    FILE *f;
+    int fd;
+    int err; /* decoding: write failed (-1 | -2) */
+};
+
+static void lslice_push (struct bers *bs, unsigned char *p, int len);
+static void lsink_arg (lua_State *L, int idx, struct lsink *sk);
+static int lsink_write (struct lsink *sk, const unsigned char *p,
+ size_t len);
+static p_raw lraw_test (lua_State *L, int idx);
+static p_hole lhole_test (lua_State *L, int idx);
 
 #define BUF_SIZ		BUFSIZ /* encode out chunk size */
 
+#define BERS_L(bs)	((lua_State *) (bs)->ud)
+
+
+/* <<========================================
+ * Visitor of Lua: values are on the stack of bs->ud,
+ * constructed ones are tables, marks of walk are light userdata of bs
+ */
+
+static int
+lvis_room (struct bers *bs)
+{
+    return lua_checkstack (BERS_L(bs), LUA_MINSTACK);
+}
+
+static void
+lvis_begin (struct bers *bs, int narr, int nrec)
+{
+    lua_createtable (BERS_L(bs), narr, nrec);
+}
+
+static void
+lvis_mark (struct bers *bs)
+{
+    lua_pushlightuserdata (BERS_L(bs), bs);
+}
+
+static void
+lvis_str (struct bers *bs, const unsigned char *p, int len)
+{
+    lua_pushlstring (BERS_L(bs), (const char *) p, len);
+}
+
+static void
+lvis_num (struct bers *bs, unsigned int i)
+{
+    lua_pushnumber (BERS_L(bs), i);
+}
+
+static void
+lvis_boolean (struct bers *bs, int b)
+{
+    lua_pushboolean (BERS_L(bs), b);
+}
+
+static void
+lvis_nil (struct bers *bs)
+{
+    lua_pushnil (BERS_L(bs));
+}
+
+static void
+lvis_cat (struct bers *bs)
+{
+    lua_concat (BERS_L(bs), 2);
+}
+
+static void
+lvis_set (struct bers *bs, int no)
+{
+    lua_rawseti (BERS_L(bs), -2, no);
+}
+
+static void
+lvis_pop (struct bers *bs)
+{
+    lua_pop (BERS_L(bs), 1);
+}
+
+static int
+lvis_top (struct bers *bs)
+{
+    lua_State *L = BERS_L(bs);
+
+    if (!lua_gettop (L)) return BER_VNONE;
+    switch (lua_type (L, -1)) {
+    case LUA_TNIL: return BER_VNIL;
+    case LUA_TTABLE: return BER_VCONS;
+    case LUA_TFUNCTION: return BER_VREAD;
+    case LUA_TUSERDATA:
+	if (lraw_test (L, -1)) return BER_VRAW;
+	if (lhole_test (L, -1)) return BER_VHOLE;
+	break;
+    case LUA_TLIGHTUSERDATA:
+	if (lua_touserdata (L, -1) == bs) return BER_VMARK;
+    }
+    return BER_VPRIM;
+}
+
+static int
+lvis_get (struct bers *bs, int no)
+{
+    lua_rawgeti (BERS_L(bs), -1, no);
+    return lvis_top (bs);
+}
+
+static const char *
+lvis_tostr (struct bers *bs, size_t *len)
+{
+    lua_State *L = BERS_L(bs);
+    p_raw r = lraw_test (L, -1);
+
+    if (r) {
+	*len = r->len;
+	return (const char *) RAW_OCTETS(r);
+    }
+    return luaber_tolstring (L, -1, len);
+}
+
+static unsigned int
+lvis_tonum (struct bers *bs)
+{
+    return (int) lua_tonumber (BERS_L(bs), -1);
+}
+
+static int
+lvis_tobool (struct bers *bs)
+{
+    return lua_toboolean (BERS_L(bs), -1);
+}
+
+/* Numbers of components of table on top: one traversal of it */
+static void
+lvis_keys (struct bers *bs, unsigned int *bits, int n)
+{
+    lua_State *L = BERS_L(bs);
+
+    lua_pushnil (L);
+    while (lua_next (L, -2)) {
+	if (lua_type (L, -2) == LUA_TNUMBER) {
+	    const lua_Number d = lua_tonumber (L, -2);
+	    const int i = (int) d - COMP_START_NUM;
+
+	    if (i >= 0 && i < n && (lua_Number) (int) d == d)
+		bits[i >> 5] |= 1U << (i & 31);
+	}
+	lua_pop (L, 1);
+    }
+}
+
+/* Call reader on top with max: it returns string of up to max octets
+ * (nil or empty one - its end) */
+static int
+lvis_read (struct bers *bs, unsigned char *p, int max)
+{
+    lua_State *L = BERS_L(bs);
+    const char *s;
+    size_t len = 0;
+
+    lua_pushvalue (L, -1);
+    lua_pushinteger (L, max);
+    if (lua_pcall (L, 1, 1, 0)) {
+	lua_pop (L, 1);
+	longjmp (*bs->jb, BER_ERRREAD); /* Reader failed */
+    }
+    if (!lua_isnil (L, -1)) {
+	s = (lua_type (L, -1) == LUA_TSTRING)
+	 ? lua_tolstring (L, -1, &len) : NULL;
+	if (!s || len > (size_t) max) {
+	    lua_pop (L, 1);
+	    longjmp (*bs->jb, BER_ERRREAD); /* Bad string */
+	}
+	memcpy (p, s, len);
+    }
+    lua_pop (L, 1);
+    return (int) len;
+}
+
+const struct ber_visitor luaber_visitor = {
+    lvis_room, lvis_begin, lvis_mark, lvis_str, lvis_num, lvis_boolean,
+    lvis_nil, lvis_cat, lvis_set, lvis_pop, lvis_top, lvis_get,
+    lvis_tostr, lvis_tonum, lvis_tobool, lvis_keys, lvis_read
+};
+
+/* ========================================>> */
+
 /*
  * Arguments: odr_udata
  * Returns: ber_udata, thread
  */
 static int
-lber_ber (lua_State *L)
+lber_ber (lua_State *L)
+{
+    p_mmodr mo = lua_touserdata (L, 1); /* ODRHANDLE */
+    p_lbers lb;
+
+    lua_settop (L, 1);
+    lb = lua_newuserdata (L, sizeof (struct lbers)); /* 2 */
+    luaL_getmetatable (L, BERHANDLE);
+    lua_setmetatable (L, -2);
+    memset (lb, 0, sizeof (struct lbers));
+    lb->anchor = LUA_NOREF;
+    lb->sink = LUA_NOREF;
+    lb->bs.odr = mo;
+    lb->bs.vis = &luaber_visitor;
+    /* values and odr live as long as the codec */
+    lua_createtable (L, 0, 2); /* 3: uservalue */
+    lua_pushvalue (L, 1);
+    lua_setfield (L, 3, "odr");
+    lb->bs.ud = lua_newthread (L); /* 4 */
+    lua_pushvalue (L, 4);
+    lua_rawseti (L, 3, 0);
+    lua_pushvalue (L, 3);
+    lua_setuservalue (L, 2);
+    lua_remove (L, 3);
+    return 2;
+}
+
+/*
+ * Arguments: ber_udata
+ */
+static int
+lber_clear (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    struct bers bs0 = *bs;
+    lua_settop (BERS_L(&bs0), 0);
+    lua_getuservalue (L, 1);
+    lua_pushnil (L);
+    lua_setfield (L, -2, "proj");
+    memset (bs, 0, sizeof (struct bers));
+    bs->odr = bs0.odr;
+    bs->vis = bs0.vis;
+    bs->ud = bs0.ud;
+    bs->stack = bs0.stack;
+    bs->nstack = bs0.nstack;
+    bs->keys = bs0.keys;
+    bs->nkeys = bs0.nkeys;
+    bs->maxdepth = bs0.maxdepth;
+    bs->slice = bs0.slice;
+    bs->slice_min = bs0.slice_min;
+    bs->seg_size = bs0.seg_size;
+    bs->sink = bs0.sink;
+    bs->sink_min = bs0.sink_min;
+    bs->sink_marks = bs0.sink_marks;
+    bs->sizes = bs0.sizes;
+    bs->sizes_max = bs0.sizes_max;
+    return 0;
+}
+
+/*
+ * Arguments: ber_udata
+ */
+static int
+lber_gc (lua_State *L)
+{
+    p_lbers lb = lua_touserdata (L, 1); /* BERHANDLE */
+    ber_free (&lb->bs);
+    free (lb->obuf);
+    lb->obuf = NULL;
+    lb->osize = 0;
+    free (lb->iov);
+    lb->iov = NULL;
+    lb->iov_max = 0;
+    free ((void *) lb->bs.sink_marks);
+    lb->bs.sink_marks = NULL;
+    luaL_unref (L, LUA_REGISTRYINDEX, lb->sink);
+    lb->sink = LUA_NOREF;
+    lb->bs.sink = NULL;
+    return 0;
+}
+
+/*
+ * Arguments: ber_udata, [number]
+ * Returns: number (previous limit)
+ */
+static int
+lber_maxdepth (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    int depth = luaL_optinteger (L, 2, 0);
+
+    lua_pushinteger (L, (bs->maxdepth) ? bs->maxdepth : BERS_MAX);
+    if (depth) {
+	/* encode buffer must hold End Of Contents of all bers */
+	if (depth < 1 || depth > BUF_SIZ / 4)
+	    luaL_argerror (L, 2, "bad depth");
+	bs->maxdepth = depth;
+    }
+    return 1;
+}
+
+/*
+ * Arguments: ber_udata, [number (octets)]
+ * Returns: number (previous size of segments of strings from readers)
+ */
+static int
+lber_segments (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    int size = luaL_optinteger (L, 2, 0);
+
+    lua_pushinteger (L, (bs->seg_size) ? bs->seg_size : ENC_SEGSZ);
+    if (size) {
+	/* encode buffer must hold segment with End Of Contents */
+	if (size < 1 || size > BUF_SIZ / 2)
+	    luaL_argerror (L, 2, "bad size");
+	bs->seg_size = size;
+    }
+    return 1;
+}
+
+/*
+ * Arguments: ber_udata, [number (min. size) | nil | false]
+ */
+static int
+lber_slices (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    if (lua_toboolean (L, 2)) {
+	int min = luaL_checkinteger (L, 2);
+	if (min < 0) luaL_argerror (L, 2, "negative size");
+	bs->slice = lslice_push;
+	bs->slice_min = min;
+    } else {
+	bs->slice = NULL;
+	bs->slice_min = 0;
+    }
+    return 0;
+}
+
+/* Write octets of string to sink (called from ber_decode) */
+static void
+lber_sink_write (struct bers *bs, const struct tmt *t,
+ const unsigned char *p, int len)
+{
+    struct lsink *sk = ((p_lbers) bs)->sk;
+
+    (void) t;
+    if ((sk->err = lsink_write (sk, p, len)))
+	longjmp (*bs->jb, BER_ERRSINK);
+}
+
+/*
+ * Arguments: ber_udata, sink (function | file | fd) | false,
+ *	[min (number), paths (table of paths {"name.name...", ...})]
+ * Returns: true
+ *          nil, errcode, path
+ */
+static int
+lber_sink (lua_State *L)
+{
+    p_lbers lb = lua_touserdata (L, 1); /* BERHANDLE */
+    p_bers bs = &lb->bs;
+    const int on = lua_toboolean (L, 2);
+    const int min = (lua_toboolean (L, 3)) ? luaL_checkinteger (L, 3) : 0;
+    unsigned char *marks = NULL;
+    struct lsink sk;
+    int i;
+
+    if (bs->top)
+	luaL_argerror (L, 1, "decoding in progress");
+    if (on) {
+	lsink_arg (L, 2, &sk);
+	if (min < 0) luaL_argerror (L, 3, "negative size");
+	if (!lua_isnoneornil (L, 4)) {
+	    luaL_checktype (L, 4, LUA_TTABLE);
+	    marks = calloc (ber_proj_size (bs->odr), 1);
+	    if (!marks) {
+		lua_pushnil (L);
+		lua_pushinteger (L, BER_ERRMEM);
+		return 2;
+	    }
+	}
+	/* strings of paths, or of SEQUENCE OF them */
+	for (i = 1; marks; ++i) {
+	    const char *path;
+	    struct tmt *t;
+	    lua_rawgeti (L, 4, i);
+	    if (lua_isnil (L, -1)) break;
+	    path = lua_tostring (L, -1);
+	    t = (path) ? ber_path_find (bs->odr, path) : NULL;
+	    if (t && (t->opt & TAG_TYPE_OF)) t = bs->odr->odrs + t->subaddr;
+	    if (!t || !(t->opt & TAG_SIMPLE) || t->subaddr != FUN_OCT) {
+		free (marks);
+		lua_pushnil (L);
+		lua_pushinteger (L, BER_ERRPATH);
+		lua_pushvalue (L, -3);
+		return 3;
+	    }
+	    marks[t - bs->odr->odrs] = 1;
+	    lua_pop (L, 1);
+	}
+	if (!min && !marks)
+	    luaL_argerror (L, 3, "size or paths expected");
+    }
+    free ((void *) bs->sink_marks);
+    luaL_unref (L, LUA_REGISTRYINDEX, lb->sink);
+    lb->sink = LUA_NOREF;
+    bs->sink = NULL;
+    bs->sink_min = 0;
+    bs->sink_marks = marks;
+    if (on) {
+	lua_pushvalue (L, 2);
+	lb->sink = luaL_ref (L, LUA_REGISTRYINDEX);
+	bs->sink = lber_sink_write;
+	bs->sink_min = min;
+    }
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+/* Push sink of decoded strings of lb (if any) */
+static void
+lber_sink_push (lua_State *L, p_lbers lb, struct lsink *sk)
+{
+    lb->sk = NULL;
+    if (lb->sink == LUA_NOREF) return;
+    lua_rawgeti (L, LUA_REGISTRYINDEX, lb->sink);
+    lsink_arg (L, lua_gettop (L), sk);
+    lb->sk = sk;
+}
+
+/* Result of failed decoding: nil, errcode [, message of sink]
+ * (error raised by sink function is raised again)
+ */
+static int
+lber_decode_err (lua_State *L, p_lbers lb, const int res)
+{
+    if (res == BER_ERRSINK && lb->sk->err == -2)
+	lua_error (L);
+    lua_pushnil (L);
+    lua_pushinteger (L, res);
+    if (res != BER_ERRSINK) return 2;
+    lua_pushvalue (L, -3);
+    return 3;
+}
+
+/* Anchor source string (at idx) of decoding values */
+static void
+lber_anchor (lua_State *L, p_lbers lb, int idx)
+{
+    lua_newtable (L);
+    lua_pushvalue (L, idx);
+    lua_rawseti (L, -2, 0);
+    lb->anchor = luaL_ref (L, LUA_REGISTRYINDEX);
+}
+
+static void
+lber_unanchor (lua_State *L, p_lbers lb)
+{
+    luaL_unref (L, LUA_REGISTRYINDEX, lb->anchor);
+    lb->anchor = LUA_NOREF;
+}
+
+/* Marks of projection argument for decoding by bs (NULL - none) */
+static const unsigned char *
+lproj_arg (lua_State *L, int idx, struct bers *bs)
+{
+    p_proj pr;
+
+    if (lua_isnoneornil (L, idx)) return NULL;
+    pr = luaL_checkudata (L, idx, PROJHANDLE);
+    if (pr->odrs != bs->odr->odrs)
+	luaL_argerror (L, idx, "projection of other odr");
+    return pr->marks;
+}
+
+/* Set projection of decoding by bs from argument at idx.
+ * Partial PDU is continued with its projection (anchored in uservalue) */
+static void
+lber_proj (lua_State *L, p_bers bs, int idx)
+{
+    const unsigned char *marks = lproj_arg (L, idx, bs);
+
+    if (bs->top) {
+	if (marks != bs->proj)
+	    luaL_argerror (L, idx, "projection of partial PDU expected");
+	return;
+    }
+    bs->proj = marks;
+    lua_getuservalue (L, 1);
+    lua_pushvalue (L, idx);
+    lua_setfield (L, -2, "proj");
+    lua_pop (L, 1);
+}
+
+/*
+ * Arguments: ber_udata, string, [init (number), projection_udata]
+ * Returns: tail (string) | position of first undecoded octet, table
+ *          nil, errcode
+ */
+static int
+lber_decode (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    void *strp = NULL;
+    size_t str_len, init = 0;
+    struct lsink sk;
+    jmp_buf jb;
+    unsigned char c;
+    int res, pos = !lua_isnoneornil (L, 3);
+
+    luaL_checktype (L, 2, LUA_TSTRING);
+    strp = (void *) lua_tolstring (L, 2, &str_len);
+    if (pos) {
+	init = luaL_checkinteger (L, 3);
+	if (init < 1 || init > str_len + 1)
+	    luaL_argerror (L, 3, "initial position out of string");
+	--init;
+    }
+    lua_settop (L, 4);
+    lber_proj (L, bs, 4);
+    lber_sink_push (L, (p_lbers) bs, &sk);
+    if (bs->slice) lber_anchor (L, (p_lbers) bs, 2);
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = (unsigned char *) strp + init; /* chunk start */
+    bs->endp = (unsigned char *) strp + str_len;
+    res = setjmp (jb);
+    if (!res) c = ber_decode (bs);
+    if (bs->slice) lber_unanchor (L, (p_lbers) bs);
+    if (res) return lber_decode_err (L, (p_lbers) bs, res);
+    /* tail or its position */
+    res = bs->endp - bs->bp;
+    if (res < 0) res = 0;
+    if (pos) lua_pushinteger (L, str_len - res + 1);
+    else lua_pushlstring (L, (char *) bs->bp, res);
+    /* complete? */
+    if (!c || c == BER_MORE) {
+	lua_xmove (BERS_L(bs), L, 1);
+	return 2;
+    }
+    return 1;
+}
+
+/*
+ * Arguments: ber_udata, string, [init (number), projection_udata]
+ * Returns: array of tables, position of first undecoded octet (number)
+ *          nil, errcode
+ */
+static int
+lber_decode_all (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    size_t str_len;
+    const char *str = luaL_checklstring (L, 2, &str_len);
+    size_t init = luaL_optinteger (L, 3, 1);
+    struct lsink sk;
+    jmp_buf jb;
+    int n = 0, t, res;
+
+    if (init < 1 || init > str_len + 1)
+	luaL_argerror (L, 3, "initial position out of string");
+    lua_settop (L, 4);
+    lber_proj (L, bs, 4);
+    lber_sink_push (L, (p_lbers) bs, &sk);
+    lua_newtable (L);
+    t = lua_gettop (L);
+    if (bs->slice) lber_anchor (L, (p_lbers) bs, 2);
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = (unsigned char *) str + init - 1; /* chunk start */
+    bs->endp = (unsigned char *) str + str_len;
+    res = setjmp (jb);
+    if (!res)
+	/* partial PDU remains in bers for next call */
+	while (bs->bp < bs->endp && ber_decode (bs) != BER_INCOMPL) {
+	    lua_xmove (BERS_L(bs), L, 1);
+	    lua_rawseti (L, t, ++n);
+	}
+    if (bs->slice) lber_unanchor (L, (p_lbers) bs);
+    if (res) return lber_decode_err (L, (p_lbers) bs, res);
+    if (bs->bp > bs->endp) bs->bp = bs->endp;
+    lua_pushinteger (L, bs->bp - (unsigned char *) str + 1);
+    return 2;
+}
+
+/* Call handler with walk event (called from ber_decode) */
+static int
+lwalk_event (struct bers *bs, int ev, const struct tmt *t, int no,
+ const unsigned char *p, int len)
+{
+    static const char *const events[] = {NULL, "start", "value", "end"};
+    struct lwalk *w = (struct lwalk *) bs;
+    lua_State *L = w->L;
+    int stop;
+
+    lua_pushvalue (L, 3);
+    lua_pushstring (L, events[ev]);
+    lua_pushstring (L, bs->odr->names + t->nameaddr);
+    lua_pushinteger (L, no);
+    if (ev == BER_WALK_VALUE) {
+	lua_pushvalue (BERS_L(bs), -1);
+	lua_xmove (BERS_L(bs), L, 1);
+    } else lua_pushnil (L);
+    if (p) {
+	const int i = p - (const unsigned char *) w->str + 1;
+	lua_pushinteger (L, i);
+	if (len < 0) lua_pushnil (L); /* indefinite */
+	else lua_pushinteger (L, i + len - 1);
+    } else {
+	lua_pushnil (L);
+	lua_pushnil (L);
+    }
+    if (lua_pcall (L, 6, 1, 0)) {
+	w->err = 1;
+	return 1;
+    }
+    stop = lua_isboolean (L, -1) && !lua_toboolean (L, -1);
+    lua_pop (L, 1);
+    return stop;
+}
+
+/*
+ * Arguments: ber_udata, string, handler (function),
+ *	[init (number), projection_udata]
+ * Handler: event ("start" | "value" | "end"), name (string),
+ *	comp_no (number), value, first (number), last (number)
+ *	returns false to stop
+ * Returns: position of first undecoded octet (number)
+ *          false (incomplete)
+ *          nil, errcode
+ */
+static int
+lber_walk (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    struct lwalk w;
+    size_t str_len;
+    const char *str = luaL_checklstring (L, 2, &str_len);
+    size_t init = luaL_optinteger (L, 4, 1);
+    jmp_buf jb;
+    int res;
+
+    luaL_checktype (L, 3, LUA_TFUNCTION);
+    if (init < 1 || init > str_len + 1)
+	luaL_argerror (L, 4, "initial position out of string");
+
+    memset (&w, 0, sizeof (struct lwalk));
+    w.lb.bs.odr = bs->odr;
+    w.lb.bs.maxdepth = bs->maxdepth;
+    w.lb.bs.slice = bs->slice;
+    w.lb.bs.slice_min = bs->slice_min;
+    w.lb.bs.proj = lproj_arg (L, 5, bs);
+    w.lb.bs.walk = lwalk_event;
+    w.L = L;
+    w.str = str;
+    lua_settop (L, 5);
+    w.lb.bs.vis = &luaber_visitor;
+    w.lb.bs.ud = lua_newthread (L); /* values */
+    lber_anchor (L, &w.lb, 2);
+
+    w.lb.bs.jb = &jb;
+    w.lb.bs.bp = w.lb.bs.buf = (unsigned char *) str + init - 1;
+    w.lb.bs.endp = (unsigned char *) str + str_len;
+    res = setjmp (jb);
+    if (!res) res = ber_decode (&w.lb.bs);
+    ber_free (&w.lb.bs);
+    lber_unanchor (L, &w.lb);
+    if (w.err) lua_error (L);
+    if (res < 0) {
+	lua_pushnil (L);
+	lua_pushinteger (L, res);
+	return 2;
+    }
+    if (res == BER_INCOMPL)
+	lua_pushboolean (L, 0);
+    else lua_pushinteger (L, w.lb.bs.bp - (unsigned char *) str + 1);
+    return 1;
+}
+
+/* Drop state of failed encoding */
+static void
+lber_reset (p_bers bs)
+{
+    bs->top = NULL;
+    bs->sizes_mode = 0;
+    lua_settop (BERS_L(bs), 0);
+}
+
+/*
+ * Arguments: ber_udata, table, [definite (boolean)]
+ * Returns: string, [boolean (complete?)]
+ *          nil, errcode
+ */
+static int
+lber_encode (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    const int definite = lua_toboolean (L, 3);
+    unsigned char buffer[BUF_SIZ];
+    jmp_buf jb;
+    int res, start = 0;
+
+    if (!lua_istable (L, 2))
+	luaL_argerror (L, 2, "Table_out expected");
+    lua_settop (L, 2);
+    /* set table in thread (in place of the one of the last PDU) */
+    if (!bs->top) {
+	lua_settop (BERS_L(bs), 0);
+	lua_xmove (L, BERS_L(bs), 1);
+	start = 1;
+    }
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = buffer;
+    bs->endp = buffer + BUF_SIZ;
+    res = setjmp (jb);
+    if (!res) {
+	unsigned char c;
+	if (start && definite) {
+	    /* sizing pass of copy of table */
+	    lua_pushvalue (BERS_L(bs), 1);
+	    ber_encode_size (bs);
+	}
+	c = ber_encode (bs);
+	lua_pushlstring (L, (char *) buffer, bs->bp - buffer);
+	lua_pushboolean (L, !c);
+    } else {
+	lber_reset (bs);
+        lua_pushnil (L);
+        lua_pushinteger (L, res);
+    }
+    return 2;
+}
+
+/* Reallocate buffer of encode_all (called from ber_encode) */
+static unsigned char *
+lber_grow (struct bers *bs, size_t size)
+{
+    p_lbers lb = (p_lbers) bs;
+    unsigned char *buf = realloc (lb->obuf, size);
+
+    if (buf) {
+	lb->obuf = buf;
+	lb->osize = size;
+    }
+    return buf;
+}
+
+/*
+ * Arguments: ber_udata, table
+ * Returns: string
+ *          nil, errcode
+ */
+static int
+lber_encode_all (lua_State *L)
+{
+    p_lbers lb = lua_touserdata (L, 1); /* BERHANDLE */
+    p_bers bs = &lb->bs;
+    jmp_buf jb;
+    int res;
+
+    if (!lua_istable (L, 2))
+	luaL_argerror (L, 2, "Table_out expected");
+    if (bs->top)
+	luaL_argerror (L, 1, "encoding in progress");
+    lua_settop (L, 2);
+    lua_settop (BERS_L(bs), 0);
+    lua_xmove (L, BERS_L(bs), 1);
+    /* buffer is kept for next calls */
+    if (!lb->obuf && !lber_grow (bs, BUF_SIZ)) {
+	lua_pushnil (L);
+	lua_pushinteger (L, BER_ERRMEM);
+	return 2;
+    }
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = lb->obuf;
+    bs->endp = lb->obuf + lb->osize;
+    bs->grow = lber_grow;
+    res = setjmp (jb);
+    if (!res) {
+	/* sizing pass of copy of table in buffer, then PDU fits in it
+	 * (compiled encoders put lengths in one pass) */
+	if (!bs->odr->encode) {
+	    size_t size;
+	    lua_pushvalue (BERS_L(bs), 1);
+	    size = ber_encode_size (bs) + sizeof (tag_id_t);
+	    if (size > lb->osize && !lber_grow (bs, size))
+		longjmp (jb, BER_ERRMEM);
+	    bs->bp = bs->buf = lb->obuf;
+	    bs->endp = lb->obuf + lb->osize;
+	}
+	res = ber_encode (bs);
+    }
+    bs->grow = NULL;
+    if (!res) {
+	lua_pushlstring (L, (char *) bs->buf, bs->bp - bs->buf);
+	return 1;
+    }
+    lber_reset (bs);
+    lua_pushnil (L);
+    lua_pushinteger (L, res);
+    return 2;
+}
+
+/*
+ * Arguments: ber_udata, table
+ * Returns: number (octets of PDU with definite lengths)
+ *          nil, errcode
+ */
+static int
+lber_encoded_size (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    unsigned char buffer[BUF_SIZ];
+    jmp_buf jb;
+    int res;
+
+    if (!lua_istable (L, 2))
+	luaL_argerror (L, 2, "Table_out expected");
+    if (bs->top)
+	luaL_argerror (L, 1, "encoding in progress");
+    lua_settop (L, 2);
+    lua_settop (BERS_L(bs), 0);
+    lua_xmove (L, BERS_L(bs), 1);
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = buffer;
+    bs->endp = buffer + BUF_SIZ;
+    res = setjmp (jb);
+    if (!res) {
+	lua_pushinteger (L, ber_encode_size (bs));
+	bs->sizes_mode = 0;
+	return 1;
+    }
+    lber_reset (bs);
+    lua_pushnil (L);
+    lua_pushinteger (L, res);
+    return 2;
+}
+
+#define GATHER_MIN	1024 /* default least length of gathered strings */
+
+/* Reference string on top of thread (called from ber_encode) */
+static void
+lber_gather (struct bers *bs, const unsigned char *p, int len)
+{
+    p_lbers lb = (p_lbers) bs;
+    const size_t off = bs->bp - bs->buf;
+
+    /* room for tail octets too */
+    if (lb->niov + 3 > lb->iov_max) {
+	const unsigned int n = (lb->iov_max) ? lb->iov_max * 2 : BERS_MIN;
+	struct iovec *iov = realloc (lb->iov, n * sizeof (struct iovec));
+	if (!iov) longjmp (*bs->jb, BER_ERRMEM);
+	lb->iov = iov;
+	lb->iov_max = n;
+    }
+    lb->iov[lb->niov].iov_base = NULL;
+    lb->iov[lb->niov++].iov_len = off - lb->ohead;
+    lb->iov[lb->niov].iov_base = (void *) p;
+    lb->iov[lb->niov++].iov_len = len;
+    lb->ohead = off;
+    /* number may be converted in place, so anchor the string */
+    lua_pushvalue (BERS_L(bs), -1);
+    lua_xmove (BERS_L(bs), lb->L, 1);
+    lua_rawseti (lb->L, lb->list, lb->niov / 2);
+}
+
+/* Encode table at index 2 with definite lengths, gathering strings
+ * of at least min octets: lb->iov has all the octets of PDU then,
+ * and table of gathered strings is pushed to keep them.
+ * Returns 0 | error code
+ */
+static int
+lber_encode_gather (lua_State *L, p_lbers lb, const int min)
+{
+    p_bers bs = &lb->bs;
+    jmp_buf jb;
+    int res;
+    unsigned int i;
+
+    if (bs->top)
+	luaL_argerror (L, 1, "encoding in progress");
+    lua_settop (BERS_L(bs), 0);
+    lua_pushvalue (L, 2);
+    lua_xmove (L, BERS_L(bs), 1);
+    lua_newtable (L); /* gathered values */
+    if (!lb->obuf && !lber_grow (bs, BUF_SIZ))
+	return BER_ERRMEM;
+    lb->niov = 0;
+    lb->ohead = 0;
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = lb->obuf;
+    bs->endp = lb->obuf + lb->osize;
+    res = setjmp (jb);
+    if (!res) {
+	/* sizing pass of copy of table, then lengths are not patched
+	 * in octets between strings */
+	lua_pushvalue (BERS_L(bs), 1);
+	ber_encode_size (bs);
+	bs->grow = lber_grow;
+	bs->gather = lber_gather;
+	bs->gather_min = min;
+	lb->L = L;
+	lb->list = lua_gettop (L);
+	res = ber_encode (bs);
+    }
+    bs->grow = NULL;
+    bs->gather = NULL;
+    lb->L = NULL;
+    lb->list = 0;
+    if (res) {
+	lber_reset (bs);
+	return res;
+    }
+    if ((size_t) (bs->bp - bs->buf) > lb->ohead) { /* tail octets */
+	if (!lb->iov_max) {
+	    if (!(lb->iov = malloc (BERS_MIN * sizeof (struct iovec))))
+		return BER_ERRMEM;
+	    lb->iov_max = BERS_MIN;
+	}
+	lb->iov[lb->niov].iov_base = NULL;
+	lb->iov[lb->niov++].iov_len = bs->bp - bs->buf - lb->ohead;
+    }
+    lb->ohead = 0;
+    /* obuf is in place now */
+    for (i = 0; i < lb->niov; i += 2) {
+	lb->iov[i].iov_base = lb->obuf + lb->ohead;
+	lb->ohead += lb->iov[i].iov_len;
+    }
+    return 0;
+}
+
+/*
+ * Arguments: ber_udata, table, [min (number)]
+ * Returns: table (array of octets of PDU: the odd items are strings, the
+ *		even ones values of at least min octets in place - strings,
+ *		slice_udata or raw_udata of the table)
+ *          nil, errcode
+ */
+static int
+lber_encode_iov (lua_State *L)
+{
+    p_lbers lb = lua_touserdata (L, 1); /* BERHANDLE */
+    const int min = luaL_optinteger (L, 3, GATHER_MIN);
+    unsigned int i;
+    int res;
+
+    if (!lua_istable (L, 2))
+	luaL_argerror (L, 2, "Table_out expected");
+    if (min < 1)
+	luaL_argerror (L, 3, "bad length");
+    lua_settop (L, 2);
+    res = lber_encode_gather (L, lb, min); /* 3: gathered values */
+    if (res) {
+	lua_pushnil (L);
+	lua_pushinteger (L, res);
+	return 2;
+    }
+    lua_createtable (L, lb->niov, 0);
+    for (i = 0; i < lb->niov; ++i) {
+	if (i & 1) lua_rawgeti (L, 3, (i + 1) / 2);
+	else lua_pushlstring (L, lb->iov[i].iov_base, lb->iov[i].iov_len);
+	lua_rawseti (L, 4, i + 1);
+    }
+    return 1;
+}
+
+/*
+ * Arguments: ber_udata, fd (number), table, [min (number)]
+ * Returns: number (octets written)
+ *          nil, errcode | (message, number (octets written))
+ */
+static int
+lber_encode_to_fd (lua_State *L)
+{
+    p_lbers lb = lua_touserdata (L, 1); /* BERHANDLE */
+    const int fd = luaL_checkinteger (L, 2);
+    const int min = luaL_optinteger (L, 4, GATHER_MIN);
+    struct iovec *iov;
+    size_t done = 0;
+    unsigned int n;
+    int res;
+
+    if (!lua_istable (L, 3))
+	luaL_argerror (L, 3, "Table_out expected");
+    if (min < 1)
+	luaL_argerror (L, 4, "bad length");
+    lua_settop (L, 3);
+    lua_insert (L, 2); /* table at index 2 */
+    res = lber_encode_gather (L, lb, min); /* 4: gathered values */
+    if (res) {
+	lua_pushnil (L);
+	lua_pushinteger (L, res);
+	return 2;
+    }
+    iov = lb->iov;
+    n = lb->niov;
+    while (n) {
+	ssize_t len = writev (fd, iov, (n < IOV_MAX) ? n : IOV_MAX);
+	if (len < 0) {
+	    if (errno == EINTR) continue;
+	    lua_pushnil (L);
+	    lua_pushstring (L, strerror (errno));
+	    lua_pushinteger (L, done);
+	    return 3;
+	}
+	done += len;
+	/* skip written vectors */
+	for (; n && (size_t) len >= iov->iov_len; ++iov, --n)
+	    len -= iov->iov_len;
+	if (n) {
+	    iov->iov_base = (char *) iov->iov_base + len;
+	    iov->iov_len -= len;
+	}
+    }
+    lua_pushinteger (L, done);
+    return 1;
+}
+
+/* Set sink by argument at idx */
+static void
+lsink_arg (lua_State *L, int idx, struct lsink *sk)
+{
+    sk->L = L;
+    sk->idx = 0;
+    sk->f = NULL;
+    sk->fd = -1;
+    sk->err = 0;
+    if (lua_isfunction (L, idx)) sk->idx = idx;
+    else if (lua_isnumber (L, idx)) sk->fd = lua_tointeger (L, idx);
+    else {
+#if LUA_VERSION_NUM >= 502
+	luaL_Stream *st = luaL_checkudata (L, idx, LUA_FILEHANDLE);
+	if (st->closef) sk->f = st->f;
+#else
+	FILE **pf = luaL_checkudata (L, idx, LUA_FILEHANDLE);
+	sk->f = *pf;
+#endif
+	if (!sk->f) luaL_argerror (L, idx, "closed file");
+    }
+}
+
+/* Write octets to sink.
+ * Returns 0 | -1 (stopped: message on top of L)
+ *	| -2 (function raised error: message on top of L)
+ */
+static int
+lsink_write (struct lsink *sk, const unsigned char *p, size_t len)
+{
+    lua_State *L = sk->L;
+
+    if (sk->idx) {
+	lua_pushvalue (L, sk->idx);
+	lua_pushlstring (L, (const char *) p, len);
+	if (lua_pcall (L, 1, 2, 0)) return -2;
+	/* false | nil, error */
+	if ((lua_isboolean (L, -2) && !lua_toboolean (L, -2))
+	 || (lua_isnil (L, -2) && !lua_isnil (L, -1))) {
+	    if (lua_isnil (L, -1)) lua_pushliteral (L, "stopped by sink");
+	    return -1;
+	}
+	lua_pop (L, 2);
+	return 0;
+    }
+    if (sk->f) {
+	if (fwrite (p, 1, len, sk->f) == len) return 0;
+    } else while (len) {
+	const ssize_t n = write (sk->fd, p, len);
+	if (n < 0) {
+	    if (errno == EINTR) continue;
+	    break;
+	}
+	p += n;
+	len -= n;
+    }
+    if (!len) return 0;
+    lua_pushstring (L, strerror (errno));
+    return -1;
+}
+
+/*
+ * Arguments: ber_udata, sink (function | file | fd), table,
+ *	[definite (boolean)]
+ * Returns: number (octets written)
+ *          nil, errcode | message
+ */
+static int
+lber_encode_into (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    const int definite = lua_toboolean (L, 4);
+    struct lsink sk;
+    unsigned char buffer[BUF_SIZ];
+    jmp_buf jb;
+    size_t done = 0;
+    int res;
+
+    lsink_arg (L, 2, &sk);
+    if (!lua_istable (L, 3))
+	luaL_argerror (L, 3, "Table_out expected");
+    if (bs->top)
+	luaL_argerror (L, 1, "encoding in progress");
+    lua_settop (L, 3);
+    lua_settop (BERS_L(bs), 0);
+    lua_pushvalue (L, 3);
+    lua_xmove (L, BERS_L(bs), 1);
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = buffer;
+    bs->endp = buffer + BUF_SIZ;
+    res = setjmp (jb);
+    if (!res) {
+	unsigned char c;
+	if (definite) {
+	    lua_pushvalue (BERS_L(bs), 1);
+	    ber_encode_size (bs);
+	}
+	/* flush buffer on each chunk and resume */
+	do {
+	    int err;
+	    c = ber_encode (bs);
+	    if ((err = lsink_write (&sk, buffer, bs->bp - buffer))) {
+		lber_reset (bs);
+		if (err == -2) lua_error (L);
+		lua_pushnil (L);
+		lua_insert (L, -2);
+		return 2;
+	    }
+	    done += bs->bp - buffer;
+	    bs->bp = buffer;
+	} while (c == BER_INCOMPL);
+	lua_pushinteger (L, done);
+	return 1;
+    }
+    lber_reset (bs);
+    lua_pushnil (L);
+    lua_pushinteger (L, res);
+    return 2;
+}
+
+/* Push proxy of constructed value (called from ber_decode) */
+static void
+llazy_push (struct bers *bs, struct tmt *t,
+ unsigned char *tlv, unsigned char *endp)
+{
+    lua_State *L = BERS_L(bs);
+    p_lazy lz = lua_newuserdata (L, sizeof (struct lazy));
+
+    lz->odr = bs->odr;
+    lz->tag = t;
+    lz->tlv = tlv;
+    lz->endp = endp;
+    lz->slice_min = (bs->slice) ? bs->slice_min : -1;
+    /* the value is on top of the stack: the rest of the limit of the
+     * codec is left for its own levels */
+    lz->maxdepth = ((bs->maxdepth) ? bs->maxdepth : BERS_MAX)
+     - (bs->top - bs->stack);
+    lz->decoded = 0;
+    luaL_getmetatable (L, LAZYHANDLE);
+    lua_setmetatable (L, -2);
+    lua_rawgeti (L, LUA_REGISTRYINDEX, ((p_lbers) bs)->anchor);
+    lua_setuservalue (L, -2);
+}
+
+/* Decode octets in lazy mode.
+ * Push table or nil, errcode | nil (incomplete)
+ */
+static int
+llazy_decode (lua_State *L, struct lbers *lb, unsigned char *buf,
+ unsigned char *endp, unsigned char depth)
+{
+    const int top = lua_gettop (L);
+    jmp_buf jb;
+    int res;
+
+    lb->bs.vis = &luaber_visitor;
+    lb->bs.ud = L;
+    lb->bs.jb = &jb;
+    lb->bs.bp = lb->bs.buf = buf;
+    lb->bs.endp = endp;
+    lb->bs.lazy = llazy_push;
+    lb->bs.lazy_depth = depth;
+    res = setjmp (jb);
+    if (!res) res = ber_decode (&lb->bs);
+    ber_free (&lb->bs);
+    if (res < 0) {
+	lua_settop (L, top);
+	lua_pushnil (L);
+	lua_pushinteger (L, res);
+	return 2;
+    }
+    if (res == BER_INCOMPL) {
+	lua_settop (L, top);
+	lua_pushnil (L);
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * Arguments: ber_udata, string
+ * Returns: tail (string), table
+ *          string (incomplete)
+ *          nil, errcode
+ */
+static int
+lber_decode_lazy (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    struct lbers lb;
+    const char *str;
+    size_t str_len;
+    int res;
+
+    str = luaL_checklstring (L, 2, &str_len);
+    lua_settop (L, 2);
+
+    memset (&lb, 0, sizeof (struct lbers));
+    lb.bs.odr = bs->odr;
+    lb.bs.maxdepth = bs->maxdepth;
+    lb.bs.slice = bs->slice;
+    lb.bs.slice_min = bs->slice_min;
+    lber_anchor (L, &lb, 2);
+    /* proxies keep pointers into odr */
+    lua_rawgeti (L, LUA_REGISTRYINDEX, lb.anchor);
+    lua_getuservalue (L, 1);
+    lua_getfield (L, -1, "odr");
+    lua_setfield (L, -3, "odr");
+    lua_pop (L, 2);
+    res = llazy_decode (L, &lb, (unsigned char *) str,
+     (unsigned char *) str + str_len, 0);
+    lber_unanchor (L, &lb);
+    if (res == 1) {
+	lua_pushvalue (L, 2);
+	return 1;
+    }
+    if (res) return res;
+    /* tail */
+    lua_pushlstring (L, (char *) lb.bs.bp, lb.bs.endp - lb.bs.bp);
+    lua_insert (L, -2);
+    return 2;
+}
+
+/* Push table of components of lazy proxy */
+static void
+llazy_level (lua_State *L, int idx)
+{
+    p_lazy lz = lua_touserdata (L, idx); /* LAZYHANDLE */
+    struct lbers lb;
+    int top, res;
+
+    lua_getuservalue (L, idx);
+    if (lz->decoded) return;
+    top = lua_gettop (L);
+    memset (&lb, 0, sizeof (struct lbers));
+    lb.bs.odr = lz->odr;
+    lb.bs.start = lz->tag;
+    lb.bs.maxdepth = lz->maxdepth;
+    if (lz->slice_min >= 0) {
+	lb.bs.slice = lslice_push;
+	lb.bs.slice_min = lz->slice_min;
+    }
+    lua_pushvalue (L, -1);
+    lb.anchor = luaL_ref (L, LUA_REGISTRYINDEX);
+    res = llazy_decode (L, &lb, lz->tlv, lz->endp, 1);
+    lber_unanchor (L, &lb);
+    if (res) {
+	if (res == 1) luaL_error (L, "lazy: incomplete value");
+	luaL_error (L, "lazy: %s", ber_errstr (lua_tointeger (L, -1)));
+    }
+    lua_pushvalue (L, top); /* anchor */
+    lua_rawseti (L, -2, 0);
+    lua_pushvalue (L, -1);
+    lua_setuservalue (L, idx);
+    lz->decoded = 1;
+    lua_replace (L, top);
+    lua_settop (L, top);
+}
+
+/*
+ * Arguments: lazy_udata, key
+ * Returns: value
+ */
+static int
+llazy_index (lua_State *L)
+{
+    llazy_level (L, 1);
+    if (lua_type (L, 2) == LUA_TNUMBER && lua_tonumber (L, 2) == 0)
+	lua_pushnil (L); /* anchor */
+    else {
+	lua_pushvalue (L, 2);
+	lua_rawget (L, -2);
+    }
+    return 1;
+}
+
+/*
+ * Arguments: lazy_udata
+ * Returns: number
+ */
+static int
+llazy_len (lua_State *L)
+{
+    llazy_level (L, 1);
+    lua_pushinteger (L, lua_rawlen (L, -1));
+    return 1;
+}
+
+/*
+ * Arguments: table, key
+ * Returns: key, value
+ */
+static int
+llazy_next (lua_State *L)
+{
+    lua_settop (L, 2);
+    while (lua_next (L, 1)) {
+	/* skip anchor */
+	if (lua_type (L, -2) != LUA_TNUMBER || lua_tonumber (L, -2) != 0)
+	    return 2;
+	lua_pop (L, 1);
+    }
+    return 0;
+}
+
+/*
+ * Arguments: lazy_udata
+ * Returns: function, table, nil
+ */
+static int
+llazy_pairs (lua_State *L)
+{
+    lua_pushcfunction (L, llazy_next);
+    llazy_level (L, 1);
+    lua_pushnil (L);
+    return 3;
+}
+
+
+/* Push value of node: constructed one as proxy with anchor at idx
+ * or as table of components (idx 0)
+ */
+static void
+lnode_push (lua_State *L, const struct ber_node *n, const int idx)
+{
+    const struct ber_node *c;
+    p_node nd;
+
+    switch (n->type) {
+    case BER_NSTR:
+	lua_pushlstring (L, (const char *) n->u.s.p, n->u.s.len);
+	break;
+    case BER_NNUM:
+	lua_pushnumber (L, n->u.i);
+	break;
+    case BER_NBOOL:
+	lua_pushboolean (L, n->u.i);
+	break;
+    case BER_NCONS:
+	if (idx) {
+	    nd = lua_newuserdata (L, sizeof (struct node));
+	    nd->node = n;
+	    luaL_getmetatable (L, NODEHANDLE);
+	    lua_setmetatable (L, -2);
+	    lua_pushvalue (L, idx);
+	    lua_setuservalue (L, -2);
+	    break;
+	}
+	luaL_checkstack (L, LUA_MINSTACK, "tree: too deep");
+	c = n->u.c.last;
+	if (c && c->no == n->u.c.n) lua_createtable (L, n->u.c.n, 0);
+	else lua_createtable (L, 0, n->u.c.n);
+	for (c = n->u.c.first; c; c = c->next) {
+	    lnode_push (L, c, 0);
+	    lua_rawseti (L, -2, c->no);
+	}
+	break;
+    default:
+	lua_pushnil (L);
+    }
+}
+
+/*
+ * Returns: arena_udata (empty)
+ */
+static p_arena
+larena_new (lua_State *L)
+{
+    p_arena ar = lua_newuserdata (L, sizeof (struct arena));
+
+    ar->mem = NULL;
+    luaL_getmetatable (L, ARENAHANDLE);
+    lua_setmetatable (L, -2);
+    return ar;
+}
+
+/*
+ * Arguments: arena_udata
+ */
+static int
+larena_gc (lua_State *L)
+{
+    p_arena ar = lua_touserdata (L, 1); /* ARENAHANDLE */
+
+    ber_tree_free (ar->mem);
+    ar->mem = NULL;
+    return 0;
+}
+
+/* Push root of decoded tree of job as proxy of anchor
+ * {[0] = source string at sidx, [1] = arena_udata at aidx}
+ */
+static void
+ljob_push (lua_State *L, const struct ber_job *j, const int sidx,
+ const int aidx)
+{
+    lua_createtable (L, 2, 0);
+    lua_pushvalue (L, sidx);
+    lua_rawseti (L, -2, 0);
+    lua_pushvalue (L, aidx);
+    lua_rawseti (L, -2, 1);
+    lnode_push (L, j->root, lua_gettop (L));
+    lua_remove (L, -2);
+}
+
+/*
+ * Arguments: ber_udata, string, [init (number), projection_udata]
+ * Returns: node_udata (root), position of first undecoded octet (number)
+ *          false, count of octets needed at least (incomplete)
+ *          nil, errcode
+ */
+static int
+lber_decode_tree (lua_State *L)
+{
+    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
+    size_t str_len;
+    const char *str = luaL_checklstring (L, 2, &str_len);
+    const size_t init = luaL_optinteger (L, 3, 1);
+    struct bers cfg;
+    struct ber_job j;
+    p_arena ar;
+
+    if (init < 1 || init > str_len + 1)
+	luaL_argerror (L, 3, "initial position out of string");
+    lua_settop (L, 4);
+
+    memset (&cfg, 0, sizeof (struct bers));
+    cfg.odr = bs->odr;
+    cfg.maxdepth = bs->maxdepth;
+    cfg.proj = lproj_arg (L, 4, bs);
+    ar = larena_new (L); /* 5 */
+    j.p = (const unsigned char *) str + init - 1;
+    j.len = str_len - init + 1;
+    j.of = NULL;
+    ber_tree_decode (&cfg, &j);
+    ar->mem = j.mem;
+    if (j.res <= 0) {
+	if (j.res) lua_pushnil (L);
+	else lua_pushboolean (L, 0);
+	lua_pushinteger (L, j.res ? j.res : j.need);
+	return 2;
+    }
+    ljob_push (L, &j, 2, 5);
+    lua_pushinteger (L, init + j.res);
+    return 2;
+}
+
+/*
+ * Arguments: node_udata, key
+ * Returns: value of component | method
+ */
+static int
+lnode_index (lua_State *L)
+{
+    p_node nd = lua_touserdata (L, 1); /* NODEHANDLE */
+
+    if (lua_type (L, 2) == LUA_TNUMBER) {
+	const struct ber_node *c = ber_node_get (nd->node,
+	 (int) lua_tointeger (L, 2));
+	if (!c) lua_pushnil (L);
+	else {
+	    lua_getuservalue (L, 1);
+	    lnode_push (L, c, lua_gettop (L));
+	}
+	return 1;
+    }
+    luaL_getmetatable (L, NODEHANDLE);
+    lua_pushvalue (L, 2);
+    lua_rawget (L, -2);
+    return 1;
+}
+
+/*
+ * Arguments: node_udata
+ * Returns: number (of last component)
+ */
+static int
+lnode_len (lua_State *L)
+{
+    p_node nd = lua_touserdata (L, 1); /* NODEHANDLE */
+    const struct ber_node *c = nd->node->u.c.last;
+
+    lua_pushinteger (L, c ? c->no : 0);
+    return 1;
+}
+
+/*
+ * Upvalues: next component (light userdata), anchor
+ * Returns: key, value
+ */
+static int
+lnode_next (lua_State *L)
+{
+    const struct ber_node *c = lua_touserdata (L, lua_upvalueindex (1));
+
+    if (!c) return 0;
+    lua_pushlightuserdata (L, c->next);
+    lua_replace (L, lua_upvalueindex (1));
+    lua_pushinteger (L, c->no);
+    lnode_push (L, c, lua_upvalueindex (2));
+    return 2;
+}
+
+/*
+ * Arguments: node_udata
+ * Returns: function
+ */
+static int
+lnode_pairs (lua_State *L)
+{
+    p_node nd = lua_touserdata (L, 1); /* NODEHANDLE */
+
+    lua_pushlightuserdata (L, nd->node->u.c.first);
+    lua_getuservalue (L, 1);
+    lua_pushcclosure (L, lnode_next, 2);
+    return 1;
+}
+
+/*
+ * Arguments: node_udata
+ * Returns: table
+ */
+static int
+lnode_to_lua (lua_State *L)
+{
+    p_node nd = luaL_checkudata (L, 1, NODEHANDLE);
+
+    lnode_push (L, nd->node, 0);
+    return 1;
+}
+
+
+/*
+ * Arguments: [count of threads (number)]
+ * Returns: pool_udata
+ */
+static int
+lpool_new (lua_State *L)
+{
+    const int n = luaL_optinteger (L, 1, 1);
+    p_pool pl;
+
+    luaL_argcheck (L, n >= 1, 1, "count of threads must be positive");
+    pl = lua_newuserdata (L, sizeof (struct ber_pool));
+    if (ber_pool_init (pl, n))
+	return luaL_error (L, "pool: cannot init");
+    luaL_getmetatable (L, POOLHANDLE);
+    lua_setmetatable (L, -2);
+    return 1;
+}
+
+/*
+ * Arguments: pool_udata
+ * Returns: number (of threads)
+ */
+static int
+lpool_threads (lua_State *L)
+{
+    p_pool pl = lua_touserdata (L, 1); /* POOLHANDLE */
+
+    lua_pushinteger (L, pl->nthreads + 1);
+    return 1;
+}
+
+/*
+ * Arguments: pool_udata
+ */
+static int
+lpool_gc (lua_State *L)
+{
+    p_pool pl = lua_touserdata (L, 1); /* POOLHANDLE */
+
+    ber_pool_free (pl);
+    return 0;
+}
+
+/*
+ * Arguments: pool_udata, odr_udata, table of strings, [proxies (boolean),
+ *	split (number: octets of SEQUENCE OF to decode by all threads)]
+ * Returns: table of values by string: table | node_udata (proxies),
+ *	false (incomplete) | errcode
+ */
+static int
+lpool_decode_batch (lua_State *L)
+{
+    p_pool pl = lua_touserdata (L, 1); /* POOLHANDLE */
+    p_mmodr mo = luaL_checkudata (L, 2, ODRHANDLE);
+    const int proxies = lua_toboolean (L, 4);
+    const int split = luaL_optinteger (L, 5, 0);
+    struct ber_job *jobs;
+    struct bers cfg;
+    int i, n;
+
+    luaL_checktype (L, 3, LUA_TTABLE);
+    lua_settop (L, 4);
+    n = lua_rawlen (L, 3);
+    jobs = lua_newuserdata (L, n * sizeof (struct ber_job)); /* 5 */
+    for (i = 0; i < n; ++i) {
+	size_t len;
+
+	lua_rawgeti (L, 3, i + 1);
+	if (lua_type (L, -1) != LUA_TSTRING)
+	    luaL_argerror (L, 3, "strings expected");
+	jobs[i].p = (const unsigned char *) lua_tolstring (L, -1, &len);
+	jobs[i].len = len;
+	lua_pop (L, 1);
+    }
+    /* owners of arenas before decoding */
+    lua_createtable (L, n, 0); /* 6 */
+    for (i = 1; i <= n; ++i) {
+	larena_new (L);
+	lua_rawseti (L, 6, i);
+    }
+    memset (&cfg, 0, sizeof (struct bers));
+    cfg.odr = mo;
+    cfg.split_min = split;
+    ber_pool_run (pl, &cfg, jobs, n);
+    for (i = 0; i < n; ++i) {
+	lua_rawgeti (L, 6, i + 1);
+	((p_arena) lua_touserdata (L, -1))->mem = jobs[i].mem;
+	lua_pop (L, 1);
+    }
+
+    lua_createtable (L, n, 0); /* 7 */
+    for (i = 0; i < n; ++i) {
+	const struct ber_job *j = &jobs[i];
+
+	if (j->res <= 0) {
+	    if (j->res) lua_pushinteger (L, j->res);
+	    else lua_pushboolean (L, 0);
+	} else {
+	    lua_rawgeti (L, 3, i + 1); /* 8 */
+	    lua_rawgeti (L, 6, i + 1); /* 9 */
+	    if (proxies) ljob_push (L, j, 8, 9);
+	    else {
+		p_arena ar = lua_touserdata (L, 9);
+		lnode_push (L, j->root, 0);
+		ber_tree_free (ar->mem);
+		ar->mem = NULL;
+	    }
+	    lua_replace (L, 8);
+	    lua_pop (L, 1);
+	}
+	lua_rawseti (L, 7, i + 1);
+    }
+    return 1;
+}
+
+/* Push slice of source octets (called from ber_decode) */
+static void
+lslice_push (struct bers *bs, unsigned char *p, int len)
+{
+    lua_State *L = BERS_L(bs);
+    p_slice sl = lua_newuserdata (L, sizeof (struct slice));
+
+    sl->p = (const char *) p;
+    sl->len = len;
+    luaL_getmetatable (L, SLICEHANDLE);
+    lua_setmetatable (L, -2);
+    lua_rawgeti (L, LUA_REGISTRYINDEX, ((p_lbers) bs)->anchor);
+    lua_setuservalue (L, -2);
+}
+
+/* Return slice at idx or NULL */
+static p_slice
+lslice_test (lua_State *L, int idx)
+{
+    p_slice sl = lua_touserdata (L, idx);
+
+    if (sl && lua_getmetatable (L, idx)) {
+	luaL_getmetatable (L, SLICEHANDLE);
+	if (!lua_rawequal (L, -1, -2)) sl = NULL;
+	lua_pop (L, 2);
+    } else sl = NULL;
+    return sl;
+}
+
+/* Octets of string or slice */
+LUALIB_API const char *
+luaber_tolstring (lua_State *L, int idx, size_t *len)
+{
+    p_slice sl = lslice_test (L, idx);
+
+    if (sl) {
+	if (len) *len = sl->len;
+	return sl->p;
+    }
+    return lua_tolstring (L, idx, len);
+}
+
+/* Relative string position: negative means back from end */
+static size_t
+lslice_posrelat (lua_Integer pos, size_t len)
+{
+    if (pos >= 0) return (size_t) pos;
+    else if (0u - (size_t) pos > len) return 0;
+    else return len + (size_t) pos + 1;
+}
+
+/*
+ * Arguments: slice_udata
+ * Returns: string
+ */
+static int
+lslice_tostring (lua_State *L)
+{
+    p_slice sl = luaL_checkudata (L, 1, SLICEHANDLE);
+    lua_pushlstring (L, sl->p, sl->len);
+    return 1;
+}
+
+/*
+ * Arguments: slice_udata
+ * Returns: number
+ */
+static int
+lslice_len (lua_State *L)
+{
+    p_slice sl = luaL_checkudata (L, 1, SLICEHANDLE);
+    lua_pushinteger (L, sl->len);
+    return 1;
+}
+
+/*
+ * Arguments: slice_udata, [i (number), j (number)]
+ * Returns: slice_udata
+ */
+static int
+lslice_sub (lua_State *L)
+{
+    p_slice sl = luaL_checkudata (L, 1, SLICEHANDLE);
+    size_t i = lslice_posrelat (luaL_optinteger (L, 2, 1), sl->len);
+    size_t j = lslice_posrelat (luaL_optinteger (L, 3, -1), sl->len);
+    p_slice sub = lua_newuserdata (L, sizeof (struct slice));
+
+    /* clamp to [1, len + 1], as string.sub() does */
+    if (i < 1) i = 1;
+    if (i > sl->len + 1) i = sl->len + 1;
+    if (j > sl->len) j = sl->len;
+    sub->p = sl->p + i - 1;
+    sub->len = (i <= j) ? j - i + 1 : 0;
+    luaL_getmetatable (L, SLICEHANDLE);
+    lua_setmetatable (L, -2);
+    lua_getuservalue (L, 1);
+    lua_setuservalue (L, -2);
+    return 1;
+}
+
+/*
+ * Arguments: slice_udata, [i (number), j (number)]
+ * Returns: number ...
+ */
+static int
+lslice_byte (lua_State *L)
+{
+    p_slice sl = luaL_checkudata (L, 1, SLICEHANDLE);
+    size_t i = lslice_posrelat (luaL_optinteger (L, 2, 1), sl->len);
+    size_t j = lslice_posrelat (luaL_optinteger (L, 3, i), sl->len);
+    int n;
+
+    if (i < 1) i = 1;
+    if (j > sl->len) j = sl->len;
+    if (i > j) return 0;
+    n = (int) (j - i + 1);
+    luaL_checkstack (L, n, "slice too long");
+    for (--i; i < j; ++i)
+	lua_pushinteger (L, (unsigned char) sl->p[i]);
+    return n;
+}
+
+/*
+ * Arguments: slice_udata
+ * Returns: pointer (lightuserdata), length (number)
+ */
+static int
+lslice_ptr (lua_State *L)
+{
+    p_slice sl = luaL_checkudata (L, 1, SLICEHANDLE);
+    lua_pushlightuserdata (L, (void *) sl->p);
+    lua_pushinteger (L, sl->len);
+    return 2;
+}
+
+/* Return pre-encoded TLV at idx or NULL */
+static p_raw
+lraw_test (lua_State *L, int idx)
+{
+    p_raw r = lua_touserdata (L, idx);
+
+    if (r && lua_getmetatable (L, idx)) {
+	luaL_getmetatable (L, RAWHANDLE);
+	if (!lua_rawequal (L, -1, -2)) r = NULL;
+	lua_pop (L, 2);
+    } else r = NULL;
+    return r;
+}
+
+/* Push new pre-encoded TLV of len octets */
+static p_raw
+lraw_push (lua_State *L, size_t len)
+{
+    /* encoder stores whole tag_id_t after the last octet */
+    p_raw r = lua_newuserdata (L, sizeof (struct raw) + len
+     + sizeof (tag_id_t));
+
+    r->len = len;
+    luaL_getmetatable (L, RAWHANDLE);
+    lua_setmetatable (L, -2);
+    return r;
+}
+
+/*
+ * Arguments: string | slice_udata (one complete TLV)
+ * Returns: raw_udata
+ *          nil, errcode
+ */
+static int
+lraw_new (lua_State *L)
 {
-    p_mmodr mo = lua_touserdata (L, 1); /* ODRHANDLE */
-    p_bers bs = lua_newuserdata (L, sizeof (struct bers));
-    luaL_getmetatable (L, BERHANDLE);
-    lua_setmetatable (L, -2);
-    memset (bs, 0, sizeof (struct bers));
-    bs->odr = mo;
-    bs->L = lua_newthread (L);
-    return 2;
+    size_t len = 0;
+    const char *str = luaber_tolstring (L, 1, &len);
+    int res, need = 0;
+
+    if (!str) luaL_argerror (L, 1, "string expected");
+    res = ber_frame ((const unsigned char *) str,
+     (const unsigned char *) str + len, 0, &need);
+    if (res != (int) len || !len) {
+	lua_pushnil (L);
+	lua_pushinteger (L, (res < 0) ? res : BER_ERRTAGLEN);
+	return 2;
+    }
+    memcpy (RAW_OCTETS(lraw_push (L, len)), str, len);
+    return 1;
 }
 
 /*
- * Arguments: ber_udata
+ * Arguments: raw_udata
+ * Returns: string
  */
 static int
-lber_clear (lua_State *L)
+lraw_tostring (lua_State *L)
 {
-    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
-    p_mmodr mo = bs->odr;
-    lua_State *bsL = bs->L;
-    lua_settop (bsL, 0);
-    memset (bs, 0, sizeof (struct bers));
-    bs->odr = mo;
-    bs->L = bsL;
-    return 0;
+    p_raw r = luaL_checkudata (L, 1, RAWHANDLE);
+    lua_pushlstring (L, (char *) RAW_OCTETS(r), r->len);
+    return 1;
 }
 
 /*
- * Arguments: ber_udata, string
- * Returns: tail (string), table
- *          nil, errcode
+ * Arguments: raw_udata
+ * Returns: number
  */
 static int
-lber_decode (lua_State *L)
+lraw_len (lua_State *L)
 {
-    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
-    void *strp = NULL;
-    size_t str_len;
-    jmp_buf jb;
-    unsigned char c;
-    int res;
+    p_raw r = luaL_checkudata (L, 1, RAWHANDLE);
+    lua_pushinteger (L, r->len);
+    return 1;
+}
 
-    luaL_checktype (L, 2, LUA_TSTRING);
-    strp = (void *) lua_tolstring (L, 2, &str_len);
+/* Return hole at idx or NULL */
+static p_hole
+lhole_test (lua_State *L, int idx)
+{
+    p_hole h = lua_touserdata (L, idx);
 
-    bs->jb = &jb;
-    bs->bp = bs->buf = strp;
-    bs->endp = (unsigned char *) strp + str_len;
-    res = setjmp (jb);
-    if (!res) c = ber_decode (bs);
-    else {
-	lua_pushnil (L);
-	lua_pushinteger (L, res);
-	return 2;
-    }
-    /* tail */
-    res = bs->endp - bs->bp;
-    if (res < 0) res = 0;
-    lua_pushlstring (L, (char *) bs->bp, res);
-    /* complete? */
-    if (!c || c == BER_MORE) {
-	lua_xmove (bs->L, L, 1);
-	return 2;
-    }
-    return 1;
+    if (h && lua_getmetatable (L, idx)) {
+	luaL_getmetatable (L, HOLEHANDLE);
+	if (!lua_rawequal (L, -1, -2)) h = NULL;
+	lua_pop (L, 2);
+    } else h = NULL;
+    return h;
 }
 
 /*
- * Arguments: ber_udata, table
- * Returns: string, [boolean (complete?)]
- *          nil, errcode
+ * Arguments: name (string)
+ * Returns: hole_udata
  */
 static int
-lber_encode (lua_State *L)
+lhole_new (lua_State *L)
 {
-    p_bers bs = lua_touserdata (L, 1); /* BERHANDLE */
-    unsigned char buffer[BUF_SIZ];
-    jmp_buf jb;
-    int res;
-
-    if (!lua_istable (L, 2))
-	luaL_argerror (L, 2, "Table_out expected");
-    /* set table in thread */
-    if (!lua_gettop (bs->L))
-	lua_xmove (L, bs->L, 1);
+    size_t len;
+    const char *name = luaL_checklstring (L, 1, &len);
+    p_hole h = lua_newuserdata (L, sizeof (struct hole) + len);
 
-    bs->jb = &jb;
-    bs->bp = bs->buf = buffer;
-    bs->endp = buffer + BUF_SIZ;
-    res = setjmp (jb);
-    if (!res) {
-	unsigned char c = ber_encode (bs);
-	lua_pushlstring (L, (char *) buffer, bs->bp - buffer);
-	lua_pushboolean (L, !c);
-    } else {
-        lua_pushnil (L);
-        lua_pushinteger (L, res);
-    }
-    return 2;
+    h->len = len;
+    memcpy ((char *) HOLE_NAME(h), name, len);
+    luaL_getmetatable (L, HOLEHANDLE);
+    lua_setmetatable (L, -2);
+    return 1;
 }
 
+
 /*
  * Returns: odr_udata
  */
@@ -135,6 +2068,8 @@ lodr_new (lua_State *L)
     luaL_getmetatable (L, ODRHANDLE);
     lua_setmetatable (L, -2);
     mo->odrs = NULL;
+    mo->decode = NULL;
+    mo->encode = NULL;
     return 1;
 }
 
@@ -160,6 +2095,316 @@ lodr_set (lua_State *L)
     }
 }
 
+/*
+ * Arguments: odr_udata, table of paths {"name.name...", ...}
+ * Returns: projection_udata
+ *          nil, errcode, path
+ */
+static int
+lodr_projection (lua_State *L)
+{
+    p_mmodr mo = lua_touserdata (L, 1); /* ODRHANDLE */
+    const int n = ber_proj_size (mo);
+    p_proj pr;
+    int i;
+
+    luaL_checktype (L, 2, LUA_TTABLE);
+    pr = lua_newuserdata (L, sizeof (struct proj) + n);
+    luaL_getmetatable (L, PROJHANDLE);
+    lua_setmetatable (L, -2);
+    pr->odrs = mo->odrs;
+    memset (pr->marks, 0, n);
+    for (i = 1; ; ++i) {
+	const char *path;
+	lua_rawgeti (L, 2, i);
+	if (lua_isnil (L, -1)) break;
+	path = luaL_checkstring (L, -1);
+	if (ber_proj_path (mo, pr->marks, path)) {
+	    lua_pushnil (L);
+	    lua_pushinteger (L, BER_ERRPATH);
+	    lua_pushvalue (L, -3);
+	    return 3;
+	}
+	lua_pop (L, 1);
+    }
+    lua_pop (L, 1);
+    return 1;
+}
+
+/* Component of path at 2 (element of its SEQUENCE OF, if 4 is true)
+ * for value at 3 or NULL
+ */
+static struct tmt *
+lodr_path_arg (lua_State *L, p_mmodr mo)
+{
+    struct tmt *t = ber_path_find (mo, luaL_checkstring (L, 2));
+
+    if (lua_isnoneornil (L, 3))
+	luaL_argerror (L, 3, "value expected");
+    if (t && lua_toboolean (L, 4))
+	t = (t->opt & TAG_TYPE_OF) ? mo->odrs + t->subaddr : NULL;
+    return t;
+}
+
+/*
+ * Arguments: odr_udata, path ("name.name..."), value,
+ *	[element (boolean): value is element of SEQUENCE OF of path]
+ * Returns: raw_udata (TLV of value as component of path)
+ *          nil, errcode
+ */
+static int
+lodr_preencode (lua_State *L)
+{
+    p_mmodr mo = lua_touserdata (L, 1); /* ODRHANDLE */
+    struct tmt *t = lodr_path_arg (L, mo);
+    unsigned char buffer[BUF_SIZ];
+    struct bers bs;
+    jmp_buf jb;
+    int res;
+
+    if (!t) {
+	lua_pushnil (L);
+	lua_pushinteger (L, BER_ERRPATH);
+	return 2;
+    }
+    lua_settop (L, 3);
+    memset (&bs, 0, sizeof (struct bers));
+    bs.odr = mo;
+    bs.start = t;
+    bs.vis = &luaber_visitor;
+    bs.ud = lua_newthread (L); /* 4: values */
+    /* {[comp_no] = value} and its copy for sizing pass */
+    lua_createtable (L, 0, 1);
+    lua_pushvalue (L, 3);
+    lua_rawseti (L, -2, t->comp_no);
+    lua_pushvalue (L, -1);
+    lua_xmove (L, BERS_L(&bs), 2);
+
+    bs.jb = &jb;
+    bs.bp = bs.buf = buffer;
+    bs.endp = buffer + BUF_SIZ;
+    res = setjmp (jb);
+    if (!res) {
+	p_raw r = lraw_push (L, ber_encode_size (&bs)); /* 5 */
+	bs.bp = bs.buf = RAW_OCTETS(r);
+	bs.endp = bs.buf + r->len + sizeof (tag_id_t);
+	res = ber_encode (&bs);
+	r->len = bs.bp - bs.buf;
+    }
+    ber_free (&bs);
+    if (!res) return 1;
+    lua_pushnil (L);
+    lua_pushinteger (L, res);
+    return 2;
+}
+
+/* Reallocate buffer to have room of size octets */
+static int
+ltpl_room (unsigned char **buf, size_t *bsize, const size_t size)
+{
+    unsigned char *p;
+    size_t n = (*bsize) ? *bsize : BUF_SIZ;
+
+    if (size <= *bsize) return 1;
+    while (n < size) n *= 2;
+    if (!(p = realloc (*buf, n))) return 0;
+    *buf = p;
+    *bsize = n;
+    return 1;
+}
+
+/* Add hole on top of thread (called from ber_encode) */
+static void
+ltpl_hole (struct bers *bs, const struct tmt *t, int level)
+{
+    p_ltpl lt = (p_ltpl) bs;
+    struct ber_tpl_hole *h;
+
+    if (bs->sizes_mode != BER_SIZES_PUT) return; /* sizing pass */
+    h = ber_tpl_add (&lt->tpl, t, bs->bp - bs->buf, level);
+    if (!h) longjmp (*bs->jb, BER_ERRMEM);
+    h->ud = lhole_test (BERS_L(bs), -1);
+}
+
+/*
+ * Arguments: odr_udata, path ("name.name..."), value (with holes),
+ *	[element (boolean): value is element of SEQUENCE OF of path]
+ * Returns: tpl_udata
+ *          nil, errcode
+ */
+static int
+lodr_template (lua_State *L)
+{
+    p_mmodr mo = lua_touserdata (L, 1); /* ODRHANDLE */
+    struct tmt *t = lodr_path_arg (L, mo);
+    unsigned char buffer[BUF_SIZ];
+    p_ltpl lt;
+    p_bers bs;
+    lua_State *vs;
+    jmp_buf jb;
+    int i, res;
+
+    if (!t) {
+	lua_pushnil (L);
+	lua_pushinteger (L, BER_ERRPATH);
+	return 2;
+    }
+    lua_settop (L, 4);
+    lt = lua_newuserdata (L, sizeof (struct ltpl)); /* 5 */
+    memset (lt, 0, sizeof (struct ltpl));
+    luaL_getmetatable (L, TPLHANDLE);
+    lua_setmetatable (L, -2);
+    lua_newtable (L); /* 6: uservalue */
+    lua_pushvalue (L, 1);
+    lua_setfield (L, 6, "odr");
+    vs = lua_newthread (L);
+    lua_rawseti (L, 6, 0);
+    lua_pushvalue (L, 6);
+    lua_setuservalue (L, 5);
+
+    bs = &lt->bs;
+    bs->odr = mo;
+    bs->start = t;
+    bs->vis = &luaber_visitor;
+    bs->ud = vs;
+    /* {[comp_no] = value}, kept for rendering, and its copies */
+    lua_createtable (L, 0, 1);
+    lua_pushvalue (L, 3);
+    lua_rawseti (L, -2, t->comp_no);
+    lua_pushvalue (L, -1);
+    lua_pushvalue (L, -1);
+    lua_xmove (L, vs, 3);
+
+    bs->jb = &jb;
+    bs->bp = bs->buf = buffer;
+    bs->endp = buffer + BUF_SIZ;
+    bs->hole = ltpl_hole;
+    res = setjmp (jb);
+    if (!res) {
+	const size_t size = ber_encode_size (bs) + sizeof (tag_id_t);
+	if (!ltpl_room (&lt->obuf, &lt->osize, size))
+	    longjmp (jb, BER_ERRMEM);
+	bs->bp = bs->buf = lt->obuf;
+	bs->endp = lt->obuf + size;
+	res = ber_encode (bs);
+	if (!res)
+	    res = ber_tpl_compile (&lt->tpl, lt->obuf, bs->bp - lt->obuf);
+    }
+    bs->hole = NULL;
+    bs->top = NULL;
+    bs->sizes_mode = 0;
+    lua_settop (vs, 1);
+    lua_pushnil (vs);
+    lua_rawseti (vs, 1, t->comp_no);
+    if (res) {
+	lua_pushnil (L);
+	lua_pushinteger (L, res);
+	return 2;
+    }
+    /* names of holes */
+    for (i = 0; i < lt->tpl.nholes; ++i) {
+	const p_hole h = (p_hole) lt->tpl.holes[i].ud;
+	lua_pushlstring (L, HOLE_NAME(h), h->len);
+	lua_rawseti (L, 6, i + 1);
+    }
+    lua_settop (L, 5);
+    return 1;
+}
+
+/*
+ * Arguments: tpl_udata, table of values of holes {name => value}
+ * Returns: string
+ *          nil, errcode
+ */
+static int
+ltpl_render (lua_State *L)
+{
+    p_ltpl lt = luaL_checkudata (L, 1, TPLHANDLE);
+    struct ber_tpl *tp = &lt->tpl;
+    p_bers bs = &lt->bs;
+    lua_State *vs = BERS_L(bs);
+    unsigned char buffer[BUF_SIZ];
+    jmp_buf jb;
+    int res;
+
+    if (!tp->octets) luaL_argerror (L, 1, "freed template");
+    luaL_checktype (L, 2, LUA_TTABLE);
+    lua_settop (L, 2);
+    lua_getuservalue (L, 1); /* 3: names */
+
+    bs->jb = &jb;
+    res = setjmp (jb);
+    if (!res) {
+	size_t used = 0, size;
+	int i;
+	/* TLVs of holes one after another */
+	for (i = 0; i < tp->nholes; ++i) {
+	    struct ber_tpl_hole *h = tp->holes + i;
+	    const int no = h->t->comp_no;
+
+	    h->len = 0;
+	    lua_rawgeti (L, 3, i + 1);
+	    lua_rawget (L, 2);
+	    if (lua_isnil (L, -1)) {
+		lua_pop (L, 1); /* absent */
+		continue;
+	    }
+	    lua_xmove (L, vs, 1);
+	    lua_rawseti (vs, 1, no);
+	    lua_pushvalue (vs, 1);
+	    lua_pushvalue (vs, 1);
+	    bs->start = (struct tmt *) h->t;
+	    bs->bp = bs->buf = buffer;
+	    bs->endp = buffer + BUF_SIZ;
+	    size = ber_encode_size (bs) + sizeof (tag_id_t);
+	    if (!ltpl_room (&lt->hbuf, &lt->hsize, used + size))
+		longjmp (jb, BER_ERRMEM);
+	    bs->bp = bs->buf = lt->hbuf + used;
+	    bs->endp = bs->buf + size;
+	    ber_encode (bs);
+	    h->len = bs->bp - bs->buf;
+	    used += h->len;
+	    lua_pushnil (vs);
+	    lua_rawseti (vs, 1, no);
+	}
+	for (i = 0, used = 0; i < tp->nholes; ++i) {
+	    tp->holes[i].p = lt->hbuf + used;
+	    used += tp->holes[i].len;
+	}
+	size = ber_tpl_size (tp);
+	if (!ltpl_room (&lt->obuf, &lt->osize, size))
+	    longjmp (jb, BER_ERRMEM);
+	lua_pushlstring (L, (char *) lt->obuf,
+	 ber_tpl_put (tp, lt->obuf) - lt->obuf);
+	return 1;
+    }
+    /* new table of values */
+    bs->top = NULL;
+    bs->sizes_mode = 0;
+    lua_settop (vs, 0);
+    lua_newtable (vs);
+    lua_pushnil (L);
+    lua_pushinteger (L, res);
+    return 2;
+}
+
+/*
+ * Arguments: tpl_udata
+ */
+static int
+ltpl_gc (lua_State *L)
+{
+    p_ltpl lt = lua_touserdata (L, 1);
+
+    ber_free (&lt->bs);
+    ber_tpl_free (&lt->tpl);
+    free (lt->hbuf);
+    free (lt->obuf);
+    lt->hbuf = lt->obuf = NULL;
+    lt->hsize = lt->osize = 0;
+    return 0;
+}
+
 /*
  * Arguments: odr_udata
  * Returns: table {name => oid}
@@ -232,19 +2477,115 @@ lber_strerror (lua_State *L)
     return 1;
 }
 
+/*
+ * Arguments: string, [init (number), limit (number)]
+ * Returns: length of PDU at init (number)
+ *          false, count of octets needed at least (number)
+ *          nil, errcode
+ */
+static int
+lber_frame (lua_State *L)
+{
+    size_t str_len;
+    const char *str = luaL_checklstring (L, 1, &str_len);
+    size_t init = luaL_optinteger (L, 2, 1);
+    const int limit = luaL_optinteger (L, 3, 0);
+    int res, need = 0;
+
+    if (init < 1 || init > str_len + 1)
+	luaL_argerror (L, 2, "initial position out of string");
+    if (limit < 0) luaL_argerror (L, 3, "negative limit");
+    res = ber_frame ((const unsigned char *) str + init - 1,
+     (const unsigned char *) str + str_len, limit, &need);
+    if (res > 0) {
+	lua_pushinteger (L, res);
+	return 1;
+    }
+    if (res) lua_pushnil (L);
+    else lua_pushboolean (L, 0);
+    lua_pushinteger (L, res ? res : need);
+    return 2;
+}
+
 
 static luaL_Reg odrmeth[] = {
     {"set",		lodr_set},
     {"ber",		lber_ber},
     {"names",		lodr_names},
     {"oid2name",	lodr_oid2name},
+    {"projection",	lodr_projection},
+    {"preencode",	lodr_preencode},
+    {"template",	lodr_template},
     {NULL, NULL}
 };
 
 static luaL_Reg bermeth[] = {
     {"clear",		lber_clear},
     {"decode",		lber_decode},
+    {"decode_all",	lber_decode_all},
+    {"decode_lazy",	lber_decode_lazy},
+    {"decode_tree",	lber_decode_tree},
+    {"walk",		lber_walk},
     {"encode",  	lber_encode},
+    {"encode_all",	lber_encode_all},
+    {"encoded_size",	lber_encoded_size},
+    {"encode_iov",	lber_encode_iov},
+    {"encode_to_fd",	lber_encode_to_fd},
+    {"encode_into",	lber_encode_into},
+    {"maxdepth",	lber_maxdepth},
+    {"slices",		lber_slices},
+    {"segments",	lber_segments},
+    {"sink",		lber_sink},
+    {NULL, NULL}
+};
+
+static luaL_Reg lazymeth[] = {
+    {"__index",		llazy_index},
+    {"__len",		llazy_len},
+    {"__pairs",		llazy_pairs},
+    {NULL, NULL}
+};
+
+static luaL_Reg nodemeth[] = {
+    {"to_lua",		lnode_to_lua},
+    {"__index",		lnode_index},
+    {"__len",		lnode_len},
+    {"__pairs",		lnode_pairs},
+    {NULL, NULL}
+};
+
+static luaL_Reg arenameth[] = {
+    {"__gc",		larena_gc},
+    {NULL, NULL}
+};
+
+static luaL_Reg poolmeth[] = {
+    {"decode_batch",	lpool_decode_batch},
+    {"threads",		lpool_threads},
+    {NULL, NULL}
+};
+
+static luaL_Reg slicemeth[] = {
+    {"tostring",	lslice_tostring},
+    {"len",		lslice_len},
+    {"sub",		lslice_sub},
+    {"byte",		lslice_byte},
+    {"ptr",		lslice_ptr},
+    {"__tostring",	lslice_tostring},
+    {"__len",		lslice_len},
+    {NULL, NULL}
+};
+
+static luaL_Reg rawmeth[] = {
+    {"tostring",	lraw_tostring},
+    {"len",		lraw_len},
+    {"__tostring",	lraw_tostring},
+    {"__len",		lraw_len},
+    {NULL, NULL}
+};
+
+static luaL_Reg tplmeth[] = {
+    {"render",		ltpl_render},
     {NULL, NULL}
 };
 
@@ -255,6 +2596,10 @@ static luaL_Reg berlib[] = {
     {"num2bitstr",	num2bitstr},
     {"bitstr2num",	bitstr2num},
     {"strerror",	lber_strerror},
+    {"frame",		lber_frame},
+    {"pool",		lpool_new},
+    {"raw",		lraw_new},
+    {"hole",		lhole_new},
     {NULL, NULL}
 };
 
@@ -281,9 +2626,61 @@ createmeta (lua_State *L)
 
     luaL_newmetatable (L, BERHANDLE);
     lua_pushliteral (L, "__index");
+    lua_newtable (L);  /* methods without __gc */
+    register_functions (L, bermeth);
+    lua_rawset (L, -3);  /* metatable.__index = methods */
+    lua_pushcfunction (L, lber_gc);
+    lua_setfield (L, -2, "__gc");
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, LAZYHANDLE);
+    register_functions (L, lazymeth);
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, PROJHANDLE);
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, NODEHANDLE);
+    register_functions (L, nodemeth);
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, ARENAHANDLE);
+    register_functions (L, arenameth);
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, POOLHANDLE);
+    lua_pushliteral (L, "__index");
+    lua_newtable (L);  /* methods without __gc */
+    register_functions (L, poolmeth);
+    lua_rawset (L, -3);  /* metatable.__index = methods */
+    lua_pushcfunction (L, lpool_gc);
+    lua_setfield (L, -2, "__gc");
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, SLICEHANDLE);
+    lua_pushliteral (L, "__index");
     lua_pushvalue (L, -2);  /* push metatable */
     lua_rawset (L, -3);  /* metatable.__index = metatable */
-    register_functions (L, bermeth);
+    register_functions (L, slicemeth);
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, RAWHANDLE);
+    lua_pushliteral (L, "__index");
+    lua_pushvalue (L, -2);  /* push metatable */
+    lua_rawset (L, -3);  /* metatable.__index = metatable */
+    register_functions (L, rawmeth);
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, HOLEHANDLE);
+    lua_pop (L, 1);
+
+    luaL_newmetatable (L, TPLHANDLE);
+    lua_pushliteral (L, "__index");
+    lua_newtable (L);  /* methods without __gc */
+    register_functions (L, tplmeth);
+    lua_rawset (L, -3);  /* metatable.__index = methods */
+    lua_pushcfunction (L, ltpl_gc);
+    lua_setfield (L, -2, "__gc");
     lua_pop (L, 1);
 }
 
@@ -296,3 +2693,17 @@ luaopen_ber (lua_State *L)
     createmeta (L);
     return 1;
 }
+
+/* Open odr_udata set by compiled decoders (asn2odr -C):
+ * metatables registered by require "ber" are kept as they are */
+LUALIB_API int
+luaber_open_odr (lua_State *L, int (*set) (struct mmodr *mo))
+{
+    luaL_getmetatable (L, ODRHANDLE);
+    if (lua_isnil (L, -1)) createmeta (L);
+    lua_pop (L, 1);
+    lodr_new (L);
+    if (set (lua_touserdata (L, -1)))
+	return luaL_error (L, "bad compiled odr");
+    return 1;
+}
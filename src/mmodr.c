@@ -4,6 +4,7 @@
 
 #include "mmodr.h"
 
+/* Layout: odrs | [disps] | lists | modules | names */
 int
 mmodr_set (struct mmodr *mo, const void * const p, int len)
 {
@@ -12,9 +13,18 @@ mmodr_set (struct mmodr *mo, const void * const p, int len)
 
 	mo->odrs = (struct tmt *) info;
 	mo->start = mo->odrs + info->start;
-	mo->modules = (struct module_id *) (mo->odrs + info->nodrs);
+	if (info->ndisps) {
+	    mo->disps = (struct odr_disp *) (mo->odrs + info->nodrs);
+	    mo->lists = (struct odr_list *) (mo->disps + info->ndisps);
+	} else {
+	    mo->disps = NULL;
+	    mo->lists = (struct odr_list *) (mo->odrs + info->nodrs);
+	}
+	mo->modules = (struct module_id *) (mo->lists + info->nodrs);
 	mo->names = (char *) (mo->modules + info->nmodules);
 	mo->nmodules = (char) info->nmodules;
+	mo->decode = NULL;
+	mo->encode = NULL;
 
 	return
 	 !(len >= (mo->names - (char *) info) + (int) sizeof (ODR_NAME_STUB)
@@ -3,11 +3,20 @@
 
 #include "asn/odr.h"
 
+struct bers;
+
 struct mmodr {
     struct tmt *odrs, *start;
+    struct odr_disp *disps; /* NULL - without dispatch index */
+    struct odr_list *lists; /* tmt addr -> components list info */
     struct module_id *modules;
     char *names;
     unsigned char nmodules;
+    /* Compiled decoders of complete PDU (asn2odr -C; NULL - none) */
+    unsigned char (*decode) (struct bers *bs);
+    /* Compiled encoders of complete PDU with definite lengths
+     * to growing buffer (NULL - none) */
+    unsigned char (*encode) (struct bers *bs);
 };
 
 int mmodr_set (struct mmodr *mo, const void *info, int len);
@@ -0,0 +1,725 @@
+-- Checks of codec methods: results of one method on the PDUs of files
+-- must match ones of another, and results on a known PDU the expected
+-- values
+
+local ber = require "ber"
+
+local odrfile = arg[1]
+if not odrfile or not arg[2] then
+    io.stderr:write("Usage: ", arg[0], " ODR FILE ...\n")
+    os.exit(1)
+end
+
+local function readfile(file)
+    local f = assert(io.open(file, "rb"))
+    local s = f:read("*a")
+    f:close()
+    return s
+end
+
+local odrstr = readfile(odrfile)
+local odr = ber.odr()
+assert(odr:set(odrstr), "bad odr file")
+
+local nfail, nchecks = 0, 0
+
+local function check(ok, name, what)
+    nchecks = nchecks + 1
+    if not ok then
+	nfail = nfail + 1
+	print("FAIL", name, what)
+    end
+end
+
+-- Known PDU: initRequest with its mandatory components,
+-- implementationName and implementationVersion
+local INIT = "\131\2\0\224\132\3\0\233\162\133\3\16\0\0\134\3\16\0\0"
+local PDU = "\180\33" .. INIT .. "\159\111\3YAZ\159\112\0052.0.1"
+local INIT_VALUE = {[2] = "\224", [3] = "\233\162", [4] = 1048576,
+    [5] = 1048576}
+
+-- Copy of INIT_VALUE with the given components
+local function init(comps)
+    local t = {}
+    for k, v in pairs(INIT_VALUE) do t[k] = v end
+    for k, v in pairs(comps) do t[k] = v end
+    return t
+end
+
+local VALUE = {[1] = {[1] = init{[8] = "YAZ", [9] = "2.0.1"}}}
+
+-- Deep comparison of values (userdata by their string)
+local function same(a, b)
+    if type(a) == "userdata" then a = tostring(a) end
+    if type(b) == "userdata" then b = tostring(b) end
+    if type(a) ~= "table" or type(b) ~= "table" then return a == b end
+    for k, v in pairs(a) do
+	if not same(v, b[k]) then return false end
+    end
+    for k in pairs(b) do
+	if a[k] == nil then return false end
+    end
+    return true
+end
+
+-- Copy of PDU with value at key of its top component alt changed
+local function with(v, alt, key, x)
+    local k = next(v)
+    local c = {}
+    for i, y in pairs(v[k][alt]) do c[i] = y end
+    c[key] = x
+    return {[k] = {[alt] = c}}
+end
+
+-- Number and name of top component (alternative of the PDU) at init,
+-- with numbers, names and values of its primitive components (by
+-- ber:walk)
+local function top_comps(bc, s, init, v)
+    local alt, name, comps, depth = nil, nil, {}, 0
+    bc:walk(s, function(ev, nm, no, x)
+	if ev == "start" then
+	    depth = depth + 1
+	    if depth == 1 then alt, name = no, nm end
+	elseif ev == "end" then
+	    depth = depth - 1
+	elseif depth == 1 then
+	    comps[#comps + 1] = {no, nm, x}
+	end
+    end, init)
+    local t = v[next(v)][alt]
+    local ok = {}
+    for _, c in ipairs(comps) do
+	if t[c[1]] == c[3] then ok[#ok + 1] = c end
+    end
+    return alt, name, ok, t
+end
+
+-- PDUs of string with their positions
+local function pdus(bc, s)
+    local all = assert(bc:decode_all(s))
+    local inits, init = {}, 1
+    for i = 1, #all do
+	inits[i] = init
+	init = bc:decode(s, init)
+    end
+    return all, inits
+end
+
+-- Decoding of the known PDU
+local function decode_known(bc)
+    local tail, v = bc:decode(PDU)
+    check(tail == "" and same(v, VALUE), "known", "decode")
+    check(same(bc:decode_all(PDU .. PDU), {VALUE, VALUE}), "known",
+     "decode_all")
+end
+
+-- Tables of proxies (of decode_lazy and decode_tree) by __pairs
+local function tolua(v)
+    if type(v) ~= "userdata" and type(v) ~= "table" then return v end
+    local t = {}
+    for k, x in pairs(v) do t[k] = tolua(x) end
+    return t
+end
+
+-- Lazy proxies give the tables of decode
+local function lazy(bc, name, s)
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local tail, lv = bc:decode_lazy(s:sub(inits[i]))
+	check(tail == s:sub(inits[i + 1] or #s + 1) and same(tolua(lv), v),
+	 name, "decode_lazy of PDU " .. i)
+    end
+    -- proxies keep the depth limit of the codec
+    local old, d = bc:maxdepth(1), 1
+    while not bc:decode(s) do bc:clear(); d = d + 1; bc:maxdepth(d) end
+    local tail, lv = bc:decode_lazy(s)
+    check(tail and same(tolua(lv), all[1]), name, "decode_lazy at maxdepth")
+    if d > 1 then
+	bc:maxdepth(d - 1)
+	tail, lv = bc:decode_lazy(s)
+	check(not tail or not pcall(tolua, lv), name,
+	 "decode_lazy over maxdepth")
+	bc:clear()
+    end
+    bc:maxdepth(old)
+end
+
+local function lazy_known(bc)
+    local tail, lv = bc:decode_lazy(PDU .. "x")
+    check(tail == "x" and type(lv[1][1]) == "userdata"
+     and lv[1][1][8] == "YAZ" and lv[1][1][9] == "2.0.1"
+     and same(tolua(lv), VALUE), "known", "decode_lazy")
+    check(bc:decode_lazy(PDU:sub(1, 10)) == PDU:sub(1, 10), "known",
+     "decode_lazy of incomplete PDU")
+end
+
+-- Slices give the strings of decode and encode as them
+local function slices(bc, name, s)
+    local all = pdus(bc, s)
+    bc:slices(1)
+    local sl = bc:decode_all(s)
+    bc:slices(false)
+    for i, v in ipairs(all) do
+	check(same(sl[i], v) and bc:encode_all(sl[i]) == bc:encode_all(v),
+	 name, "slices of PDU " .. i)
+    end
+end
+
+local function slices_known(bc)
+    bc:slices(4)
+    local _, v = bc:decode(PDU)
+    bc:slices(false)
+    local sl, name = v[1][1][9], v[1][1][8]
+    check(type(sl) == "userdata" and name == "YAZ", "known", "slices")
+    check(tostring(sl) == "2.0.1" and sl:len() == 5 and #sl == 5
+     and sl:byte(1) == 50, "known", "slice")
+    check(tostring(sl:sub(2, 3)) == ".0" and tostring(sl:sub(-2)) == ".1"
+     and tostring(sl:sub(3)) == "0.1", "known", "slice:sub")
+    check(#sl:sub(6) == 0 and #sl:sub(9) == 0 and #sl:sub(9, 20) == 0
+     and #sl:sub(4, 2) == 0 and #sl:sub(-20, 0) == 0, "known",
+     "slice:sub out of slice")
+    check(bc:encode_all(v) == PDU, "known", "encode of slices")
+end
+
+-- Projection is kept by PDU split across calls
+local function split_projection(bc, name, s)
+    local pr = assert(odr:projection{"presentResponse.records",
+     "searchRequest.query", "initRequest"})
+    local full = bc:decode_all(s, 1, pr)
+    local ref = bc:encode_all(full[1])
+    for h = 1, #s - 1, math.max(1, math.floor(#s / 7)) do
+	local tail, v = bc:decode(s:sub(1, h), nil, pr)
+	check(type(tail) == "string" and v == nil, name, "incomplete at " .. h)
+	tail = tail .. s:sub(h + 1)
+	check(not pcall(bc.decode, bc, tail), name,
+	 "projection dropped at " .. h)
+	check(not pcall(bc.decode, bc, tail, nil,
+	 odr:projection{"initRequest"}), name, "projection changed at " .. h)
+	tail, v = bc:decode(tail, nil, pr)
+	check(type(v) == "table" and bc:encode_all(v) == ref, name,
+	 "split at " .. h)
+    end
+end
+
+-- Projections of each component give its value of decode
+local function projection(bc, name, s)
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local alt, top, comps = top_comps(bc, s, inits[i], v)
+	for _, c in ipairs(comps) do
+	    local path = top .. "." .. c[2]
+	    local _, pv = bc:decode(s, inits[i], odr:projection{path})
+	    check(same(pv, {[next(v)] = {[alt] = {[c[1]] = c[3]}}}), name,
+	     "projection of " .. path)
+	end
+    end
+end
+
+local function projection_known(bc)
+    local pr = odr:projection{"initRequest.implementationName"}
+    local pos, v = bc:decode(PDU, 1, pr)
+    check(pos == #PDU + 1 and same(v, {[1] = {[1] = {[8] = "YAZ"}}}),
+     "known", "projection")
+    check(select(3, odr:projection{"initRequest.noSuchName"})
+     == "initRequest.noSuchName", "known", "projection of bad path")
+end
+
+-- Trees of nodes give the tables of decode
+local function tree(bc, name, s)
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local root, pos = bc:decode_tree(s, inits[i])
+	check(root and pos == (inits[i + 1] or #s + 1)
+	 and same(root:to_lua(), v) and same(tolua(root), v), name,
+	 "decode_tree of PDU " .. i)
+    end
+end
+
+local function tree_known(bc)
+    local root, pos = bc:decode_tree(PDU .. PDU, #PDU + 1)
+    check(pos == 2 * #PDU + 1 and root[1][1][8] == "YAZ"
+     and #root[1][1] == 9 and same(root:to_lua(), VALUE), "known",
+     "decode_tree")
+    local f, need = bc:decode_tree(PDU:sub(1, 4))
+    check(f == false and need == #PDU - 4, "known",
+     "decode_tree of incomplete PDU")
+    -- segments of a constructed string outgrow the first arena
+    local long = "\180\128" .. INIT .. "\191\111\128" .. ("\4\1x"):rep(100)
+     .. "\0\0\159\112\0052.0.1\0\0"
+    root = bc:decode_tree(long)
+    check(root and same(root:to_lua(), with(VALUE, 1, 8, ("x"):rep(100))),
+     "known", "decode_tree of grown arena")
+end
+
+-- Pools of threads give the tables of decode, as tables and as proxies
+local function pool(bc, name, s)
+    local all, inits = pdus(bc, s)
+    local strs = {}
+    for i = 1, #all do
+	strs[i] = s:sub(inits[i], (inits[i + 1] or #s + 1) - 1)
+    end
+    local pl = ber.pool(4)
+    local vs, ps = pl:decode_batch(odr, strs), pl:decode_batch(odr, strs, true)
+    for i, v in ipairs(all) do
+	check(same(vs[i], v) and same(tolua(ps[i]), v), name,
+	 "decode_batch of PDU " .. i)
+    end
+end
+
+-- Unused bits of BIT STRING are masked in the values, not in the source
+local function pool_known(bc)
+    local pdu = "\180\33\131\2\5\231" .. PDU:sub(7)
+    local value = with(VALUE, 1, 2, "\7")
+    local pl = ber.pool(2)
+    local vs = pl:decode_batch(odr, {pdu, PDU})
+    check(same(vs, {value, VALUE}), "known", "decode_batch")
+    check(same(tolua(pl:decode_batch(odr, {pdu}, true)[1]), value), "known",
+     "decode_batch of proxies")
+    check(same(select(2, bc:decode(pdu)), value)
+     and same(bc:decode_tree(pdu):to_lua(), value), "known",
+     "masked BIT STRING")
+    bc:slices(1)
+    check(same(select(2, bc:decode(pdu)), value), "known",
+     "masked BIT STRING of slices")
+    bc:slices(false)
+    check(pdu:byte(6) == 231, "known", "source of masked BIT STRING")
+end
+
+-- Pools split SEQUENCE OF's (when two of their threads run at once)
+-- into the tables of decode
+local function pool_split(bc, name, s)
+    local all = pdus(bc, s)
+    local vs = ber.pool(4):decode_batch(odr, {s}, false, 16)
+    check(same(vs[1], all[1]), name, "decode_batch split")
+end
+
+-- Frames of PDUs at their positions, false for their prefixes
+local function frame(bc, name, s)
+    local _, inits = pdus(bc, s)
+    for i, init in ipairs(inits) do
+	local len = (inits[i + 1] or #s + 1) - init
+	check(ber.frame(s, init) == len, name, "frame of PDU " .. i)
+	local pdu = s:sub(init, init + len - 1)
+	for h = 1, len - 1, math.max(1, math.floor(len / 7)) do
+	    local f, need = ber.frame(pdu:sub(1, h))
+	    check(f == false and need > 0, name,
+	     "frame of PDU " .. i .. " prefix " .. h)
+	end
+	check(not ber.frame(s, init, len - 1), name,
+	 "frame limit of PDU " .. i)
+    end
+end
+
+local function frame_known()
+    check(ber.frame(PDU) == 35 and ber.frame(PDU .. PDU, 36) == 35,
+     "known", "frame")
+    local f, need = ber.frame(PDU:sub(1, 10))
+    check(f == false and need == 25, "known", "frame of incomplete PDU")
+    f, need = ber.frame("\180\128\159\111\3YAZ\0")
+    check(f == false and need >= 1, "known",
+     "frame of incomplete indefinite PDU")
+    check(ber.frame("\180\128\159\111\3YAZ\0\0") == 10, "known",
+     "frame of indefinite PDU")
+    f, need = ber.frame(PDU, 1, 34)
+    check(f == nil and ber.strerror(need) ~= nil, "known", "frame limit")
+end
+
+-- Walk events are balanced and give the leaves of decode
+local function walk(bc, name, s)
+    local function leaves(v, t)
+	for _, x in pairs(v) do
+	    if type(x) == "table" then leaves(x, t) else t[#t + 1] = x end
+	end
+	return t
+    end
+    local function sorted(t)
+	for i, x in ipairs(t) do t[i] = type(x) .. ":" .. tostring(x) end
+	table.sort(t)
+	return table.concat(t, "\0")
+    end
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local t, stack, str = {}, {}, nil
+	local pos = bc:walk(s, function(ev, nm, no, x)
+	    if ev == "start" then
+		stack[#stack + 1] = nm
+		str = nil
+	    elseif ev == "end" then
+		stack[#stack] = nil
+		str = nil
+	    elseif str and stack[#stack] == nm then
+		t[#t] = t[#t] .. x -- segment of constructed string
+	    else
+		t[#t + 1] = x
+		str = type(x) == "string" and stack[#stack] == nm or nil
+	    end
+	end, inits[i])
+	check(pos == (inits[i + 1] or #s + 1) and #stack == 0, name,
+	 "walk of PDU " .. i)
+	check(sorted(t) == sorted(leaves(v, {})), name,
+	 "walk values of PDU " .. i)
+    end
+end
+
+local function walk_known(bc)
+    local events = {}
+    local pos = bc:walk(PDU, function(ev, nm, no, x, first, last)
+	if no >= 8 or ev ~= "value" then
+	    events[#events + 1] = table.concat({ev, nm, no, tostring(x),
+	     tostring(first), tostring(last)}, " ")
+	end
+    end)
+    check(pos == #PDU + 1 and table.concat(events, ", ")
+     == "start initRequest 1 nil 3 35, "
+     .. "value implementationName 8 YAZ 25 27, "
+     .. "value implementationVersion 9 2.0.1 31 35, "
+     .. "end initRequest 1 nil nil nil", "known", "walk")
+    local n = 0
+    local ok, err = bc:walk(PDU, function() n = n + 1; return false end)
+    check(n == 1 and not ok and ber.strerror(err), "known", "walk stop")
+end
+
+-- Whole PDUs decode back to their values, and so do chunks
+local function encode_all(bc, name, s)
+    for i, v in ipairs(pdus(bc, s)) do
+	local e = bc:encode_all(v)
+	check(type(e) == "string" and same(bc:decode_all(e)[1], v), name,
+	 "encode_all of PDU " .. i)
+	local chunks, c, done = {}
+	repeat
+	    c, done = bc:encode(v)
+	    chunks[#chunks + 1] = c
+	until not c or done
+	check(c and same(bc:decode_all(table.concat(chunks))[1], v), name,
+	 "encode of PDU " .. i)
+    end
+end
+
+local function encode_all_known(bc)
+    check(bc:encode_all(VALUE) == PDU, "known", "encode_all")
+    local long = string.rep("x", 300)
+    local e = bc:encode_all{[1] = {[1] = init{[8] = long}}}
+    check(e == "\180\130\1\68" .. INIT .. "\159\111\130\1\44" .. long,
+     "known", "encode_all of long lengths")
+    check(bc:encode_all(VALUE) == PDU, "known", "encode_all again")
+end
+
+-- Sizes and chunks of definite lengths match whole PDUs
+local function encoded_size(bc, name, s)
+    for i, v in ipairs(pdus(bc, s)) do
+	local e = bc:encode_all(v)
+	check(bc:encoded_size(v) == #e, name, "encoded_size of PDU " .. i)
+	local chunks, c, done = {}
+	repeat
+	    c, done = bc:encode(v, true)
+	    chunks[#chunks + 1] = c
+	until not c or done
+	check(c and table.concat(chunks) == e, name,
+	 "encode definite of PDU " .. i)
+    end
+end
+
+local function encoded_size_known(bc)
+    check(bc:encoded_size(VALUE) == #PDU, "known", "encoded_size")
+    local long = {[1] = {[1] = init{[8] = string.rep("x", 300)}}}
+    check(bc:encoded_size(long) == 4 + #INIT + 5 + 300, "known",
+     "encoded_size of long lengths")
+    check(bc:encode(VALUE, true) == PDU, "known", "encode definite")
+end
+
+-- Gathered parts put the octets of whole PDUs
+local function encode_iov(bc, name, s)
+    for i, v in ipairs(pdus(bc, s)) do
+	local c = {}
+	for j, x in ipairs(bc:encode_iov(v, 1)) do c[j] = tostring(x) end
+	check(table.concat(c) == bc:encode_all(v), name,
+	 "encode_iov of PDU " .. i)
+    end
+end
+
+local function encode_iov_known(bc)
+    local iov = bc:encode_iov(VALUE, 3)
+    check(#iov == 4 and iov[1] == "\180\33" .. INIT .. "\159\111\3"
+     and iov[2] == "YAZ" and iov[3] == "\159\112\5" and iov[4] == "2.0.1",
+     "known", "encode_iov")
+    bc:slices(1)
+    local _, v = bc:decode(PDU)
+    bc:slices(false)
+    iov = bc:encode_iov(v, 4)
+    check(#iov == 2 and type(iov[2]) == "userdata" and #iov[2] == 5
+     and tostring(iov[2]) == "2.0.1", "known",
+     "encode_iov of slices")
+    iov = bc:encode_iov({[1] = ber.raw(PDU)}, 4)
+    check(#iov == 2 and iov[1] == "" and type(iov[2]) == "userdata"
+     and #iov[2] == #PDU and tostring(iov[2]) == PDU, "known",
+     "encode_iov of raw PDU")
+end
+
+-- Sink chunks put the octets of whole PDUs
+local function encode_into(bc, name, s)
+    for i, v in ipairs(pdus(bc, s)) do
+	for _, definite in ipairs{true, false} do
+	    local chunks = {}
+	    local n = bc:encode_into(function(x) chunks[#chunks + 1] = x end,
+	     v, definite)
+	    local c = table.concat(chunks)
+	    check(n == #c and (c == bc:encode_all(v) or not definite)
+	     and same(bc:decode_all(c)[1], v), name,
+	     "encode_into of PDU " .. i .. (definite and " definite" or ""))
+	end
+    end
+end
+
+local function encode_into_known(bc)
+    local chunks = {}
+    local n = bc:encode_into(function(x) chunks[#chunks + 1] = x end,
+     VALUE, true)
+    check(n == #PDU and table.concat(chunks) == PDU, "known", "encode_into")
+    local ok, err = bc:encode_into(function() return false end, VALUE)
+    check(ok == nil and err and bc:encode_all(VALUE) == PDU, "known",
+     "encode_into stopped")
+end
+
+-- Pre-encoded values encode as their values
+local function raw(bc, name, s)
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local e = bc:encode_all(v)
+	local alt, top, comps, t = top_comps(bc, s, inits[i], v)
+	check(bc:encode_all{[next(v)] = ber.raw(e)} == e, name,
+	 "raw PDU " .. i)
+	local pe = odr:preencode(top, t)
+	check(pe and tostring(pe) == e and #pe == #e, name,
+	 "preencode of PDU " .. i)
+	for _, c in ipairs(comps) do
+	    local path = top .. "." .. c[2]
+	    pe = odr:preencode(path, c[3])
+	    check(pe and bc:encode_all(with(v, alt, c[1], pe)) == e, name,
+	     "preencode of " .. path)
+	end
+    end
+end
+
+local function raw_known(bc)
+    local pe = odr:preencode("initRequest.implementationName", "YAZ")
+    check(tostring(pe) == "\159\111\3YAZ" and pe:len() == 6, "known",
+     "preencode")
+    check(bc:encode_all{[1] = {[1] = init{[8] = pe, [9] = "2.0.1"}}}
+     == PDU, "known", "encode of preencoded value")
+    check(bc:encode_all{[1] = ber.raw(PDU)} == PDU, "known", "raw PDU")
+    check(not bc:encode_all{[1] = {[1] = init{[9] = pe}}}, "known",
+     "preencoded value of other tag")
+    check(not ber.raw(PDU:sub(1, 10)), "known", "raw of incomplete TLV")
+end
+
+-- Templates render as encode of their values
+local function template(bc, name, s)
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local e = bc:encode_all(v)
+	local alt, top, comps = top_comps(bc, s, inits[i], v)
+	for _, c in ipairs(comps) do
+	    local path = top .. "." .. c[2]
+	    local w = with(v, alt, c[1], ber.hole"x")
+	    local tpl = odr:template(top, w[next(w)][alt])
+	    check(tpl and tpl:render{x = c[3]} == e, name,
+	     "template of " .. path)
+	    check(tpl and tpl:render{}
+	     == bc:encode_all(with(v, alt, c[1], nil)), name,
+	     "template without " .. path)
+	end
+    end
+end
+
+local function template_known(bc)
+    local tpl = odr:template("initRequest",
+     init{[8] = ber.hole"name", [9] = "2.0.1"})
+    check(tpl:render{name = "YAZ"} == PDU, "known", "template")
+    check(tpl:render{} == "\180\27" .. INIT .. "\159\112\0052.0.1",
+     "known", "template without hole")
+    local long = string.rep("x", 300)
+    check(tpl:render{name = long} == "\180\130\1\76" .. INIT
+     .. "\159\111\130\1\44" .. long .. "\159\112\0052.0.1", "known",
+     "template of long lengths")
+    check(not bc:encode_all{[1] = {[1] = init{[8] = ber.hole"name"}}},
+     "known", "hole out of template")
+end
+
+-- Absent and extra components: sparse tables encode as their values
+local function sparse(bc, name, s)
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local alt, _, _, t = top_comps(bc, s, inits[i], v)
+	for key in pairs(t) do
+	    local w = with(v, alt, key, nil)
+	    local e = bc:encode_all(w)
+	    -- decoding fails without mandatory components
+	    local r = e and bc:decode_all(e)
+	    if not r then bc:clear() end
+	    check(e and (not r or same(r[1], w)), name,
+	     "PDU " .. i .. " without " .. key)
+	end
+	check(bc:encode_all(with(v, alt, "extra", "x"))
+	 == bc:encode_all(v), name, "PDU " .. i .. " with extra key")
+    end
+end
+
+local function sparse_known(bc)
+    local t = init{[8] = "YAZ", [9] = "2.0.1", extra = "x", [0] = "y",
+     [2.5] = "z"}
+    check(bc:encode_all{[1] = {[1] = t}} == PDU, "known",
+     "sparse table with extra keys")
+    check(bc:encode_all{[1] = {[1] = init{[9] = "2.0.1"}}}
+     == "\180\27" .. INIT .. "\159\112\0052.0.1", "known",
+     "sparse table")
+end
+
+-- Readers of strings stream their octets
+local function reader(bc, name, s)
+    local all, inits = pdus(bc, s)
+    for i, v in ipairs(all) do
+	local alt, _, comps = top_comps(bc, s, inits[i], v)
+	for _, c in ipairs(comps) do
+	    if type(c[3]) == "string" then
+		local p = 1
+		local w = with(v, alt, c[1], function(n)
+		    n = math.min(n, 3)
+		    p = p + n
+		    return c[3]:sub(p - n, p - 1)
+		end)
+		local chunks, x, done = {}
+		repeat
+		    x, done = bc:encode(w)
+		    chunks[#chunks + 1] = x
+		until not x or done
+		-- strings of other types than OCTET STRING fail
+		check(not x or same(bc:decode_all(table.concat(chunks))[1], v),
+		 name, "reader of PDU " .. i .. " for " .. c[2])
+		p = 1
+		check(not bc:encode_all(w), name,
+		 "definite reader of PDU " .. i .. " for " .. c[2])
+	    end
+	end
+    end
+end
+
+local function reader_known(bc)
+    local parts = {"ab", "c"}
+    local v = {[1] = {[1] = init{[1] = function()
+	return table.remove(parts, 1)
+    end}}}
+    check(bc:encode(v) == "\180\28\162\128\4\3abc\0\0" .. INIT, "known",
+     "reader")
+    check(not bc:encode_all(v), "known", "reader of definite lengths")
+    v[1][1][1] = function() error "bad reader" end
+    local ok, err = bc:encode(v)
+    check(ok == nil and ber.strerror(err), "known", "failing reader")
+    v[1][1][1] = nil
+    v[1][1][3] = function() return nil end
+    check(not bc:encode(v), "known", "reader of BIT STRING")
+end
+
+-- Sinks get the strings replaced by their lengths
+local function sink(bc, name, s)
+    local all = pdus(bc, s)
+    local chunks = {}
+    assert(bc:sink(function(x) chunks[#chunks + 1] = x end, 1))
+    local sunk = bc:decode_all(s)
+    bc:sink(false)
+    local n = 0
+    local function cmp(a, b)
+	if type(a) == "table" and type(b) == "table" then
+	    for key, x in pairs(b) do
+		if not cmp(a[key], x) then return false end
+	    end
+	    return true
+	elseif type(a) == "number" and type(b) == "string" then
+	    n = n + #b
+	    return a == #b
+	end
+	return a == b
+    end
+    for i, v in ipairs(all) do
+	check(cmp(sunk[i], v), name, "sink of PDU " .. i)
+    end
+    check(#table.concat(chunks) == n, name, "sink octets")
+end
+
+local function sink_known(bc)
+    local s = "\180\24\130\3abc" .. INIT
+    local chunks = {}
+    assert(bc:sink(function(x) chunks[#chunks + 1] = x end, 3))
+    local _, v = bc:decode(s)
+    check(v[1][1][1] == 3 and table.concat(chunks) == "abc"
+     and v[1][1][2] == "\224", "known", "sink")
+    chunks = {}
+    _, v = bc:decode("\180\23\130\2ab" .. INIT)
+    check(v[1][1][1] == "ab" and #chunks == 0, "known",
+     "sink of short string")
+    assert(bc:sink(function() return false end, 1))
+    local ok, err = bc:decode(s)
+    check(ok == nil and ber.strerror(err), "known", "failing sink")
+    bc:clear()
+    bc:sink(false)
+    _, v = bc:decode(s)
+    check(v[1][1][1] == "abc", "known", "sink off")
+end
+
+local checks = {
+    split_projection,
+    projection,
+    lazy,
+    slices,
+    tree,
+    pool,
+    pool_split,
+    frame,
+    walk,
+    encode_all,
+    encoded_size,
+    encode_iov,
+    encode_into,
+    raw,
+    template,
+    sparse,
+    reader,
+    sink,
+}
+
+local known = {
+    decode_known,
+    projection_known,
+    lazy_known,
+    slices_known,
+    tree_known,
+    pool_known,
+    frame_known,
+    walk_known,
+    encode_all_known,
+    encoded_size_known,
+    encode_iov_known,
+    encode_into_known,
+    raw_known,
+    template_known,
+    sparse_known,
+    reader_known,
+    sink_known,
+}
+
+for _, f in ipairs(known) do
+    f(odr:ber())
+end
+
+for i = 2, #arg do
+    local s = readfile(arg[i])
+    for _, f in ipairs(checks) do
+	local bc = odr:ber()
+	f(bc, arg[i], s)
+    end
+end
+
+if nfail > 0 then
+    print(nfail .. " of " .. nchecks .. " checks failed")
+    os.exit(1)
+end
+print("api: " .. nchecks .. " checks passed")
@@ -0,0 +1,523 @@
+/* Benchmark BER decoding */
+
+#include <time.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "ber.h"
+#include "ber_pool.h"
+#include "ber_tree.h"
+#include "ber_typed.h"
+#include "luaber.h"
+
+#define BENCH_LOOPS	10000
+#define BENCH_ARENA	65536	/* octets of arena of typed structs */
+#define BENCH_VALUES	4096	/* stack of kinds of C visitor */
+#define BENCH_BATCH	256	/* copies of each file in batch of pool */
+#define BENCH_SPLIT	64	/* octets of SEQUENCE OF split by pool */
+
+static lua_State *L;
+static struct mmodr odr;
+static long allocs; /* (re)allocations by Lua */
+
+static const char usage[] = "Usage: %s {-f FILE | -c} [-t] [-v] [-p NUM] [-n NUM] [-s NUM] FILE ...\n"
+    "\t-f - odr file\n"
+    "\t-c - compiled decoders of test ASN.1 (asn2odr -C)\n"
+    "\t-t - typed structs of test ASN.1 too (asn2odr -T)\n"
+    "\t-v - C visitors of kinds of values and of tree too, without Lua\n"
+    "\t-p - batches of all files by pools of 1, 2, 4 ... NUM threads,\n"
+    "\t     and files with SEQUENCE OF's split by them\n"
+    "\t-n - decode loops per file\n"
+    "\t-s - slice strings of at least NUM octets\n";
+static char *progname, *odrfile;
+static int loops = BENCH_LOOPS;
+static int slice_min = -1;
+static int compiled, typed, visited, threads;
+static unsigned char arena[BENCH_ARENA];
+static unsigned char kinds[BENCH_VALUES];
+static int nkinds;
+static long nvalues;
+
+/* test/z3950c.c */
+int z3950c_set (struct mmodr *mo);
+/* test/z3950t.c */
+struct z3950t_PDU;
+int z3950t_decode_PDU (struct ber_arena *a, const unsigned char *p,
+ const int len, struct z3950t_PDU **pv);
+
+static void
+err_quit (const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start (ap, fmt);
+    vfprintf (stderr, fmt, ap);
+    va_end (ap);
+    putc ('\n', stderr);
+    exit (EXIT_FAILURE);
+}
+
+/* Lua allocator, which counts (re)allocations */
+static void *
+bench_alloc (void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    (void) ud;
+    if (!nsize) {
+	free (ptr);
+	return NULL;
+    }
+    if (!ptr || nsize > osize) ++allocs;
+    return realloc (ptr, nsize);
+}
+
+static double
+now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Count TLV's up to endp or End Of Contents */
+static long
+tlv_count (unsigned char **pp, unsigned char *endp)
+{
+    unsigned char *p = *pp;
+    long n = 0;
+
+    while (p + 2 <= endp) {
+	unsigned int len = 0;
+	unsigned char c, cons;
+
+	if (!(p[0] | p[1])) {
+	    p += 2;
+	    break;
+	}
+	cons = *p & 0x20;
+	if ((*p++ & 0x1F) == 0x1F)
+	    while (*p++ & 0x80)
+		;
+	c = *p++;
+	if (c & 0x80)
+	    for (c &= 0x7F; c; --c)
+		len = (len << 8) | *p++;
+	else len = c;
+	++n;
+	if (!cons) p += len;
+	else if (!len && (p[-1] == 0x80))
+	    n += tlv_count (&p, endp);
+	else {
+	    unsigned char *q = p;
+	    n += tlv_count (&q, p + len);
+	    p += len;
+	}
+    }
+    *pp = p;
+    return n;
+}
+
+/* Slice of source octets: the pointer only */
+static void
+bench_slice (struct bers *bs, unsigned char *p, int len)
+{
+    (void) len;
+    lua_pushlightuserdata ((lua_State *) bs->ud, p);
+}
+
+
+/* <<========================================
+ * Visitor, which keeps kinds of values only: cost of the decoder itself
+ */
+
+static void
+kind_push (const int kind)
+{
+    kinds[nkinds++] = kind;
+    ++nvalues;
+}
+
+static int
+kvis_room (struct bers *bs)
+{
+    (void) bs;
+    return nkinds < BENCH_VALUES - 16;
+}
+
+static void
+kvis_begin (struct bers *bs, int narr, int nrec)
+{
+    (void) bs, (void) narr, (void) nrec;
+    kind_push (BER_VCONS);
+}
+
+static void
+kvis_mark (struct bers *bs)
+{
+    (void) bs;
+    kind_push (BER_VMARK);
+}
+
+static void
+kvis_str (struct bers *bs, const unsigned char *p, int len)
+{
+    (void) bs, (void) p, (void) len;
+    kind_push (BER_VPRIM);
+}
+
+static void
+kvis_num (struct bers *bs, unsigned int i)
+{
+    (void) bs, (void) i;
+    kind_push (BER_VPRIM);
+}
+
+static void
+kvis_boolean (struct bers *bs, int b)
+{
+    (void) bs, (void) b;
+    kind_push (BER_VPRIM);
+}
+
+static void
+kvis_nil (struct bers *bs)
+{
+    (void) bs;
+    kind_push (BER_VNIL);
+}
+
+static void
+kvis_pop (struct bers *bs)
+{
+    (void) bs;
+    --nkinds;
+}
+
+static void
+kvis_set (struct bers *bs, int no)
+{
+    (void) no;
+    kvis_pop (bs);
+}
+
+static int
+kvis_top (struct bers *bs)
+{
+    (void) bs;
+    return (nkinds) ? kinds[nkinds - 1] : BER_VNONE;
+}
+
+/* Nothing to encode */
+static int
+kvis_get (struct bers *bs, int no)
+{
+    (void) no;
+    kind_push (BER_VNIL);
+    return kvis_top (bs);
+}
+
+static const char *
+kvis_tostr (struct bers *bs, size_t *len)
+{
+    (void) bs;
+    *len = 0;
+    return NULL;
+}
+
+static unsigned int
+kvis_tonum (struct bers *bs)
+{
+    (void) bs;
+    return 0;
+}
+
+static int
+kvis_tobool (struct bers *bs)
+{
+    (void) bs;
+    return 0;
+}
+
+static const struct ber_visitor kinds_visitor = {
+    kvis_room, kvis_begin, kvis_mark, kvis_str, kvis_num, kvis_boolean,
+    kvis_nil, kvis_pop, kvis_set, kvis_pop, kvis_top, kvis_get,
+    kvis_tostr, kvis_tonum, kvis_tobool, NULL, NULL
+};
+
+/* ========================================>> */
+
+static unsigned char *
+file_read (const char *file, long *lenp)
+{
+    FILE *f = fopen (file, "rb");
+    unsigned char *p = NULL;
+
+    if (f && !fseek (f, 0, SEEK_END)) {
+	long len = ftell (f);
+	if (len > 0 && !fseek (f, 0, SEEK_SET)
+	 && (p = malloc (len)))
+	    *lenp = fread (p, 1, len, f);
+    }
+    if (f) fclose (f);
+    return p;
+}
+
+static void
+bench_file (const char *file)
+{
+    struct bers bs;
+    jmp_buf jb;
+    unsigned char *buf, *p;
+    long len = 0, ntlv, na;
+    double t;
+    int i, res;
+
+    if (!(buf = file_read (file, &len)))
+	err_quit ("Cannot read %s", file);
+    p = buf;
+    ntlv = tlv_count (&p, buf + len);
+
+    memset (&bs, 0, sizeof (struct bers));
+    bs.odr = &odr;
+    bs.vis = &luaber_visitor;
+    bs.ud = L;
+    bs.jb = &jb;
+    if (slice_min >= 0) {
+	bs.slice = bench_slice;
+	bs.slice_min = slice_min;
+    }
+    if ((res = setjmp (jb))) {
+	printf ("%-16s error: %s\n", file, ber_errstr (res));
+	ber_free (&bs);
+	free (buf);
+	return;
+    }
+    na = allocs;
+    t = now ();
+    for (i = 0; i < loops; ++i) {
+	bs.bp = bs.buf = buf;
+	bs.endp = buf + len;
+	ber_decode (&bs);
+	lua_settop (L, 0);
+    }
+    t = now () - t;
+    na = allocs - na;
+    printf ("%-16s %6ld bytes %5ld TLVs %10.1f ns/PDU %8.2f ns/TLV"
+     " %6.1f allocs/PDU\n", file, len, ntlv, t / loops, t / loops / ntlv,
+     (double) na / loops);
+    /* framing by headers only */
+    t = now ();
+    for (i = 0; i < loops; ++i)
+	if (ber_frame (buf, buf + len, 0, &res) != len)
+	    err_quit ("%s: framing failed", file);
+    t = now () - t;
+    printf ("%-16s %6ld bytes framed %10.1f ns/PDU\n", file, len, t / loops);
+    /* kinds of values of C visitor, without Lua */
+    if (visited) {
+	bs.vis = &kinds_visitor;
+	bs.ud = NULL;
+	bs.slice = NULL;
+	nvalues = 0;
+	t = now ();
+	for (i = 0; i < loops; ++i) {
+	    bs.bp = bs.buf = buf;
+	    bs.endp = buf + len;
+	    ber_decode (&bs);
+	    nkinds = 0;
+	}
+	t = now () - t;
+	printf ("%-16s %6ld bytes visited %10.1f ns/PDU %8.1f values/PDU\n",
+	 file, len, t / loops, (double) nvalues / loops);
+	/* tree of nodes in arena */
+	{
+	    struct ber_tree tr;
+	    struct ber_arena a;
+
+	    ber_arena_init (&a, arena, sizeof (arena));
+	    bs.vis = &ber_tree_visitor;
+	    bs.ud = &tr;
+	    t = now ();
+	    for (i = 0; i < loops; ++i) {
+		ber_arena_reset (&a);
+		ber_tree_init (&tr, &a);
+		bs.bp = bs.buf = buf;
+		bs.endp = buf + len;
+		ber_decode (&bs);
+	    }
+	    t = now () - t;
+	    printf ("%-16s %6ld bytes tree %10.1f ns/PDU %8lu arena bytes\n",
+	     file, len, t / loops, (unsigned long) a.used);
+	}
+    }
+    /* typed structs in arena, without Lua */
+    if (typed) {
+	struct ber_arena a;
+	struct z3950t_PDU *pdu;
+
+	ber_arena_init (&a, arena, sizeof (arena));
+	t = now ();
+	for (i = 0; i < loops; ++i) {
+	    ber_arena_reset (&a);
+	    if (z3950t_decode_PDU (&a, buf, len, &pdu) != len)
+		err_quit ("%s: typed decoding failed", file);
+	}
+	t = now () - t;
+	printf ("%-16s %6ld bytes typed %10.1f ns/PDU %8lu arena bytes\n",
+	 file, len, t / loops, (unsigned long) a.used);
+    }
+    ber_free (&bs);
+    free (buf);
+}
+
+/* Decode rounds of batches of n PDUs by pool */
+static double
+pool_time (struct ber_pool *pl, const struct bers *cfg, struct ber_job *jobs,
+ unsigned char **bufs, long *lens, const int n, const int rounds)
+{
+    double t = now ();
+    int i, k;
+
+    for (k = 0; k < rounds; ++k) {
+	for (i = 0; i < n; ++i) {
+	    jobs[i].p = bufs[i];
+	    jobs[i].len = lens[i];
+	}
+	ber_pool_run (pl, cfg, jobs, n);
+	for (i = 0; i < n; ++i) {
+	    if (jobs[i].res != lens[i])
+		err_quit ("pool decoding failed");
+	    ber_tree_free (jobs[i].mem);
+	}
+    }
+    return now () - t;
+}
+
+/* Batches of copies of files: copies are apart, as PDUs of a server.
+ * Files one by one with SEQUENCE OF's split by all threads
+ */
+static void
+bench_pool (char *files[], const int nfiles)
+{
+    const int njobs = nfiles * BENCH_BATCH;
+    const int batches = (loops > BENCH_BATCH) ? loops / BENCH_BATCH : 1;
+    struct ber_job *jobs = malloc (njobs * sizeof (struct ber_job));
+    unsigned char **bufs = malloc (njobs * sizeof (unsigned char *));
+    long *lens = malloc (njobs * sizeof (long));
+    struct bers cfg;
+    double t, t1 = 0, ts, ts1 = 0;
+    int i, k, n;
+
+    if (!jobs || !bufs || !lens)
+	err_quit ("Cannot allocate batch");
+    for (i = 0; i < nfiles; ++i) {
+	if (!(bufs[i] = file_read (files[i], &lens[i])))
+	    err_quit ("Cannot read %s", files[i]);
+	for (k = i + nfiles; k < njobs; k += nfiles) {
+	    if (!(bufs[k] = malloc (lens[i])))
+		err_quit ("Cannot allocate batch");
+	    memcpy (bufs[k], bufs[i], lens[i]);
+	    lens[k] = lens[i];
+	}
+    }
+    memset (&cfg, 0, sizeof (struct bers));
+    cfg.odr = &odr;
+    for (n = 1; ; n *= 2) {
+	struct ber_pool pl;
+
+	if (n > threads) n = threads;
+	if (ber_pool_init (&pl, n))
+	    err_quit ("Cannot init pool");
+	cfg.split_min = 0;
+	t = pool_time (&pl, &cfg, jobs, bufs, lens, njobs, batches);
+	cfg.split_min = BENCH_SPLIT;
+	ts = 0;
+	for (i = 0; i < nfiles; ++i)
+	    ts += pool_time (&pl, &cfg, jobs, bufs + i, lens + i, 1, loops);
+	if (n == 1) t1 = t, ts1 = ts;
+	printf ("pool %2d threads %6d PDUs/batch %10.1f ns/PDU %6.2fx"
+	 " split %10.1f ns/PDU %6.2fx\n", pl.nthreads + 1, njobs,
+	 t / batches / njobs, t1 / t, ts / loops / nfiles, ts1 / ts);
+	ber_pool_free (&pl);
+	if (n == threads) break;
+    }
+    for (i = 0; i < njobs; ++i)
+	free (bufs[i]);
+    free (lens);
+    free (bufs);
+    free (jobs);
+}
+
+static int
+file_odr_open (struct mmodr *mo, const char *file)
+{
+    long len = 0;
+    void *mp = file_read (file, &len);
+
+    if (mp && len) return mmodr_set (mo, mp, len);
+    free (mp);
+    return -1;
+}
+
+int
+main (int argc, char *argv[])
+{
+    int i, first;
+
+    progname = argv[0];
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i)
+	switch (argv[i][1]) {
+	case 'f':
+	    if (argv[i][2]) odrfile = &argv[i][2];
+	    else if (++i < argc) odrfile = argv[i];
+	    break;
+	case 'c':
+	    compiled = 1;
+	    break;
+	case 't':
+	    typed = 1;
+	    break;
+	case 'v':
+	    visited = 1;
+	    break;
+	case 'p':
+	    if (argv[i][2]) threads = atoi (&argv[i][2]);
+	    else if (++i < argc) threads = atoi (argv[i]);
+	    break;
+	case 'n':
+	    if (argv[i][2]) loops = atoi (&argv[i][2]);
+	    else if (++i < argc) loops = atoi (argv[i]);
+	    break;
+	case 's':
+	    if (argv[i][2]) slice_min = atoi (&argv[i][2]);
+	    else if (++i < argc) slice_min = atoi (argv[i]);
+	    break;
+	default:
+	    err_quit (usage, progname);
+	}
+    if (!(odrfile || compiled) || i >= argc || loops <= 0)
+	err_quit (usage, progname);
+    if (compiled) {
+	if (z3950c_set (&odr))
+	    err_quit ("bad compiled odr");
+	odrfile = "compiled";
+    } else if (file_odr_open (&odr, odrfile))
+	err_quit ("bad odr file");
+    printf ("%s (%s dispatch index", odrfile,
+     odr.disps ? "with" : "without");
+    if (slice_min >= 0) printf (", slices of %d+ octets", slice_min);
+    printf (")\n");
+
+    L = lua_newstate (bench_alloc, NULL);
+    if (!L) err_quit ("Cannot init Lua");
+    for (first = i; i < argc; ++i)
+	bench_file (argv[i]);
+    if (threads > 0) bench_pool (&argv[first], argc - first);
+
+    if (!compiled) free (odr.odrs);
+    lua_close (L);
+    return EXIT_SUCCESS;
+}
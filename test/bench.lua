@@ -0,0 +1,154 @@
+-- Benchmark decoding of pipelined PDUs: tail strings vs positions,
+-- and encoding by chunks vs encode_all
+
+local ber = require "ber"
+
+local COPIES = 200	-- PDUs of each file in the stream
+local LOOPS = 20	-- decodes of the stream
+
+local odrfile = arg[1]
+if not odrfile or not arg[2] then
+    io.stderr:write("Usage: ", arg[0], " ODR FILE ...\n")
+    os.exit(1)
+end
+
+local function readfile(file)
+    local f = assert(io.open(file, "rb"))
+    local s = f:read("*a")
+    f:close()
+    return s
+end
+
+local odrstr = readfile(odrfile)
+local odr = ber.odr()
+assert(odr:set(odrstr), "bad odr file")
+
+-- One receive buffer with all PDUs
+local pdus = {}
+for i = 2, #arg do
+    pdus[#pdus + 1] = readfile(arg[i])
+end
+local npdu = #pdus * COPIES
+local stream = string.rep(table.concat(pdus), COPIES)
+
+-- Decode a new tail string after each PDU
+local function by_tail(bc, s)
+    local n, v = 0
+    while #s > 0 do
+	s, v = bc:decode(s)
+	assert(type(v) == "table", "incomplete PDU")
+	n = n + 1
+    end
+    return n
+end
+
+-- Decode from the position, where the previous PDU ends
+local function by_position(bc, s)
+    local n, pos, v = 0, 1
+    while pos <= #s do
+	pos, v = bc:decode(s, pos)
+	assert(type(v) == "table", "incomplete PDU")
+	n = n + 1
+    end
+    return n
+end
+
+-- Decode all PDUs in one call
+local function all(bc, s)
+    local t, pos = bc:decode_all(s)
+    assert(t and pos == #s + 1, "incomplete PDU")
+    return #t
+end
+
+print(string.format("%s (%d PDUs, %d bytes in stream)",
+    odrfile, npdu, #stream))
+for _, b in ipairs{{"tail", by_tail}, {"position", by_position},
+    {"decode_all", all}} do
+    local bc = odr:ber()
+    local t = os.clock()
+    for _ = 1, LOOPS do
+	assert(b[2](bc, stream) == npdu)
+    end
+    t = os.clock() - t
+    print(string.format("%-16s %10.1f ns/PDU", b[1],
+	t * 1e9 / LOOPS / npdu))
+end
+
+-- Encode by BUFSIZ chunks, concatenated (of definite lengths?)
+local function chunks(bc, t, definite)
+    local parts, s, done = {}
+    repeat
+	s, done = bc:encode(t, definite)
+	assert(s, "encode error")
+	parts[#parts + 1] = s
+    until done
+    return #table.concat(parts)
+end
+
+local function definite(bc, t)
+    return chunks(bc, t, true)
+end
+
+-- Encode into the growing buffer of codec
+local function encode_all(bc, t)
+    return #assert(bc:encode_all(t))
+end
+
+-- Octets between strings of at least 64 octets, which are in place
+local function encode_iov(bc, t)
+    local size = 0
+    for _, s in ipairs(assert(bc:encode_iov(t, 64))) do
+	size = size + #s
+    end
+    return size
+end
+
+-- Chunks to a sink function, without returns to Lua
+local function encode_into(bc, t)
+    local size = 0
+    assert(bc:encode_into(function(s) size = size + #s end, t))
+    return size
+end
+
+-- Sizing pass only
+local function encoded_size(bc, t)
+    return assert(bc:encoded_size(t))
+end
+
+local values, raws = {}, {}
+do
+    local bc = odr:ber()
+    for i = 1, #pdus do
+	local _, v = bc:decode(pdus[i])
+	values[i] = v
+	-- the same PDU pre-encoded, spliced in by the encoder
+	local k = next(v)
+	raws[i] = {[k] = assert(ber.raw(pdus[i]))}
+    end
+end
+
+-- Encode PDU of pre-encoded value
+local function encode_raw(bc, _, i)
+    return #assert(bc:encode_all(raws[i]))
+end
+
+-- Compiled encoders of the test ASN.1 (asn2odr -C), when built
+local compiled, codr = pcall(require, "z3950c")
+
+for _, b in ipairs{{"encode", chunks}, {"encode definite", definite},
+    {"encode_all", encode_all}, {"encode_iov", encode_iov},
+    {"encode_into", encode_into},
+    {"encoded_size", encoded_size}, {"encode_all raw", encode_raw},
+    compiled and {"encode_all -C", encode_all, codr} or nil} do
+    local bc = (b[3] or odr):ber()
+    local size = 0
+    local t = os.clock()
+    for _ = 1, COPIES do
+	for i = 1, #values do
+	    size = size + b[2](bc, values[i], i)
+	end
+    end
+    t = os.clock() - t
+    print(string.format("%-16s %10.1f ns/PDU %8d bytes/PDU", b[1],
+	t * 1e9 / npdu, math.floor(size / npdu)))
+end
@@ -10,6 +10,7 @@
 #include "lualib.h"
 
 #include "ber.h"
+#include "luaber.h"
 
 #define BUF_SIZ		BUFSIZ
 
@@ -38,36 +39,42 @@ static void
 event_loop ()
 {
     unsigned char buffer[BUF_SIZ];
-    int i, tl = 0;
+    unsigned char *endp = buffer; /* end of read octets */
+    int i;
 
-    bs.L = L;
-    bs.bp = bs.buf = buffer;
+    bs.vis = &luaber_visitor;
+    bs.ud = L;
+    bs.bp = buffer;
 
 #if LUA_VERSION_NUM < 503
-    lua_pushstring (bs.L, "QI");
+    lua_pushstring (L, "QI");
 #endif
 
     do {
-	i = read (0, bs.bp, BUF_SIZ - tl);
-	if (!i) return;
-	bs.endp = bs.bp + i;
-	bs.bp = bs.buf;
+	/* move the undecoded tail only when the buffer is full */
+	if (endp == buffer + BUF_SIZ) {
+	    i = endp - bs.bp;
+	    memmove (buffer, bs.bp, i);
+	    bs.bp = buffer;
+	    endp = buffer + i;
+	}
+	i = read (0, endp, buffer + BUF_SIZ - endp);
+	if (i <= 0) return;
+	endp += i;
 
+	/* decode from the position, where the previous call stopped */
+	bs.buf = bs.bp;
+	bs.endp = endp;
 	i = ber_decode (&bs);
-	if (bs.bp < bs.endp) {
-	    tl = bs.endp - bs.bp;
-	    memcpy (bs.buf, bs.bp, tl);
-	    bs.bp = bs.buf + tl;
-	} else {
-	    tl = 0;
-	    bs.bp = bs.buf;
-	}
+	if (bs.bp > endp) bs.bp = endp;
     } while (i == BER_INCOMPL);
 
+    bs.bp = bs.buf = buffer;
+
 #if LUA_VERSION_NUM >= 503
-    lua_setglobal (bs.L, "QI");
+    lua_setglobal (L, "QI");
 #else
-    lua_rawset (bs.L, LUA_GLOBALSINDEX);
+    lua_rawset (L, LUA_GLOBALSINDEX);
 #endif
 
     luaL_dofile (L, luafile);
@@ -76,10 +83,10 @@ event_loop ()
     bs.endp = bs.buf + BUF_SIZ;
 
 #if LUA_VERSION_NUM >= 503
-    lua_getglobal(bs.L, "QO");
+    lua_getglobal(L, "QO");
 #else
-    lua_pushstring (bs.L, "QO");
-    lua_rawget (bs.L, LUA_GLOBALSINDEX);
+    lua_pushstring (L, "QO");
+    lua_rawget (L, LUA_GLOBALSINDEX);
 #endif
 
     while ((i = ber_encode (&bs)) == BER_INCOMPL) {
@@ -162,6 +169,7 @@ main (int argc, char *argv[])
     if (!ret) event_loop ();
     else err_quit ("Error: %s", ber_errstr (ret));
 
+    ber_free (&bs);
     free (odr.odrs);
     lua_close (L);
     return EXIT_SUCCESS;
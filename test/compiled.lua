@@ -0,0 +1,80 @@
+-- Checks of compiled decoders and encoders (asn2odr -C): their results
+-- must match ones of the interpreter
+
+local ber = require "ber"
+
+local module, odrfile = arg[1], arg[2]
+if not module or not odrfile or not arg[3] then
+    io.stderr:write("Usage: ", arg[0], " MODULE ODR FILE ...\n")
+    os.exit(1)
+end
+
+local function readfile(file)
+    local f = assert(io.open(file, "rb"))
+    local s = f:read("*a")
+    f:close()
+    return s
+end
+
+local odrstr = readfile(odrfile)
+local odr = ber.odr()
+assert(odr:set(odrstr), "bad odr file")
+local meta = getmetatable(odr:ber())
+local index = meta.__index
+local codr = require(module)
+
+local nfail = 0
+
+local function check(ok, name, what)
+    if not ok then
+	nfail = nfail + 1
+	print("FAIL", name, what)
+    end
+end
+
+-- The module shares the library loaded by require "ber"
+check(getmetatable(codr:ber()) == meta and meta.__index == index
+ and getmetatable(codr) == getmetatable(odr), module, "metatables")
+
+local function same(a, b)
+    if type(a) ~= "table" or type(b) ~= "table" then return a == b end
+    for k, v in pairs(a) do
+	if not same(v, b[k]) then return false end
+    end
+    for k in pairs(b) do
+	if a[k] == nil then return false end
+    end
+    return true
+end
+
+local nchecks = 0
+
+for i = 3, #arg do
+    local name, s = arg[i], readfile(arg[i])
+    local bi, bc = odr:ber(), codr:ber()
+    local vi, vc = bi:decode_all(s), bc:decode_all(s)
+    check(#vi == #vc, name, "count of PDUs")
+    for j = 1, #vi do
+	local ei, ec = bi:encode_all(vi[j]), bc:encode_all(vi[j])
+	local vr = ec and bc:decode_all(ec)
+	check(same(vi[j], vc[j]), name, "decoded PDU " .. j)
+	check(ei == ec, name, "encoded PDU " .. j)
+	check(type(vr) == "table" and same(vr[1], vi[j]), name,
+	 "re-decoded PDU " .. j)
+	nchecks = nchecks + 1
+    end
+end
+
+-- Unused bits of BIT STRING are masked in the values, not in the source
+local pdu = "\180\33\131\2\5\231\132\3\0\233\162\133\3\16\0\0"
+ .. "\134\3\16\0\0\159\111\3YAZ\159\112\0052.0.1"
+local _, vc = codr:ber():decode(pdu)
+local _, vi = odr:ber():decode(pdu)
+check(type(vc) == "table" and same(vc, vi) and vc[1][1][2] == "\7"
+ and pdu:byte(6) == 231, "known", "masked BIT STRING")
+
+if nfail > 0 then
+    print(nfail .. " checks failed")
+    os.exit(1)
+end
+print("compiled: " .. nchecks .. " PDUs of files matched")